@@ -48,17 +48,23 @@ static const wxString units3_names[] = {"Celcius", "Fahrenheit", wxEmptyString};
 static const wxString units4_names[] = {"Percent", wxEmptyString};
 static const wxString units5_names[] = {"Unknown", wxEmptyString};
 static const wxString units6_names[] = {"Meters", "Feet", wxEmptyString};
+static const wxString units8_names[] = {"Tracks", wxEmptyString};
 static const wxString *unit_names[] = {units0_names, units1_names, units2_names,
                                        units3_names, units4_names, units5_names,
-				       units6_names};
+				       units6_names, units3_names, units8_names};
 
 static const wxString name_from_index[] = {"Wind", "Current",
                                            "Sea Level Pressure", "Sea Surface Temperature",
                                            "Air Temperature",
                                            "Cloud Cover", "Precipitation",
-                                           "Relative Humidity", "Lightning", "Sea Depth"};
+                                           "Relative Humidity", "Lightning", "Sea Depth",
+                                           "Dew Point", "Wind Chill", "Current Corrected Wind",
+                                           "Sea Air Temperature Difference", "Expression",
+                                           "Cyclone Density"};
 
-static const int unittype[ClimatologyOverlaySettings::SETTINGS_COUNT] = {0, 0, 1, 3, 3, 4, 2, 4, 5, 6};
+/* 7 is a temperature difference, converted without the offset, 8 a count */
+static const int unittype[ClimatologyOverlaySettings::SETTINGS_COUNT] = {0, 0, 1, 3, 3, 4, 2, 4, 5, 6,
+                                                                          3, 3, 0, 7, 5, 8};
 
 wxString ClimatologyConfigDialog::SettingName(int setting)
 {
@@ -109,6 +115,11 @@ double ClimatologyOverlaySettings::CalibrationFactor(int setting)
         case METERS: return 1;
         case FEET:   return 3.28;
         } break;
+    case 7: switch(Settings[setting].m_Units) {
+        case CELCIUS:     return 1;
+        case FAHRENHEIT: return 9./5;
+        } break;
+    case 8: return 1;
     }
         
     return 1;
@@ -123,6 +134,9 @@ void ClimatologyOverlaySettings::Load()
 
     pConf->SetPath("/PlugIns/Climatology");
 
+    pConf->Read ( "CoastalFillCells" , &m_iCoastalFillCells, 0);
+    pConf->Read ( "Expression" , &m_sExpression, "precip*cloud/100");
+
     for(int i=0; i<SETTINGS_COUNT; i++) {
         wxString Name=name_from_index[i];
 
@@ -134,20 +148,20 @@ void ClimatologyOverlaySettings::Load()
                       i == WIND || i == CURRENT );
         pConf->Read ( Name +   "OverlayMap" , &Settings[i].m_bOverlayMap,
                       i == SST || i == AT || i==CLOUD || i == PRECIPITATION
-                      || i == RELATIVE_HUMIDITY || i == LIGHTNING || i == SEADEPTH);
+                      || i == RELATIVE_HUMIDITY || i == LIGHTNING || i == SEADEPTH
+                      || i == DEWPOINT || i == WINDCHILL || i == CURRENT_WIND || i == SST_AT
+                      || i == EXPRESSION || i == CYCLONE_DENSITY);
         pConf->Read ( Name +   "OverlayTransparency" , &Settings[i].m_iOverlayTransparency,
                       0 );
         pConf->Read ( Name +   "OverlayInterpolation" , &Settings[i].m_bOverlayInterpolation,
                       true );
 
         pConf->Read ( Name +   "IsoBars" , &Settings[i].m_bIsoBars, i==SLP);
-        double defspacing[SETTINGS_COUNT] = {5, 2, 10, 5, 5, 20, 1, 10, 30, 1000};
+        double defspacing[SETTINGS_COUNT] = {5, 2, 10, 5, 5, 20, 1, 10, 30, 1000,
+                                             5, 5, 5, 1, 10, 5};
         pConf->Read ( Name +   "IsoBarSpacing" , &Settings[i].m_iIsoBarSpacing, defspacing[i]);
         pConf->Read ( Name +   "IsoBarStep" , &Settings[i].m_iIsoBarStep, 2);
 
-        for(int m = 0; m<13; m++)
-            Settings[i].m_pIsobars[m] = NULL;
-
         pConf->Read ( Name +   "Numbers" , &Settings[i].m_bNumbers, 0);
         pConf->Read ( Name +   "NumbersSpacing" , &Settings[i].m_iNumbersSpacing, 50);
 
@@ -191,6 +205,9 @@ void ClimatologyOverlaySettings::Save()
 
     pConf->SetPath (  "/PlugIns/Climatology"  );
 
+    pConf->Write ( "CoastalFillCells" , m_iCoastalFillCells);
+    pConf->Write ( "Expression" , m_sExpression);
+
     for(int i=0; i<SETTINGS_COUNT; i++) {
         wxString Name=name_from_index[i];
 
@@ -253,6 +270,21 @@ ClimatologyConfigDialog::ClimatologyConfigDialog(ClimatologyDialog *parent)
                                            PLUGIN_VERSION_MAJOR, PLUGIN_VERSION_MINOR));
     m_tDataDirectory->SetValue(ClimatologyDataDirectory());
 
+    /* coastal fill only happens as the data loads, so it has no place
+       among the display settings, it sits with the data directory */
+    wxSizer *datasizer = m_tDataDirectory->GetContainingSizer();
+    wxWindow *datapanel = m_tDataDirectory->GetParent();
+    datasizer->Add( new wxStaticText( datapanel, wxID_ANY, _("Coastal Fill Cells") ),
+                    0, wxALL, 5 );
+    m_sCoastalFillCells = new wxSpinCtrl( datapanel, wxID_ANY, wxEmptyString,
+                                          wxDefaultPosition, wxDefaultSize,
+                                          wxSP_ARROW_KEYS, 0, 10,
+                                          m_Settings.m_iCoastalFillCells );
+    m_sCoastalFillCells->SetToolTip( _("Grid cells to extend the data into land along the coast, so positions near shore have values. 0 disables. Takes effect when OpenCPN is restarted.") );
+    datasizer->Add( m_sCoastalFillCells, 0, wxALL, 5 );
+    m_sCoastalFillCells->Connect( wxEVT_COMMAND_SPINCTRL_UPDATED, wxSpinEventHandler
+                                  ( ClimatologyConfigDialog::OnCoastalFillCells ), NULL, this );
+
     m_refreshTimer.Connect(wxEVT_TIMER, wxTimerEventHandler(ClimatologyConfigDialog::OnRefreshTimer) , NULL, this);
 
     DimeWindow( this );
@@ -471,6 +503,11 @@ void ClimatologyConfigDialog::OnUpdateIsobar()
     OnUpdate();
 }
 
+void ClimatologyConfigDialog::OnCoastalFillCells( wxSpinEvent& event )
+{
+    m_Settings.m_iCoastalFillCells = m_sCoastalFillCells->GetValue();
+}
+
 void ClimatologyConfigDialog::OnUpdateCyclones()
 {
     g_pOverlayFactory->BuildCycloneCache();
@@ -498,7 +535,7 @@ void ClimatologyConfigDialog::OnPaintKey( wxPaintEvent& event )
 
     window->GetName().ToDouble(&knots);
 
-    wxColour c = ClimatologyOverlayFactory::GetGraphicColor(CYCLONE_SETTING, knots);
+    wxColour c = ClimatologyOverlayFactory::GetColorMapColor(CYCLONE_COLORMAP, knots);
 
     dc.SetBackground(c);
     dc.Clear();
@@ -515,6 +552,12 @@ void ClimatologyConfigDialog::OnAboutAuthor( wxCommandEvent& event )
     wxLaunchDefaultBrowser(ABOUT_AUTHOR_URL);
 }
 
+void ClimatologyConfigDialog::RefreshLater(int ms)
+{
+    if(!m_refreshTimer.IsRunning())
+        m_refreshTimer.Start(ms, true);
+}
+
 void ClimatologyConfigDialog::OnRefreshTimer( wxTimerEvent& event )
 {
     pParent->RefreshRedraw();
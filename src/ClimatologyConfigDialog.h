@@ -33,9 +33,14 @@
 #include "wx/wx.h"
 #endif //precompiled headers
 
+#include <list>
+#include <map>
+#include <memory>
+
 #include "ClimatologyUI.h"
 
 class ClimatologyIsoBarMap;
+class IsoBarGrid;
 
 struct ClimatologyOverlaySettings
 {
@@ -49,7 +54,12 @@ struct ClimatologyOverlaySettings
     void Save();
 
     enum SettingsType {WIND, CURRENT, SLP, SST, AT, CLOUD, PRECIPITATION,
-                       RELATIVE_HUMIDITY, LIGHTNING, SEADEPTH, SETTINGS_COUNT};
+                       RELATIVE_HUMIDITY, LIGHTNING, SEADEPTH,
+                       /* derived from the datasets above */
+                       DEWPOINT, WINDCHILL, CURRENT_WIND, SST_AT,
+                       EXPRESSION, /* typed by the user */
+                       CYCLONE_DENSITY, /* from the cyclone tracks */
+                       SETTINGS_COUNT};
     enum Units0 {KNOTS, M_S, MPH, KPH};
     enum Units1 {MILLIBARS, MMHG};
     enum Units2 {MM_DAY, IN_DAY, MM_MONTH, M_MONTH, IN_MONTH, FT_MONTH, M_YEAR, IN_YEAR, FT_YEAR};
@@ -68,7 +78,10 @@ struct ClimatologyOverlaySettings
 
         bool m_bIsoBars;
         int m_iIsoBarSpacing, m_iIsoBarStep;
-        ClimatologyIsoBarMap *m_pIsobars[13];
+        /* maps of recent days and settings, the last shown first */
+        std::list<ClimatologyIsoBarMap*> m_IsoBarMaps;
+        /* samples kept by month and step for the isobars to contour */
+        std::map<double, std::shared_ptr<IsoBarGrid> > m_IsoBarGrids[13];
 
         bool m_bNumbers;
         double m_iNumbersSpacing;
@@ -78,6 +91,12 @@ struct ClimatologyOverlaySettings
         wxColour m_cDirectionArrowsColor;
         int m_iDirectionArrowsSize, m_iDirectionArrowsSpacing;
     } Settings[SETTINGS_COUNT];
+
+    /* grid cells to extrapolate data into land at load time, 0 disables */
+    int m_iCoastalFillCells;
+
+    /* formula shown by the EXPRESSION setting */
+    wxString m_sExpression;
 };
 
 class ClimatologyDialog;
@@ -90,6 +109,8 @@ public:
 
     wxString SettingName(int setting);
     void DisableIsoBars(int setting);
+    /* redraw the chart after ms unless a redraw is already due */
+    void RefreshLater(int ms);
 
     void OnDataTypeChoice( wxCommandEvent& event );
 
@@ -117,6 +138,8 @@ private:
     void OnUpdateSpinIsobar( wxSpinEvent& event ) { OnUpdateIsobar(); }
     void OnUpdateIsobar( wxCommandEvent& event ) { OnUpdateIsobar(); }
 
+    void OnCoastalFillCells( wxSpinEvent& event );
+
     void OnUpdateCyclones();
     void OnUpdateCyclonesDate( wxDateEvent& event ) { OnUpdateCyclones(); }
     void OnUpdateCyclonesSpin( wxSpinEvent& event ) { OnUpdateCyclones(); }
@@ -133,6 +156,8 @@ private:
     int m_lastdatatype;
 
     ClimatologyDialog *pParent;
+
+    wxSpinCtrl *m_sCoastalFillCells;
     
     wxTimer m_refreshTimer;
 };
@@ -38,6 +38,8 @@
 #include "climatology_pi.h"
 #include "ClimatologyDialog.h"
 #include "ClimatologyConfigDialog.h"
+#include "DerivedFields.h"
+#include "Expression.h"
 
 ClimatologyDialog::ClimatologyDialog(wxWindow *parent, climatology_pi *ppi)
 #ifndef __WXOSX__
@@ -51,6 +53,8 @@ ClimatologyDialog::ClimatologyDialog(wxWindow *parent, climatology_pi *ppi)
     GetHandle()->setStyleSheet( qtStyleSheet);
 #endif
     m_cfgdlg = new ClimatologyConfigDialog(this);
+    CreateDerivedControls();
+    CreateChartControls();
 
     Now();
 
@@ -108,6 +112,10 @@ void ClimatologyDialog::UpdateTrackingControls()
     m_tRelativeHumidity->SetValue(GetValue(ClimatologyOverlaySettings::RELATIVE_HUMIDITY));
     m_tLightning->SetValue(GetValue(ClimatologyOverlaySettings::LIGHTNING));
     m_tSeaDepth->SetValue(GetValue(ClimatologyOverlaySettings::SEADEPTH));
+    for(int i=0; i<DERIVED_COUNT; i++)
+        m_tDerived[i]->SetValue(GetValue(ClimatologyOverlaySettings::DEWPOINT + i));
+
+    UpdateChart();
 }
 
 void ClimatologyDialog::PopulateTrackingControls()
@@ -128,6 +136,12 @@ void ClimatologyDialog::PopulateTrackingControls()
     SetControlsVisible(ClimatologyOverlaySettings::RELATIVE_HUMIDITY, m_cbRelativeHumidity, m_tRelativeHumidity);
     SetControlsVisible(ClimatologyOverlaySettings::LIGHTNING, m_cbLightning, m_tLightning);
     SetControlsVisible(ClimatologyOverlaySettings::SEADEPTH, m_cbSeaDepth, m_tSeaDepth);
+    for(int i=0; i<DERIVED_COUNT; i++) {
+        int setting = ClimatologyOverlaySettings::DEWPOINT + i;
+        SetControlsVisible((ClimatologyOverlaySettings::SettingsType)setting,
+                           m_cbDerived[i], m_tDerived[i],
+                           setting == ClimatologyOverlaySettings::EXPRESSION ? m_tExpression : NULL);
+    }
 
     Refresh();
     Fit();
@@ -170,9 +184,29 @@ wxCheckBox *ClimatologyDialog::GetSettingControl(int setting)
     case ClimatologyOverlaySettings::LIGHTNING:     return m_cbLightning;
     case ClimatologyOverlaySettings::SEADEPTH:      return m_cbSeaDepth;
     }
+    if(setting >= ClimatologyOverlaySettings::DEWPOINT &&
+       setting < ClimatologyOverlaySettings::SETTINGS_COUNT)
+        return m_cbDerived[setting - ClimatologyOverlaySettings::DEWPOINT];
     return NULL;
 }
 
+/* derived settings are available once every dataset they read loaded,
+   expressions may read anything so they are always available, and
+   cyclone density needs the cyclone tracks */
+void ClimatologyDialog::EnableDerivedSettings()
+{
+    for(int i=0; i<DERIVED_COUNT; i++) {
+        const DerivedFields::Field *field =
+            DerivedFields::GetField(ClimatologyOverlaySettings::DEWPOINT + i);
+        bool enable = true;
+        for(int k=0; field && enable && k<field->inputs; k++)
+            enable = GetSettingControl(field->input[k].setting)->IsEnabled();
+        if(ClimatologyOverlaySettings::DEWPOINT + i == ClimatologyOverlaySettings::CYCLONE_DENSITY)
+            enable = m_cbCyclones->IsEnabled();
+        m_cbDerived[i]->Enable(enable);
+    }
+}
+
 void ClimatologyDialog::SetControlsVisible(ClimatologyOverlaySettings::SettingsType type,
                                            wxControl *ctrl1, wxControl *ctrl2, wxControl *ctrl3)
 {
@@ -196,6 +230,168 @@ wxString ClimatologyDialog::GetValue(int index, Coord coord)
     return wxString::Format("%.2f", val);
 }
 
+void ClimatologyDialog::CreateDerivedControls()
+{
+    wxWindow *parent = m_cbSeaDepth->GetParent();
+    wxSizer *sizer = m_cbSeaDepth->GetContainingSizer();
+
+    /* keep the cyclones check box and config button last */
+    sizer->Detach(m_cbCyclones);
+    sizer->Detach(m_bConfig);
+
+    for(int i=0; i<DERIVED_COUNT; i++) {
+        int setting = ClimatologyOverlaySettings::DEWPOINT + i;
+        m_cbDerived[i] = new wxCheckBox( parent, wxID_ANY, m_cfgdlg->SettingName(setting) );
+        m_cbDerived[i]->Enable( false );
+        sizer->Add( m_cbDerived[i], 0, wxALL, 5 );
+
+        m_tDerived[i] = new wxTextCtrl( parent, wxID_ANY, wxEmptyString );
+        sizer->Add( m_tDerived[i], 0, wxALL, 5 );
+
+        m_cbDerived[i]->Connect( wxEVT_COMMAND_CHECKBOX_CLICKED, wxCommandEventHandler
+                                 ( ClimatologyDialog::OnUpdateDisplay ), NULL, this );
+
+        /* the formula goes on its own row under the expression */
+        if(setting != ClimatologyOverlaySettings::EXPRESSION)
+            continue;
+
+        m_tExpression = new wxTextCtrl( parent, wxID_ANY, m_cfgdlg->m_Settings.m_sExpression,
+                                        wxDefaultPosition, wxDefaultSize, wxTE_PROCESS_ENTER );
+        m_tExpression->SetToolTip( Expression::Help() );
+        sizer->Add( m_tExpression, 0, wxALL|wxEXPAND, 5 );
+        sizer->AddSpacer( 0 );
+        m_tExpression->Connect( wxEVT_COMMAND_TEXT_ENTER, wxCommandEventHandler
+                                ( ClimatologyDialog::OnExpression ), NULL, this );
+    }
+
+    sizer->Add( m_cbCyclones, 0, wxALL, 5 );
+    sizer->Add( m_bConfig, 0, wxALL, 5 );
+}
+
+void ClimatologyDialog::OnExpression( wxCommandEvent& event )
+{
+    wxString text = m_tExpression->GetValue(), error;
+    if(g_pOverlayFactory && !g_pOverlayFactory->SetExpression(text, error)) {
+        m_tExpression->SetBackgroundColour( wxColour(255, 192, 192) );
+        m_tExpression->SetToolTip( error + "\n\n" + Expression::Help() );
+        m_tExpression->Refresh();
+        return;
+    }
+
+    m_tExpression->SetBackgroundColour( wxNullColour );
+    m_tExpression->SetToolTip( Expression::Help() );
+    m_tExpression->Refresh();
+
+    m_cfgdlg->m_Settings.m_sExpression = text;
+    UpdateTrackingControls();
+    RefreshRedraw();
+}
+
+void ClimatologyDialog::CreateChartControls()
+{
+    m_bChartValid = false;
+
+    wxStaticBoxSizer *sbChart = new wxStaticBoxSizer
+        ( new wxStaticBox( this, wxID_ANY, _("Climate Chart") ), wxVERTICAL );
+
+    m_cChartSetting = new wxChoice( sbChart->GetStaticBox(), wxID_ANY );
+    m_cChartSetting->Append(_("None"));
+    for(int i=0; i<ClimatologyOverlaySettings::SETTINGS_COUNT; i++)
+        m_cChartSetting->Append(GetSettingControl(i)->GetLabel());
+    m_cChartSetting->SetSelection(0);
+    sbChart->Add( m_cChartSetting, 0, wxALL|wxEXPAND, 5 );
+
+    m_pChart = new wxPanel( sbChart->GetStaticBox(), wxID_ANY, wxDefaultPosition, wxSize( 220,100 ) );
+    m_pChart->Hide();
+    sbChart->Add( m_pChart, 1, wxALL|wxEXPAND, 5 );
+
+    GetSizer()->Add( sbChart, 0, wxEXPAND, 5 );
+
+    m_cChartSetting->Connect( wxEVT_COMMAND_CHOICE_SELECTED, wxCommandEventHandler
+                              ( ClimatologyDialog::OnChartSetting ), NULL, this );
+    m_pChart->Connect( wxEVT_PAINT, wxPaintEventHandler
+                       ( ClimatologyDialog::OnChartPaint ), NULL, this );
+}
+
+void ClimatologyDialog::UpdateChart()
+{
+    int setting = m_cChartSetting->GetSelection() - 1;
+    if(setting < 0 || !g_pOverlayFactory)
+        return;
+
+    m_bChartValid = g_pOverlayFactory->getDailyValues
+        (MAG, setting, m_cursorlat, m_cursorlon, m_ChartValues);
+    for(int i=0; i<365; i++)
+        m_ChartValues[i] = m_cfgdlg->m_Settings.CalibrateValue(setting, m_ChartValues[i]);
+
+    m_pChart->Refresh();
+}
+
+void ClimatologyDialog::OnChartSetting( wxCommandEvent& event )
+{
+    m_pChart->Show(m_cChartSetting->GetSelection() > 0);
+    UpdateChart();
+    Fit();
+}
+
+void ClimatologyDialog::OnChartPaint( wxPaintEvent& event )
+{
+    wxPaintDC dc(m_pChart);
+    int w, h;
+    m_pChart->GetClientSize(&w, &h);
+
+    dc.SetBrush(*wxWHITE_BRUSH);
+    dc.SetPen(*wxBLACK_PEN);
+    dc.DrawRectangle(0, 0, w, h);
+
+    /* month divisions */
+    dc.SetPen(wxPen(wxColour(200, 200, 200)));
+    for(int month=1, day=0; month<12; month++) {
+        day += wxDateTime::GetNumberOfDays((wxDateTime::Month)(month-1), 1999);
+        int x = day * w / 365;
+        dc.DrawLine(x, 0, x, h);
+    }
+
+    if(!m_bChartValid)
+        return;
+
+    double min = INFINITY, max = -INFINITY;
+    for(int i=0; i<365; i++)
+        if(!isnan(m_ChartValues[i])) {
+            min = wxMin(min, m_ChartValues[i]);
+            max = wxMax(max, m_ChartValues[i]);
+        }
+    if(min > max)
+        return;
+    if(max - min < 1e-6)
+        max = min + 1;
+
+    int th = dc.GetCharHeight(), top = th, bottom = h - th;
+    dc.SetPen(wxPen(*wxBLUE, 2));
+    wxPoint points[365];
+    int count = 0;
+    for(int i=0; i<=365; i++) {
+        if(i == 365 || isnan(m_ChartValues[i])) {
+            if(count > 1)
+                dc.DrawLines(count, points);
+            count = 0;
+            continue;
+        }
+        points[count++] = wxPoint(i * w / 365,
+                                  bottom - (m_ChartValues[i] - min) * (bottom - top) / (max - min));
+    }
+
+    /* current day */
+    if(g_pOverlayFactory && !g_pOverlayFactory->m_bAllTimes) {
+        int x = (g_pOverlayFactory->m_CurrentTimeline.GetDayOfYear() - 1) * w / 365;
+        dc.SetPen(wxPen(*wxRED));
+        dc.DrawLine(x, 0, x, h);
+    }
+
+    dc.DrawText(wxString::Format("%.1f", max), 2, 0);
+    dc.DrawText(wxString::Format("%.1f", min), 2, h - th);
+}
+
 void ClimatologyDialog::DayMonthUpdate()
 {
     wxDateTime &timeline = g_pOverlayFactory->m_CurrentTimeline;
@@ -60,6 +60,7 @@ public:
     void SetCursorLatLon(double lat, double lon);
     bool SettingEnabled(int setting);
     void DisableSetting(int setting);
+    void EnableDerivedSettings();
 
     void FitLater() { m_fittimer.Start(100, true); }
     void Save();
@@ -91,6 +92,14 @@ private:
 
     void OnFitTimer( wxTimerEvent & ) { Fit(); }
 
+    void CreateDerivedControls();
+    void OnExpression( wxCommandEvent& event );
+
+    void CreateChartControls();
+    void UpdateChart();
+    void OnChartSetting( wxCommandEvent& event );
+    void OnChartPaint( wxPaintEvent& event );
+
     void Now();
     
     wxWindow *pParent;
@@ -98,6 +107,19 @@ private:
     double m_cursorlat, m_cursorlon;
 
     wxTimer m_fittimer;
+
+    /* settings without generated controls, from DEWPOINT on */
+    enum {DERIVED_COUNT = ClimatologyOverlaySettings::SETTINGS_COUNT
+          - ClimatologyOverlaySettings::DEWPOINT};
+    wxCheckBox *m_cbDerived[DERIVED_COUNT];
+    wxTextCtrl *m_tDerived[DERIVED_COUNT];
+    wxTextCtrl *m_tExpression;
+
+    /* climate chart of the selected dataset over the year at the cursor */
+    wxChoice *m_cChartSetting;
+    wxPanel *m_pChart;
+    double m_ChartValues[365];
+    bool m_bChartValid;
 };
 
 #endif
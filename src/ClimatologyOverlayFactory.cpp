@@ -25,6 +25,10 @@
  *
  */
 
+#include <algorithm>
+#include <climits>
+#include <unordered_map>
+
 #include <wx/wx.h>
 #include <wx/glcanvas.h>
 
@@ -48,6 +52,12 @@
 
 #include "plugingl/pi_shaders.h"
 
+#include "ThreadPool.h"
+#include "WindAtlasSampler.h"
+#include "PassageSimulator.h"
+#include "DerivedFields.h"
+#include "MercatorView.h"
+
 #define FAILED_FILELIST_MSG_LEN 150
 
 static int s_multitexturing = 0;
@@ -99,33 +109,49 @@ static GLboolean QueryExtension( const char *extName )
 #define systemGetProcAddress(ADDR) glXGetProcAddress((const GLubyte*)ADDR)
 #endif
 
-double deg2rad(double degrees)
+ClimatologyOverlay::~ClimatologyOverlay()
 {
-  return M_PI * degrees / 180.0;
+    Clear();
 }
 
-ClimatologyOverlay::~ClimatologyOverlay()
+void ClimatologyOverlay::Clear()
 {
     if(m_iTexture)
         glDeleteTextures( 1, &m_iTexture );
+    m_iTexture = 0;
     delete m_pDCBitmap, delete[] m_pRGBA;
+    m_pDCBitmap = NULL, m_pRGBA = NULL;
 }
 
 static const wxString climatology_pi = "climatology_pi: ";
 static bool s_bnoglrepeat = true;
 
-double ClimatologyIsoBarMap::CalcParameter(double lat, double lon)
+double ClimatologyIsoBarMap::CalcParameter(int source, double lat, double lon)
+{
+    return m_factory.getValueMonth(MAG, m_setting, lat, lon, source ? m_nmonth : m_month);
+}
+
+bool ClimatologyIsoBarMap::CalcGrid(int source, double lat0, double lon0, double step,
+                                    int rows, int cols, float *values)
+{
+    /* every setting has a raster, even where a band of it is all
+       missing (over land or past the data) */
+    m_factory.getRasterMonth(MAG, m_setting, source ? m_nmonth : m_month,
+                             lat0, lon0, step, step, rows, cols, values);
+    return true;
+}
+
+bool ClimatologyIsoBarMap::GridExact(int source, double lat0, double lon0, double step)
 {
-    return m_factory.getCalibratedValueMonth(MAG, m_setting, lat, lon, m_month);
+    return m_factory.RasterExact(m_setting, source ? m_nmonth : m_month, lat0, lon0, step);
 }
 
-#define CYCLONE_CACHE_SEMAPHORE_COUNT 4
 ClimatologyOverlayFactory::ClimatologyOverlayFactory( ClimatologyDialog &dlg )
     : //m_bUpdateCyclones(true),
-    m_cyclone_cache_semaphore(CYCLONE_CACHE_SEMAPHORE_COUNT),
     m_bCompletedLoading(false),
     m_dlg(dlg), m_Settings(dlg.m_cfgdlg->m_Settings),
-    m_cyclonesDisplayList(0), m_cyclone_drawn_counter(0)
+    m_bCycloneLinesChanged(false), m_CycloneBuffer(0), m_CycloneVertices(0),
+    m_bCycloneFilterValid(false)
 {
     // make sure the user data directory exists
     wxFileName::Mkdir(ClimatologyUserDataDirectory(), wxS_DIR_DEFAULT, wxPATH_MKDIR_FULL);
@@ -133,6 +159,14 @@ ClimatologyOverlayFactory::ClimatologyOverlayFactory( ClimatologyDialog &dlg )
         m_WindData[m] = NULL;
         m_CurrentData[m] = NULL;
     }
+    m_WindAtlasSampler = new WindAtlasSampler(m_WindData);
+    m_PassageSimulator = new PassageSimulator(*this);
+    m_DerivedFields = new DerivedFields(*this);
+    m_bExpressionChanged = m_bCycloneDensityChanged = false;
+
+    wxString error;
+    if(!m_DerivedFields->SetExpression(m_Settings.m_sExpression, error))
+        wxLogMessage(climatology_pi + _("expression: ") + error);
 
     m_CurrentTimeline = wxDateTime::Now();
     /* use a year without a leap year */
@@ -218,6 +252,13 @@ ClimatologyOverlayFactory::ClimatologyOverlayFactory( ClimatologyDialog &dlg )
 ClimatologyOverlayFactory::~ClimatologyOverlayFactory()
 {
     Free();
+#ifdef USE_GLSL
+    if(m_CycloneBuffer)
+        glDeleteBuffers(1, &m_CycloneBuffer);
+#endif
+    delete m_WindAtlasSampler;
+    delete m_PassageSimulator;
+    delete m_DerivedFields;
 }
 
 void ClimatologyOverlayFactory::GetDateInterpolation(const wxDateTime *cdate,
@@ -296,6 +337,21 @@ bool ClimatologyOverlayFactory::InterpolateWindAtlasTime(int month, int nmonth,
     return true;
 }
 
+int ClimatologyOverlayFactory::SampleWindAtlas(wxDateTime &date, double lat, double lon,
+                                               int count, wxUint64 seed,
+                                               double *directions, double *speeds)
+{
+    if(!m_bCompletedLoading || count < 0)
+        return -1;
+
+    int month, nmonth;
+    double dpos;
+    GetDateInterpolation(&date, month, nmonth, dpos);
+
+    return m_WindAtlasSampler->Sample(month, nmonth, dpos, lat, lon,
+                                      count, seed, directions, speeds);
+}
+
 static double interpquad(double v1, double v2, double v3, double v4, double d1, double d2)
 {
     double w1 = d1*v3 + (1-d1)*v1;
@@ -439,6 +495,23 @@ static ColorMap LightningMap[] =
 {{0, "#490000", 255},  {64, "#890000", 128}, {128, "#a98900", 64},
  {192, "#ffd900", 0}, {255, "#ffff00", 0}};
 
+static ColorMap StabilityMap[] =
+{{-10, "#0000d9", 0}, {-6, "#006ed9", 0}, {-3, "#00b2d9", 0}, {-1, "#a0e0f0", 0},
+ {0, "#ffffff", 0},   {1, "#f0e0a0", 0},  {3, "#d9ae00", 0},  {6, "#d95700", 0},
+ {10, "#d90000", 0}};
+
+/* no natural range, so spread over 0 to 100 */
+static ColorMap ExpressionMap[] =
+{{0, "#0000d9", 0},  {10, "#006ed9", 0}, {20, "#00b2d9", 0}, {30, "#00d9a6", 0},
+ {40, "#00d900", 0}, {50, "#95d900", 0}, {60, "#d9d900", 0}, {70, "#d98300", 0},
+ {80, "#d90000", 0}, {90, "#ae0080", 0}, {100, "#ffffff", 0}};
+
+/* tracks in the record, clear where there were none */
+static ColorMap DensityMap[] =
+{{0, "#0000d9", 255}, {1, "#0000d9", 96}, {2, "#006ed9", 64}, {5, "#00b2d9", 32},
+ {10, "#00d900", 0},  {20, "#d9d900", 0}, {40, "#d98300", 0}, {80, "#d90000", 0},
+ {160, "#ae0080", 0}, {320, "#ffffff", 0}};
+
 ColorMap SeaDepthMap[] =
 {{0, "#0000d9", 255},  {20, "#002ad9", 0},   {50, "#006ed9", 0},   {100, "#00b2d9", 0},
  {150, "#00d4d4", 0},  {250, "#00d9a6", 0},  {400, "#00d900", 0},  {600, "#95d900", 0},
@@ -466,7 +539,7 @@ static wxColour TextColor(wxString text)
 
 ColorMap *ColorMaps[] = {WindMap, CurrentMap, PressureMap, SeaTempMap, AirTempMap,
                          CloudMap, PrecipitationMap, RelativeHumidityMap, LightningMap,
-                         SeaDepthMap, CycloneMap};
+                         SeaDepthMap, CycloneMap, StabilityMap, ExpressionMap, DensityMap};
 
 static const int ColorMapLens[] = { (sizeof WindMap) / (sizeof *WindMap),
                              (sizeof CurrentMap) / (sizeof *CurrentMap),
@@ -478,15 +551,30 @@ static const int ColorMapLens[] = { (sizeof WindMap) / (sizeof *WindMap),
                              (sizeof RelativeHumidityMap) / (sizeof *RelativeHumidityMap),
                              (sizeof LightningMap) / (sizeof *LightningMap),
                              (sizeof SeaDepthMap) / (sizeof *SeaDepthMap),
-                             (sizeof CycloneMap) / (sizeof *CycloneMap)};
+                             (sizeof CycloneMap) / (sizeof *CycloneMap),
+                             (sizeof StabilityMap) / (sizeof *StabilityMap),
+                             (sizeof ExpressionMap) / (sizeof *ExpressionMap),
+                             (sizeof DensityMap) / (sizeof *DensityMap)};
 
+/* built in settings share their index with their colormap */
+int ClimatologyOverlayFactory::SettingColorMap(int setting)
+{
+    switch(setting) {
+    case ClimatologyOverlaySettings::DEWPOINT:     return AIRTEMP_COLORMAP;
+    case ClimatologyOverlaySettings::WINDCHILL:    return AIRTEMP_COLORMAP;
+    case ClimatologyOverlaySettings::CURRENT_WIND: return WIND_COLORMAP;
+    case ClimatologyOverlaySettings::SST_AT:       return STABILITY_COLORMAP;
+    case ClimatologyOverlaySettings::EXPRESSION:   return EXPRESSION_COLORMAP;
+    case ClimatologyOverlaySettings::CYCLONE_DENSITY: return DENSITY_COLORMAP;
+    }
+    return setting;
+}
 
-wxColour ClimatologyOverlayFactory::GetGraphicColor(int setting, double val_in)
+wxColour ClimatologyOverlayFactory::GetColorMapColor(int colormap_index, double val_in)
 {
     if(isnan(val_in))
         return wxColour(0, 0, 0, 0); /* transparent */
 
-    int colormap_index = setting;
     ColorMap *map = ColorMaps[colormap_index];
     int maplen = ColorMapLens[colormap_index];
 
@@ -573,40 +661,34 @@ void ClimatologyOverlayFactory::LoadInternal(wxGenericProgressDialog *progressdi
         return;
     ReadSeaDepthData("seadepth");
 
+    /* extend data near the coast so queries there don't return nan */
+    if(m_Settings.m_iCoastalFillCells > 0) {
+        if(progressdialog && !progressdialog->Update(30, _("coastal fill")))
+            return;
+        FillCoastalGaps(m_Settings.m_iCoastalFillCells);
+    }
+
     /* load cyclone tracks */
+    const char *cyclonefiles[CycloneTracks::THEATRES] =
+        {"cyclone-epa", "cyclone-wpa", "cyclone-spa", "cyclone-atl", "cyclone-nio", "cyclone-she"};
+    const bool cyclonesouth[CycloneTracks::THEATRES] = {false, false, true, false, false, true};
+    const wxString cyclonenames[CycloneTracks::THEATRES] =
+        {_("cyclone (east pacific)"), _("cyclone (west pacific)"), _("cyclone (south pacific)"),
+         _("cyclone (atlantic)"), _("cyclone (north indian)"), _("cyclone (south indian)")};
+    CycloneTheatre theatres[CycloneTracks::THEATRES];
     bool allcyclone = true;
-    if(progressdialog && !progressdialog->Update(30, _("cyclone (east pacific)")))
-        return;
-    if(!ReadCycloneData("cyclone-epa", m_epa))
-        allcyclone = false;
-
-    if(progressdialog && !progressdialog->Update(31, _("cyclone (west pacific)")))
-        return;
-    if(!ReadCycloneData("cyclone-wpa", m_wpa))
-        allcyclone = false;
-
-    if(progressdialog && !progressdialog->Update(32, _("cyclone (south pacific)")))
-        return;
-    if(!ReadCycloneData("cyclone-spa", m_spa, true))
-        allcyclone = false;
-
-    if(progressdialog && !progressdialog->Update(33, _("cyclone (atlantic)")))
-        return;
-    if(!ReadCycloneData("cyclone-atl", m_atl))
-        allcyclone = false;
-
-    if(progressdialog && !progressdialog->Update(34, _("cyclone (north indian)")))
-        return;
-    if(!ReadCycloneData("cyclone-nio", m_nio))
-        allcyclone = false;
-
-    if(progressdialog && !progressdialog->Update(35, _("cyclone (south indian)")))
-        return;
-    if(!ReadCycloneData("cyclone-she", m_she, true))
-        allcyclone = false;
+    for(int i=0; i<CycloneTracks::THEATRES; i++) {
+        if(progressdialog && !progressdialog->Update(30 + i, cyclonenames[i]))
+            return;
+        if(!ReadCycloneData(cyclonefiles[i], theatres[i], cyclonesouth[i]))
+            allcyclone = false;
+    }
+    if(!m_CycloneTracks.Build(theatres))
+        wxLogMessage(climatology_pi + _("cyclone tracks: out of memory"));
 
     if(allcyclone)
         m_dlg.m_cbCyclones->Enable();
+    m_dlg.EnableDerivedSettings();
 
     if(progressdialog && !progressdialog->Update(36, _("el nino years")))
         return;
@@ -619,6 +701,7 @@ void ClimatologyOverlayFactory::LoadInternal(wxGenericProgressDialog *progressdi
 
     if(progressdialog && !progressdialog->Update(37, _("cyclone cache")))
         return;
+    ClassifyCycloneEnso();
     BuildCycloneCache();
 }
 
@@ -637,13 +720,24 @@ void ClimatologyOverlayFactory::Load()
 
 void ClimatologyOverlayFactory::Free()
 {
-#if 0
-    for(int i=0; i<ClimatologyOverlaySettings::SETTINGS_COUNT; i++)
+    /* isobars still computing would read the data being freed,
+       cancelled maps start again when next shown, from new samples */
+    for(int i=0; i<ClimatologyOverlaySettings::SETTINGS_COUNT; i++) {
+        ClimatologyOverlaySettings::OverlayDataSettings &odc = m_Settings.Settings[i];
+        for(std::list<ClimatologyIsoBarMap*>::iterator it = odc.m_IsoBarMaps.begin();
+            it != odc.m_IsoBarMaps.end(); it++)
+            (*it)->Cancel();
+        for(std::list<ClimatologyIsoBarMap*>::iterator it = odc.m_IsoBarMaps.begin();
+            it != odc.m_IsoBarMaps.end(); it++)
+            (*it)->Stop();
         for(int m=0; m<13; m++)
-            delete m_Settings.Settings[i].m_pIsobars[m];
-#endif
+            odc.m_IsoBarGrids[m].clear();
+    }
+    FreeRetiredIsoBarMaps(true);
 
     // free wind data
+    m_WindAtlasSampler->Clear();
+    m_DerivedFields->Clear();
     for(int m=0; m<13; m++) {
         delete m_WindData[m];
         m_WindData[m] = NULL;
@@ -652,17 +746,10 @@ void ClimatologyOverlayFactory::Free()
     }
     
     // free cyclones
-    std::list<Cyclone*> *cyclones[6] = {&m_epa, &m_wpa, &m_spa, &m_atl, &m_nio, &m_she};
-    for(int i=0; i < 6; i++) {
-        for(std::list<Cyclone*>::iterator it = cyclones[i]->begin(); it != cyclones[i]->end(); it++) {
-            Cyclone *s = *it;
-            for(std::list<CycloneState*>::iterator it2 = s->states.begin(); it2 != s->states.end(); it2++)
-                delete *it2;
-            delete s;
-        }
-        cyclones[i]->clear();
-    }
-    m_cyclone_cache.clear();
+    m_CycloneTracks.Clear();
+    m_bCycloneFilterValid = false;
+    m_CycloneCache.Clear();
+    m_bCycloneLinesChanged = true;
 }
 
 void ClimatologyOverlayFactory::ReadWindData(int month, wxString filename)
@@ -1168,198 +1255,267 @@ void ClimatologyOverlayFactory::ReadSeaDepthData(wxString filename)
     zu_close(f);
 }
 
-bool ClimatologyOverlayFactory::ReadCycloneData(wxString filename, std::list<Cyclone*> &cyclones, bool south)
+/* indices of the neighbours of a grid cell, edges first then corners,
+   wrapping in longitude */
+static int GapNeighbours(int lats, int lons, int lati, int loni, int ind[8])
 {
-    ZUFILE *f;
-    wxString path = ClimatologyDataDirectory();
-    if(!(f = TryOpenFile(path + filename))) {
-        path = ClimatologyUserDataDirectory();
-        if(!(f = TryOpenFile(path + filename)))
-            goto missing;
+    static const int offsets[8][2] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1},
+                                      {-1, -1}, {-1, 1}, {1, -1}, {1, 1}};
+    int count = 0;
+    for(int i=0; i<8; i++) {
+        int nlati = lati + offsets[i][0], nloni = loni + offsets[i][1];
+        if(nlati < 0 || nlati >= lats)
+            continue;
+        if(nloni < 0) nloni += lons;
+        else if(nloni >= lons) nloni -= lons;
+        ind[count++] = nlati*lons + nloni;
     }
+    return count;
+}
 
-    wxUint16 lyear, llastmonth;
-    Cyclone *cyclone;
-    while(zu_read(f, &lyear, sizeof lyear)==sizeof lyear) {
-#ifdef __MSVC__
-        if(lyear < 1972)
-            lyear = 1972;
-#endif
-        cyclone = new Cyclone;
-        llastmonth = 0;
-
-        wxUint8 wk;
-        wxUint16 press;
-        CycloneState::State lastcyclonestate = CycloneState::UNKNOWN;
-        CycloneDateTime lastdatetime(1, 1, 1900, 0);
-        wxInt16 lastlat=-10000, lastlon=-10000;
-        for(;;) {
-            signed char state;
-            if(zu_read(f, &state, sizeof state) != sizeof state)
-                goto corrupted;
-
-            if(state == -128)
-                break;
+struct Int16GapFill
+{
+    bool Valid(wxInt16 v) { return v != 32767; }
+    void Fill(wxInt16 &v, const wxInt16 *prev, int *ind, int count) {
+        long total = 0, totalcount = 0;
+        for(int i=0; i<count; i++)
+            if(Valid(prev[ind[i]])) {
+                total += prev[ind[i]];
+                totalcount++;
+            }
+        if(totalcount)
+            v = total / totalcount;
+    }
+};
 
-            CycloneState::State cyclonestate;
-            switch(state) {
-            case '*': cyclonestate = CycloneState::TROPICAL; break;
-            case 'S': cyclonestate = CycloneState::SUBTROPICAL; break;
-            case 'E': cyclonestate = CycloneState::EXTRATROPICAL; break;
-            case 'W': cyclonestate = CycloneState::WAVE; break;
-            case 'L': cyclonestate = CycloneState::REMANENT; break;
-            case 'D': case 'X': cyclonestate = CycloneState::UNKNOWN; break;
-            default: goto corrupted;
+struct FloatGapFill
+{
+    bool Valid(float v) { return !isnan(v); }
+    void Fill(float &v, const float *prev, int *ind, int count) {
+        double total = 0;
+        int totalcount = 0;
+        for(int i=0; i<count; i++)
+            if(Valid(prev[ind[i]])) {
+                total += prev[ind[i]];
+                totalcount++;
             }
+        if(totalcount)
+            v = total / totalcount;
+    }
+};
 
-            char lday, lmonth;
-            if(zu_read(f, &lday, sizeof lday) != sizeof lday ||
-               zu_read(f, &lmonth, sizeof lmonth) != sizeof lmonth)
-                goto corrupted;
-
-            if(lmonth < llastmonth)
-                lyear++;
-            llastmonth = lmonth;
-
-            wxDateTime::Month month = (wxDateTime::Month)(lmonth-1);
-            int day = lday/4, hour = (lday%4)*6;
-            if(lmonth < 1 || lmonth > 12 ||
-               day < 1 || day > wxDateTime::GetNumberOfDays(month, lyear) ||
-               hour < 0 || hour >= 24)
-                goto corrupted;
-
-            wxInt16 lat, lon;
-            if(zu_read(f, &lat, sizeof lat) != sizeof lat ||
-               zu_read(f, &lon, sizeof lon) != sizeof lon)
-                goto corrupted;
-
-            // make sure it's in range
-            if(fabsf((double)lat/10) >= 90 || (double)lon/10 > 15 || (double)lon/10 < -360)
-                goto corrupted;
-
-            if(lastlat != -10000) {
-                cyclone->states.push_back
-                    (new CycloneState(lastcyclonestate, lastdatetime,
-                                      (south ? -1 : 1) * (double)lastlat/10, (double)lastlon/10,
-                                      (south ? -1 : 1) * (double)lat/10, (double)lon/10,
-                                      wk, press));
+/* averaging polars can round every direction to zero, so take the nearest */
+struct WindPolarGapFill
+{
+    bool Valid(const WindData::WindPolar &p) { return p.gale != 255; }
+    void Fill(WindData::WindPolar &p, const WindData::WindPolar *prev, int *ind, int count) {
+        for(int i=0; i<count; i++)
+            if(Valid(prev[ind[i]])) {
+                p = prev[ind[i]];
+                return;
             }
+    }
+};
 
-            lastcyclonestate = cyclonestate;
-            lastdatetime = CycloneDateTime(day, month, lyear, hour);
-            lastlat = lat, lastlon = lon;
-                
-            if(zu_read(f, &wk, sizeof wk) != sizeof wk ||
-               zu_read(f, &press, sizeof press) != sizeof press)
-                goto corrupted;
-        }
-        cyclones.push_back(cyclone);
+/* each pass extends valid data by one cell into missing neighbours,
+   reading only the previous pass so rows can be filled in parallel */
+template <class T, class F>
+static void FillGridGaps(T *grid, int lats, int lons, int cells, F fill)
+{
+    std::vector<T> prev;
+    for(int pass = 0; pass < cells; pass++) {
+        prev.assign(grid, grid + lats*lons);
+        ParallelFor(0, lats, [&](int lat0, int lat1) {
+                F f = fill;
+                for(int lati = lat0; lati < lat1; lati++)
+                    for(int loni = 0; loni < lons; loni++) {
+                        int i = lati*lons + loni;
+                        if(f.Valid(prev[i]))
+                            continue;
+                        int ind[8];
+                        int count = GapNeighbours(lats, lons, lati, loni, ind);
+                        f.Fill(grid[i], &prev[0], ind, count);
+                    }
+            }, 8);
     }
+}
 
-    zu_close(f);
-    return true;
+void ClimatologyOverlayFactory::FillCoastalGaps(int cells)
+{
+    wxStopWatch sw;
 
-corrupted:
-    delete cyclone;
-    m_sFailedMessage += _("corrupt file: ") + filename + "\n";
-    wxLogMessage(climatology_pi + _("cyclone data corrupt: ") + filename
-                 + wxString::Format(" at %ld", zu_tell(f)));
+    for(int m=0; m<13; m++) {
+        if(m_WindData[m])
+            FillGridGaps(m_WindData[m]->data, m_WindData[m]->latitudes,
+                         m_WindData[m]->longitudes, cells, WindPolarGapFill());
+
+        if(m_CurrentData[m])
+            for(int dim = 0; dim<2; dim++)
+                FillGridGaps(m_CurrentData[m]->data[dim], m_CurrentData[m]->latitudes,
+                             m_CurrentData[m]->longitudes, cells, FloatGapFill());
+
+        FillGridGaps(m_slp[m][0], 90, 180, cells, Int16GapFill());
+        FillGridGaps(m_sst[m][0], 180, 360, cells, Int16GapFill());
+        FillGridGaps(m_at[m][0], 90, 180, cells, Int16GapFill());
+        FillGridGaps(m_cld[m][0], 90, 180, cells, Int16GapFill());
+        FillGridGaps(m_precip[m][0], 72, 144, cells, Int16GapFill());
+        FillGridGaps(m_rhum[m][0], 180, 360, cells, Int16GapFill());
+    }
+
+    wxLogMessage(climatology_pi + _("coastal fill: ") + wxString::Format("%ld", sw.Time()));
+}
+
+bool ClimatologyOverlayFactory::ReadCycloneData(wxString filename, CycloneTheatre &theatre, bool south)
+{
+    ZUFILE *f;
+    wxString path = ClimatologyDataDirectory();
+    if(!(f = TryOpenFile(path + filename))) {
+        path = ClimatologyUserDataDirectory();
+        if(!(f = TryOpenFile(path + filename)))
+            goto missing;
+    }
+
+    /* the whole file in one go, compressed files have no useful size */
+    for(;;) {
+        const long chunk = 1<<16;
+        long size = theatre.data.size();
+        theatre.data.resize(size + chunk);
+        long len = zu_read(f, &theatre.data[size], chunk);
+        theatre.data.resize(size + wxMax(len, 0L));
+        if(len < chunk)
+            break;
+    }
     zu_close(f);
+
+    {
+        theatre.south = south;
+        long corrupt = CycloneTracks::Scan(theatre);
+        if(corrupt == -1)
+            return true;
+
+        m_sFailedMessage += _("corrupt file: ") + filename + "\n";
+        wxLogMessage(climatology_pi + _("cyclone data corrupt: ") + filename
+                     + wxString::Format(" at %ld", corrupt));
+    }
 missing:
     m_FailedFiles.push_back(filename);
     return false;
 }
 
-void ClimatologyOverlayFactory::BuildCycloneCache()
+static int CycloneHours(const wxDateTime &dt)
+{
+    return CycloneTracks::Hours(dt.GetYear(), dt.GetMonth(), dt.GetDay(), dt.GetHour());
+}
+
+/* the el nino years load after the tracks */
+void ClimatologyOverlayFactory::ClassifyCycloneEnso()
 {
-    std::list<Cyclone*> *cyclones[6] = {&m_epa, &m_wpa, &m_spa, &m_atl, &m_nio, &m_she};
+    CycloneTracks &t = m_CycloneTracks;
+    for(int i=0; i<t.Segments(); i++) {
+        int phase = CycloneTracks::ENSO_NOT_AVAILABLE;
+        std::map<int, ElNinoYear>::iterator ipt = m_ElNinoYears.find(t.year[i]);
+        if(ipt != m_ElNinoYears.end()) {
+            double value = ipt->second.months[t.month[i]];
+            if(isnan(value))
+                phase = CycloneTracks::ENSO_NOT_AVAILABLE;
+            else if(value >= .5)
+                phase = CycloneTracks::EL_NINO;
+            else if(value <= -.5)
+                phase = CycloneTracks::LA_NINA;
+            else
+                phase = CycloneTracks::NEUTRAL;
+        }
+        t.enso[i] = phase;
+    }
+    m_bCycloneFilterValid = false;
+}
 
+void ClimatologyOverlayFactory::BuildCycloneCache()
+{
     /* make sure we have all the cyclone theatres */
-    for(int i=0; i < 6; i++)
-        if(cyclones[i]->empty())
+    for(int i=0; i < CycloneTracks::THEATRES; i++)
+        if(!m_CycloneTracks.TheatreTracks(i))
             return;
 
-    int statemask = 0;
-    statemask |= 1*m_dlg.m_cfgdlg->m_cbTropical->GetValue();
-    statemask |= 2*m_dlg.m_cfgdlg->m_cbSubTropical->GetValue();
-    statemask |= 4*m_dlg.m_cfgdlg->m_cbExtraTropical->GetValue();
-    statemask |= 8*m_dlg.m_cfgdlg->m_cbRemanent->GetValue();
+    ClimatologyConfigDialog &cfg = *m_dlg.m_cfgdlg;
+    CycloneFilter filter;
+    filter.minwindknots = cfg.m_sMinWindSpeed->GetValue();
+    filter.maxpressure = cfg.m_sMaxPressure->GetValue();
 
-    for(int i=0; i<CYCLONE_CACHE_SEMAPHORE_COUNT; i++)
-        m_cyclone_cache_semaphore.Wait();
+#ifndef __OCPN__ANDROID__
+    filter.start = CycloneHours(cfg.m_dPStart->GetValue());
+    filter.end = CycloneHours(cfg.m_dPEnd->GetValue());
+#else
+    filter.start = INT_MIN;
+    filter.end = INT_MAX;
+#endif
 
-    int minwindspeed = m_dlg.m_cfgdlg->m_sMinWindSpeed->GetValue();
-    int maxpressure = m_dlg.m_cfgdlg->m_sMaxPressure->GetValue();
+    filter.statemask = 0;
+    filter.statemask |= 1*cfg.m_cbTropical->GetValue();
+    filter.statemask |= 2*cfg.m_cbSubTropical->GetValue();
+    filter.statemask |= 4*cfg.m_cbExtraTropical->GetValue();
+    filter.statemask |= 8*cfg.m_cbRemanent->GetValue();
+
+    /* without el nino data every segment passes */
+    filter.ensomask = 0;
+    if(cfg.m_cbNotAvailable->GetValue() || m_ElNinoYears.empty())
+        filter.ensomask |= CycloneTracks::ENSO_NOT_AVAILABLE;
+    if(cfg.m_cbElNino->GetValue())
+        filter.ensomask |= CycloneTracks::EL_NINO;
+    if(cfg.m_cbLaNina->GetValue())
+        filter.ensomask |= CycloneTracks::LA_NINA;
+    if(cfg.m_cbNeutral->GetValue())
+        filter.ensomask |= CycloneTracks::NEUTRAL;
+
+    if(m_bCycloneFilterValid && filter == m_CycloneFilter)
+        return;
 
-    m_cyclone_cache.clear();
     wxStopWatch sw;
 
-    for(int i=0; i < 6; i++) {
-        for(std::list<Cyclone*>::iterator it = cyclones[i]->begin(); it != cyclones[i]->end(); it++) {
-            Cyclone *s = *it;
-
-            for(std::list<CycloneState*>::iterator it2 = s->states.begin(); it2 != s->states.end(); it2++) {
-                if((*it2)->windknots < minwindspeed)
-                    continue;
-
-                if((*it2)->pressure > maxpressure)
-                    continue;
-
-                /* rebuild cache for these? */
-#ifndef __OCPN__ANDROID__                
-                wxDateTime dt = (*it2)->datetime.DateTime();
-                if((dt < m_dlg.m_cfgdlg->m_dPStart->GetValue()) ||
-                   (dt > m_dlg.m_cfgdlg->m_dPEnd->GetValue()))
-                    continue;
-#endif
-                /* el nino test */
-                int year = (*it2)->datetime.year;
-                std::map<int, ElNinoYear>::iterator ipt = m_ElNinoYears.find(year);
-                if (ipt == m_ElNinoYears.end()) {
-                    if(!m_dlg.m_cfgdlg->m_cbNotAvailable->GetValue() && m_ElNinoYears.size())
-                        continue;
-                } else {
-                    ElNinoYear elninoyear = m_ElNinoYears[year];
-                    int month = (*it2)->datetime.month;
-                    double value = elninoyear.months[month];
-        
-                    if(isnan(value)) {
-                        if(!m_dlg.m_cfgdlg->m_cbNotAvailable->GetValue())
-                            continue;
-                    } else {
-                        if(value >= .5) {
-                            if(!m_dlg.m_cfgdlg->m_cbElNino->GetValue())
-                                continue;
-                        } else if(value <= -.5) {
-                            if(!m_dlg.m_cfgdlg->m_cbLaNina->GetValue())
-                                continue;
-                        } else if(!m_dlg.m_cfgdlg->m_cbNeutral->GetValue())
-                            continue;
-                    }
-                }
+    /* branch free tests over the columns */
+    const CycloneTracks &c = m_CycloneTracks;
+    int count = c.Segments();
+    std::vector<wxUint8> keep(count);
+    ParallelFor(0, count, [&](int start, int end) {
+            for(int i = start; i < end; i++)
+                keep[i] = (c.windknots[i] >= filter.minwindknots) &
+                    (c.pressure[i] <= filter.maxpressure) &
+                    (c.hours[i] >= filter.start) & (c.hours[i] <= filter.end) &
+                    (((1 << c.state[i]) & filter.statemask) != 0) &
+                    ((c.enso[i] & filter.ensomask) != 0);
+        }, 16384);
+
+    std::vector<CycloneSegment> segments;
+    for(int i=0; i<count; i++)
+        if(keep[i]) {
+            CycloneSegment segment;
+            for(int j = 0; j<2; j++) {
+                segment.lat[j] = c.lat[j][i];
+                segment.lon[j] = c.lon[j][i];
+            }
+            segment.windknots = c.windknots[i];
+            segment.pressure = c.pressure[i];
+            segment.day = c.day[i];
+            segment.state = c.state[i];
+            segment.id = segments.size();
+            segment.track = c.track[i];
+            segment.hours = c.hours[i];
+            segments.push_back(segment);
+        }
 
-                if(!((1<<(*it2)->state) & statemask))
-                    continue;
+    /* queries carry on with the published cache meanwhile */
+    CycloneCacheData &cache = m_CycloneCache.Back();
+    cache.index.Build(segments);
+    cache.density.Build(c, keep);
+    cache.lines.Build(segments);
+    m_CycloneCache.Publish();
 
-                int lon[2], lat[2];
-                for(int j = 0; j<2; j++) {
-                    lon[j] = (*it2)->lon[0] < 15 ? (*it2)->lon[j] : (*it2)->lon[j] - 360;
-                    lat[j] = (*it2)->lat[j];
-                }
+    m_bCycloneDensityChanged = m_bCycloneLinesChanged = true;
 
-                for(int loni = wxMin(lon[0], lon[1]); loni <= wxMax(lon[0], lon[1]); loni++)
-                    for(int lati = wxMin(lat[0], lat[1]); lati <= wxMax(lat[0], lat[1]); lati++) {
-                        int hash = (loni * 180 + lati)*12 + (*it2)->datetime.month;
-                        m_cyclone_cache[hash].push_back(*it2);
-                    }
-            }
-        }
-    }
+    m_CycloneFilter = filter;
+    m_bCycloneFilterValid = true;
 
     wxLogMessage(climatology_pi + _("cyclone cache: ") + wxString::Format("%ld", sw.Time()));
-    
-    for(int i=0; i<CYCLONE_CACHE_SEMAPHORE_COUNT; i++)
-        m_cyclone_cache_semaphore.Post();
 }
 
 static double strtod_nan(const char *str)
@@ -1437,6 +1593,11 @@ bool ClimatologyOverlayFactory::CreateGLTexture(ClimatologyOverlay &O,
 
     unsigned char *data = new unsigned char[width*height*4];
 
+    /* fetched once rather than for every pixel */
+    DerivedFields::GridRef derived;
+    if(DerivedFields::IsDerived(setting))
+        derived = m_DerivedFields->GetGrid(setting, month);
+
     for(int x = 0; x < width; x++) {
         if(x % 40 == 0) {
             if(progressdialog)
@@ -1457,7 +1618,9 @@ bool ClimatologyOverlayFactory::CreateGLTexture(ClimatologyOverlay &O,
             lat = 2*rad2deg(atan(exp(lat))) - 90;
             double lon = x/s;
 
-            double v = getValueMonth(MAG, setting, lat + latoff, lon + lonoff, month);
+            double v = derived ?
+                DerivedFields::Value(derived, MAG, setting, lat + latoff, lon + lonoff) :
+                getValueMonth(MAG, setting, lat + latoff, lon + lonoff, month);
             wxColour c = GetGraphicColor(setting, v);
 
             int doff = 4*(y*width + x);
@@ -1848,6 +2011,33 @@ static double InterpArray(double x, double y, wxInt16 *a, int h)
     return      interp_value(v0,   v1, x-x0);
 }
 
+/* bilinear value from the four corners and its derivatives with
+   respect to the fractional row (dx) and column (dy) */
+static double interp_gradient(double v00, double v01, double v10, double v11,
+                              double xd, double yd, double &dx, double &dy)
+{
+    double v0 = interp_value(v00, v01, yd);
+    double v1 = interp_value(v10, v11, yd);
+    dx = v1 - v0;
+    dy = interp_value(v01 - v00, v11 - v10, xd);
+    return interp_value(v0, v1, xd);
+}
+
+static double InterpArrayGradient(double x, double y, wxInt16 *a, int h,
+                                  double &dx, double &dy)
+{
+    if(y<0) y+=h;
+    int x0 = floor(x), x1 = x0+1;
+    int y0 = floor(y), y1 = y0+1;
+    int y1v = y1;
+    if(y1v == h) y1v = 0;
+
+    double v00 = ArrayValue(a, x0*h + y0), v01 = ArrayValue(a, x0*h + y1v);
+    double v10 = ArrayValue(a, x1*h + y0), v11 = ArrayValue(a, x1*h + y1v);
+
+    return interp_gradient(v00, v01, v10, v11, x-x0, y-y0, dx, dy);
+}
+
 double WindData::WindPolar::Value(enum Coord coord, int dir_cnt)
 {
     if(gale == 255)
@@ -1874,6 +2064,29 @@ double WindData::WindPolar::Value(enum Coord coord, int dir_cnt)
     return (double)totals / totald;
 }
 
+void WindData::WindPolar::Values(int dir_cnt, double values[4])
+{
+    if(gale == 255) {
+        values[U] = values[V] = values[MAG] = values[DIRECTION] = NAN;
+        return;
+    }
+
+    /* accumulate like Value so results are identical */
+    int totald = 0, totalu = 0, totalv = 0, totalm = 0;
+    for(int i=0; i<dir_cnt; i++) {
+        double a = i*2*M_PI/dir_cnt;
+        totald += directions[i];
+        totalu += sin(a)*speeds[i]*directions[i];
+        totalv += cos(a)*speeds[i]*directions[i];
+        totalm += speeds[i]*directions[i];
+    }
+    assert(totald != 0);
+    values[U] = (double)totalu / totald;
+    values[V] = (double)totalv / totald;
+    values[MAG] = (double)totalm / totald;
+    values[DIRECTION] = atan2(values[U], values[V]);
+}
+
 double CurrentData::Value(enum Coord coord, int xi, int yi)
 {
     if(xi < 0 || xi >= latitudes)
@@ -1922,6 +2135,82 @@ double WindData::InterpWind(enum Coord coord, double x, double y)
     return      interp_value(v0,  v1,  xi-x0 ) / speed_multiplier;
 }
 
+/* bilinear blend of per-corner vectors; direction corners are radians */
+static void InterpVector(double c[4][4], double xd, double yd, double values[4])
+{
+    for(int coord = U; coord <= MAG; coord++) {
+        double v0 = interp_value(c[0][coord], c[1][coord], yd);
+        double v1 = interp_value(c[2][coord], c[3][coord], yd);
+        values[coord] = interp_value(v0, v1, xd);
+    }
+
+    double a0 = interp_angle(c[0][DIRECTION], c[1][DIRECTION], yd);
+    double a1 = interp_angle(c[2][DIRECTION], c[3][DIRECTION], yd);
+    values[DIRECTION] = interp_angle(a0, a1, xd) * 180/M_PI;
+}
+
+void WindData::InterpWindVector(double x, double y, double values[4])
+{
+    double latoff = 90.0/latitudes, lonoff = 180.0/longitudes;
+
+    double xi = latitudes*(.5 + (x - latoff)/180.0);
+    double yi = longitudes*positive_degrees(y - lonoff)/360.0;
+
+    int h = longitudes, d = dir_cnt;
+
+    if(yi<0) yi+=h;
+
+    int x0 = floor(xi), x1 = x0+1;
+    int y0 = floor(yi), y1 = y0+1;
+    int y1v = y1;
+    if(x1 == latitudes)
+        x1 = x0;
+    if(y1v == h) y1v = 0;
+
+    double c[4][4];
+    data[x0*h + y0].Values(d, c[0]);
+    data[x0*h + y1v].Values(d, c[1]);
+    data[x1*h + y0].Values(d, c[2]);
+    data[x1*h + y1v].Values(d, c[3]);
+
+    InterpVector(c, xi-x0, yi-y0, values);
+    for(int coord = U; coord <= MAG; coord++)
+        values[coord] /= speed_multiplier;
+}
+
+double WindData::InterpWindGradient(enum Coord coord, double x, double y,
+                                    double &dlat, double &dlon)
+{
+    dlat = dlon = NAN;
+    if(coord == DIRECTION)
+        return NAN;
+
+    double latoff = 90.0/latitudes, lonoff = 180.0/longitudes;
+
+    double xi = latitudes*(.5 + (x - latoff)/180.0);
+    double yi = longitudes*positive_degrees(y - lonoff)/360.0;
+
+    int h = longitudes, d = dir_cnt;
+
+    if(yi<0) yi+=h;
+
+    int x0 = floor(xi), x1 = x0+1;
+    int y0 = floor(yi), y1 = y0+1;
+    int y1v = y1;
+    if(x1 == latitudes)
+        x1 = x0;
+    if(y1v == h) y1v = 0;
+
+    double v00 = data[x0*h + y0].Value(coord, d), v01 = data[x0*h + y1v].Value(coord, d);
+    double v10 = data[x1*h + y0].Value(coord, d), v11 = data[x1*h + y1v].Value(coord, d);
+
+    double dx, dy;
+    double v = interp_gradient(v00, v01, v10, v11, xi-x0, yi-y0, dx, dy);
+    dlat = dx * latitudes / 180.0 / speed_multiplier;
+    dlon = dy * longitudes / 360.0 / speed_multiplier;
+    return v / speed_multiplier;
+}
+
 double CurrentData::InterpCurrent(enum Coord coord, double x, double y)
 {
     y = positive_degrees(y);
@@ -1936,8 +2225,8 @@ double CurrentData::InterpCurrent(enum Coord coord, double x, double y)
     int y1v = y1;
     if(y1v == h) y1v = 0;
 
-    double v00 = Value(coord, x0, y0), v01 = Value(coord, x0, y1);
-    double v10 = Value(coord, x1, y0), v11 = Value(coord, x1, y1);
+    double v00 = Value(coord, x0, y0), v01 = Value(coord, x0, y1v);
+    double v10 = Value(coord, x1, y0), v11 = Value(coord, x1, y1v);
 
     if(coord == DIRECTION) {
         double a0 = interp_angle(v00, v01, yi-y0);
@@ -1950,6 +2239,75 @@ double CurrentData::InterpCurrent(enum Coord coord, double x, double y)
     return      interp_value(v0,  v1,  xi-x0 );
 }
 
+double CurrentData::InterpCurrentGradient(enum Coord coord, double x, double y,
+                                          double &dlat, double &dlon)
+{
+    dlat = dlon = NAN;
+    if(coord == DIRECTION)
+        return NAN;
+
+    y = positive_degrees(y);
+    double xi = (latitudes-1)*(.5 - x/160.0);
+    double yi = longitudes*y/360.0;
+    int h = longitudes;
+
+    if(xi<0) xi+=latitudes;
+
+    int x0 = floor(xi), x1 = x0+1;
+    int y0 = floor(yi), y1 = y0+1;
+    int y1v = y1;
+    if(y1v == h) y1v = 0;
+
+    double v00 = Value(coord, x0, y0), v01 = Value(coord, x0, y1v);
+    double v10 = Value(coord, x1, y0), v11 = Value(coord, x1, y1v);
+
+    double dx, dy;
+    double v = interp_gradient(v00, v01, v10, v11, xi-x0, yi-y0, dx, dy);
+    dlat = -dx * (latitudes-1) / 160.0;
+    dlon = dy * longitudes / 360.0;
+    return v;
+}
+
+void CurrentData::InterpCurrentVector(double x, double y, double values[4])
+{
+    y = positive_degrees(y);
+    double xi = (latitudes-1)*(.5 - x/160.0);
+    double yi = longitudes*y/360.0;
+    int h = longitudes;
+
+    if(xi<0) xi+=latitudes;
+
+    int x0 = floor(xi), x1 = x0+1;
+    int y0 = floor(yi), y1 = y0+1;
+    int y1v = y1;
+    if(y1v == h) y1v = 0;
+
+    /* fetch u and v once per corner */
+    double c[4][4];
+    int xs[4] = {x0, x0, x1, x1}, ys[4] = {y0, y1v, y0, y1v};
+    for(int i=0; i<4; i++) {
+        if(xs[i] < 0 || xs[i] >= latitudes) {
+            c[i][U] = c[i][V] = c[i][MAG] = c[i][DIRECTION] = NAN;
+            continue;
+        }
+        double u = data[0][xs[i]*longitudes + ys[i]], v = data[1][xs[i]*longitudes + ys[i]];
+        c[i][U] = u;
+        c[i][V] = v;
+        c[i][MAG] = hypot(u, v);
+        c[i][DIRECTION] = !u && !v ? NAN : atan2(u, v);
+    }
+
+    InterpVector(c, xi-x0, yi-y0, values);
+}
+
+static const double seadepth_table[] = {0, 10, 20, 30, 50, 75, 100, 125, 150,
+                                        200, 250, 300, 400, 500, 600, 700, 800,
+                                        900, 1000, 1100, 1200, 1300, 1400, 1500,
+                                        1750, 2000, 2500, 3000, 3500, 4000, 4500,
+                                        5000, 5500, 6000, 6500, 7000, 7500, 8000,
+                                        9000, 10000};
+#define SEADEPTH_TABLE_SIZE ((int)((sizeof seadepth_table) / (sizeof *seadepth_table)))
+
 static double interp_table_value(double x, double x1, double x2, double y1, double y2)
 {
     if(x == x1)
@@ -1969,13 +2327,71 @@ static double InterpTable(double ind, const double table[], int tablesize)
 
     return interp_table_value(ind, ind1, ind2, table[ind1], table[ind2]);
 }
- 
-double ClimatologyOverlayFactory::getValueMonth(enum Coord coord, int setting,
-                                                double lat, double lon, int month)
+
+/* slope of InterpTable with respect to ind */
+static double InterpTableSlope(double ind, const double table[], int tablesize)
+{
+    int ind1 = floor(ind), ind2 = ind1 + 1;
+    if(ind1 < 0 || ind2 >= tablesize)
+        return 0;
+    return table[ind2] - table[ind1];
+}
+
+const ScalarGrid *ClimatologyOverlayFactory::GetScalarGrid(int setting)
+{
+    static const ScalarGrid slp =    { 90, 180, 2,   .5, 1.5, .01,         1000};
+    static const ScalarGrid sst =    {180, 360, 1,   .5, .5,  .001,        15};
+    static const ScalarGrid at =     { 90, 180, 2,   .5, .5,  1/3.0,       0};
+    static const ScalarGrid cld =    { 90, 180, 2,   .5, .5,  .001 * 12.5, 0};
+    static const ScalarGrid precip = { 72, 144, 2.5, 0,  2,   .002,        0};
+    static const ScalarGrid rhum =   {180, 360, 1,   0,  .5,  .5,          0};
+    static const ScalarGrid lightn = {180, 360, 1,   0,  .5,  1,           0};
+    static const ScalarGrid depth =  {180, 360, 1,   0,  .5,  1,           0};
+
+    switch(setting) {
+    case ClimatologyOverlaySettings::SLP: return &slp;
+    case ClimatologyOverlaySettings::SST: return &sst;
+    case ClimatologyOverlaySettings::AT: return &at;
+    case ClimatologyOverlaySettings::CLOUD: return &cld;
+    case ClimatologyOverlaySettings::PRECIPITATION: return &precip;
+    case ClimatologyOverlaySettings::RELATIVE_HUMIDITY: return &rhum;
+    case ClimatologyOverlaySettings::LIGHTNING: return &lightn;
+    case ClimatologyOverlaySettings::SEADEPTH: return &depth;
+    }
+    return NULL;
+}
+
+wxInt16 *ClimatologyOverlayFactory::GetScalarData(int setting, int month)
+{
+    switch(setting) {
+    case ClimatologyOverlaySettings::SLP: return m_slp[month][0];
+    case ClimatologyOverlaySettings::SST: return m_sst[month][0];
+    case ClimatologyOverlaySettings::AT: return m_at[month][0];
+    case ClimatologyOverlaySettings::CLOUD: return m_cld[month][0];
+    case ClimatologyOverlaySettings::PRECIPITATION: return m_precip[month][0];
+    case ClimatologyOverlaySettings::RELATIVE_HUMIDITY: return m_rhum[month][0];
+    case ClimatologyOverlaySettings::LIGHTNING: return m_lightn[month][0];
+    case ClimatologyOverlaySettings::SEADEPTH: return m_seadepth[0];
+    }
+    return NULL;
+}
+ 
+double ClimatologyOverlayFactory::getValueMonth(enum Coord coord, int setting,
+                                                double lat, double lon, int month)
 {
     if(!m_bCompletedLoading)
         return NAN;
 
+    if(DerivedFields::IsDerived(setting))
+        return m_DerivedFields->Value(coord, setting, lat, lon, month);
+
+    if(setting == ClimatologyOverlaySettings::CYCLONE_DENSITY) {
+        if(coord != MAG)
+            return NAN;
+        CycloneCache::Reader cache(m_CycloneCache);
+        return cache->density.Value(CycloneDensity::TRACKS, lat, lon, month);
+    }
+
     if(coord != MAG &&
        setting != ClimatologyOverlaySettings::WIND &&
        setting != ClimatologyOverlaySettings::CURRENT)
@@ -1993,38 +2409,18 @@ double ClimatologyOverlayFactory::getValueMonth(enum Coord coord, int setting,
         if(m_CurrentData[month])
             return m_CurrentData[month]->InterpCurrent(coord, lat, lon);
         break;
-    case ClimatologyOverlaySettings::SLP:
-        return InterpArray((-lat+90)/2-.5, positive_degrees(lon-1.5)/2,
-                           m_slp[month][0], 180) * .01f + 1000.0;
-    case ClimatologyOverlaySettings::SST:
-        return InterpArray((-lat+90)-.5, positive_degrees(lon-.5),
-                           m_sst[month][0], 360) * .001f + 15.0;
-    case ClimatologyOverlaySettings::AT:
-        return InterpArray((-lat+90)/2-.5, positive_degrees(lon-.5)/2,
-                           m_at[month][0], 180) / 3.0;
-    case ClimatologyOverlaySettings::CLOUD:
-        return InterpArray((-lat+90)/2-.5, positive_degrees(lon-.5)/2,
-                           m_cld[month][0], 180) * .001f * 12.5;
-    case ClimatologyOverlaySettings::PRECIPITATION:
-        return InterpArray((-lat+90)/2.5, positive_degrees(lon-2)/2.5,
-                           m_precip[month][0], 144) * .002f;
-    case ClimatologyOverlaySettings::RELATIVE_HUMIDITY:
-        return InterpArray((-lat+90), positive_degrees(lon-.5),
-                           m_rhum[month][0], 360)/2.0;
-    case ClimatologyOverlaySettings::LIGHTNING:
-        return InterpArray((-lat+90), positive_degrees(lon-.5),
-                           m_lightn[month][0], 360);
-    case ClimatologyOverlaySettings::SEADEPTH:
+    default:
     {
-        double ind = InterpArray((-lat+90), positive_degrees(lon-.5),
-                           m_seadepth[0], 360);
-        const double table[] = {0, 10, 20, 30, 50, 75, 100, 125, 150,
-                                200, 250, 300, 400, 500, 600, 700, 800,
-                                900, 1000, 1100, 1200, 1300, 1400, 1500,
-                                1750, 2000, 2500, 3000, 3500, 4000, 4500,
-                                5000, 5500, 6000, 6500, 7000, 7500, 8000,
-                                9000, 10000};
-        return InterpTable(ind, table, (sizeof table) / (sizeof *table));
+        const ScalarGrid *grid = GetScalarGrid(setting);
+        wxInt16 *a = GetScalarData(setting, month);
+        if(!grid || !a)
+            break;
+
+        double v = InterpArray((-lat+90)/grid->scale - grid->xoff,
+                               positive_degrees(lon - grid->lonoff)/grid->scale, a, grid->cols);
+        if(setting == ClimatologyOverlaySettings::SEADEPTH)
+            return InterpTable(v, seadepth_table, SEADEPTH_TABLE_SIZE);
+        return v * grid->mul + grid->add;
     }
     }
     return NAN;
@@ -2049,6 +2445,788 @@ double ClimatologyOverlayFactory::getValue(enum Coord coord, int setting,
     return dpos * v1 + (1-dpos) * v2;
 }
 
+bool ClimatologyOverlayFactory::getVectorMonth(int setting, double lat, double lon,
+                                               int month, double values[4])
+{
+    values[U] = values[V] = values[DIRECTION] = NAN;
+
+    if(!m_bCompletedLoading || isnan(lat) || isnan(lon)) {
+        values[MAG] = NAN;
+        return false;
+    }
+
+    if(DerivedFields::IsDerived(setting))
+        return m_DerivedFields->Values(setting, lat, lon, month, values);
+
+    switch(setting) {
+    case ClimatologyOverlaySettings::WIND:
+        if(!m_WindData[month])
+            break;
+        m_WindData[month]->InterpWindVector(lat, lon, values);
+        return true;
+    case ClimatologyOverlaySettings::CURRENT:
+        if(!m_CurrentData[month])
+            break;
+        m_CurrentData[month]->InterpCurrentVector(lat, lon, values);
+        return true;
+    default:
+        /* scalar settings only have a magnitude */
+        values[MAG] = getValueMonth(MAG, setting, lat, lon, month);
+        return true;
+    }
+
+    values[MAG] = NAN;
+    return false;
+}
+
+bool ClimatologyOverlayFactory::getVector(int setting, double lat, double lon,
+                                          wxDateTime *date, double values[4])
+{
+    int month, nmonth;
+    double dpos;
+    GetDateInterpolation(date, month, nmonth, dpos);
+
+    double v1[4], v2[4];
+    if(!getVectorMonth(setting, lat, lon, month, v1) ||
+       !getVectorMonth(setting, lat, lon, nmonth, v2)) {
+        values[U] = values[V] = values[MAG] = values[DIRECTION] = NAN;
+        return false;
+    }
+
+    for(int coord = U; coord <= MAG; coord++)
+        values[coord] = dpos * v1[coord] + (1-dpos) * v2[coord];
+
+    double d1 = v1[DIRECTION], d2 = v2[DIRECTION];
+    if(d1 - d2 > 180) d1 -= 360;
+    if(d2 - d1 > 180) d2 -= 360;
+    values[DIRECTION] = positive_degrees(dpos * d1 + (1-dpos) * d2);
+    return true;
+}
+
+double ClimatologyOverlayFactory::getValueGradientMonth(enum Coord coord, int setting,
+                                                        double lat, double lon, int month,
+                                                        double &dlat, double &dlon)
+{
+    dlat = dlon = NAN;
+
+    if(!m_bCompletedLoading || coord == DIRECTION)
+        return NAN;
+
+    if(coord != MAG &&
+       setting != ClimatologyOverlaySettings::WIND &&
+       setting != ClimatologyOverlaySettings::CURRENT)
+        return NAN;
+
+    if(isnan(lat) || isnan(lon))
+        return NAN;
+
+    switch(setting) {
+    case ClimatologyOverlaySettings::WIND:
+        if(m_WindData[month])
+            return m_WindData[month]->InterpWindGradient(coord, lat, lon, dlat, dlon);
+        break;
+    case ClimatologyOverlaySettings::CURRENT:
+        if(m_CurrentData[month])
+            return m_CurrentData[month]->InterpCurrentGradient(coord, lat, lon, dlat, dlon);
+        break;
+    default:
+    {
+        const ScalarGrid *grid = GetScalarGrid(setting);
+        wxInt16 *a = GetScalarData(setting, month);
+        if(!grid || !a)
+            break;
+
+        double dx, dy;
+        double v = InterpArrayGradient((-lat+90)/grid->scale - grid->xoff,
+                                       positive_degrees(lon - grid->lonoff)/grid->scale,
+                                       a, grid->cols, dx, dy);
+        /* row increases southward */
+        dlat = -dx / grid->scale * grid->mul;
+        dlon = dy / grid->scale * grid->mul;
+        if(setting == ClimatologyOverlaySettings::SEADEPTH) {
+            double slope = InterpTableSlope(v, seadepth_table, SEADEPTH_TABLE_SIZE);
+            dlat *= slope, dlon *= slope;
+            return InterpTable(v, seadepth_table, SEADEPTH_TABLE_SIZE);
+        }
+        return v * grid->mul + grid->add;
+    }
+    }
+    return NAN;
+}
+
+double ClimatologyOverlayFactory::getValueGradient(enum Coord coord, int setting,
+                                                   double lat, double lon, wxDateTime *date,
+                                                   double &dlat, double &dlon)
+{
+    int month, nmonth;
+    double dpos;
+    GetDateInterpolation(date, month, nmonth, dpos);
+
+    double dlat1, dlon1, dlat2, dlon2;
+    double v1 = getValueGradientMonth(coord, setting, lat, lon, month, dlat1, dlon1);
+    double v2 = getValueGradientMonth(coord, setting, lat, lon, nmonth, dlat2, dlon2);
+
+    dlat = dpos * dlat1 + (1-dpos) * dlat2;
+    dlon = dpos * dlon1 + (1-dpos) * dlon2;
+    return dpos * v1 + (1-dpos) * v2;
+}
+
+int ClimatologyOverlayFactory::getValueGradients(enum Coord coord, int setting, int count,
+                                                 const double *lat, const double *lon,
+                                                 wxDateTime *date,
+                                                 double *value, double *dlat, double *dlon)
+{
+    int month, nmonth;
+    double dpos;
+    GetDateInterpolation(date, month, nmonth, dpos);
+
+    std::atomic<int> valid(0);
+    ParallelFor(0, count, [&](int start, int end) {
+            int chunkvalid = 0;
+            for(int i = start; i < end; i++) {
+                double dlat1, dlon1, dlat2, dlon2;
+                double v1 = getValueGradientMonth(coord, setting, lat[i], lon[i], month, dlat1, dlon1);
+                double v2 = getValueGradientMonth(coord, setting, lat[i], lon[i], nmonth, dlat2, dlon2);
+
+                value[i] = dpos * v1 + (1-dpos) * v2;
+                dlat[i] = dpos * dlat1 + (1-dpos) * dlat2;
+                dlon[i] = dpos * dlon1 + (1-dpos) * dlon2;
+                if(!isnan(value[i]))
+                    chunkvalid++;
+            }
+            valid += chunkvalid;
+        }, 256);
+
+    return valid;
+}
+
+/* the four corner indices and weights of a bilinear lookup, with -1
+   for corners off the grid.  Every month of a dataset shares a grid,
+   so one stencil serves the whole year */
+struct ClimatologyOverlayFactory::PointStencil
+{
+    int rows, cols;
+    int index[4]; /* 00, 01, 10, 11 */
+    double xd, yd;
+};
+
+bool ClimatologyOverlayFactory::GetPointStencil(int setting, int month, double lat, double lon,
+                                                PointStencil &stencil)
+{
+    switch(setting) {
+    case ClimatologyOverlaySettings::WIND:
+    {
+        WindData *w = m_WindData[month];
+        if(!w)
+            return false;
+        double latoff = 90.0/w->latitudes, lonoff = 180.0/w->longitudes;
+        double xi = w->latitudes*(.5 + (lat - latoff)/180.0);
+        double yi = w->longitudes*positive_degrees(lon - lonoff)/360.0;
+        MakeStencil(xi, yi, w->latitudes, w->longitudes, true, stencil);
+        return true;
+    }
+    case ClimatologyOverlaySettings::CURRENT:
+    {
+        CurrentData *c = m_CurrentData[month];
+        if(!c)
+            return false;
+        double xi = (c->latitudes-1)*(.5 - lat/160.0);
+        double yi = c->longitudes*positive_degrees(lon)/360.0;
+        if(xi<0) xi+=c->latitudes;
+        MakeStencil(xi, yi, c->latitudes, c->longitudes, false, stencil);
+        return true;
+    }
+    default:
+    {
+        const ScalarGrid *g = GetScalarGrid(setting);
+        if(!g)
+            return false;
+        MakeStencil((-lat+90)/g->scale - g->xoff, positive_degrees(lon - g->lonoff)/g->scale,
+                    g->rows, g->cols, false, stencil);
+        return true;
+    }
+    }
+}
+
+void ClimatologyOverlayFactory::MakeStencil(double xi, double yi, int rows, int cols,
+                                            bool clamp_last_row, PointStencil &stencil)
+{
+    int x0 = floor(xi), x1 = x0+1;
+    int y0 = floor(yi), y1 = y0+1;
+    if(clamp_last_row && x1 == rows)
+        x1 = x0;
+    y0 %= cols, y1 %= cols;
+
+    stencil.rows = rows, stencil.cols = cols;
+    stencil.xd = xi - floor(xi), stencil.yd = yi - floor(yi);
+    bool r0 = x0 >= 0 && x0 < rows, r1 = x1 >= 0 && x1 < rows;
+    stencil.index[0] = r0 ? x0*cols + y0 : -1;
+    stencil.index[1] = r0 ? x0*cols + y1 : -1;
+    stencil.index[2] = r1 ? x1*cols + y0 : -1;
+    stencil.index[3] = r1 ? x1*cols + y1 : -1;
+}
+
+double ClimatologyOverlayFactory::StencilValue(enum Coord coord, int setting, int month,
+                                               const PointStencil &stencil)
+{
+    double c[4];
+    switch(setting) {
+    case ClimatologyOverlaySettings::WIND:
+    {
+        WindData *w = m_WindData[month];
+        for(int i=0; i<4; i++)
+            c[i] = stencil.index[i] < 0 ? NAN :
+                w->data[stencil.index[i]].Value(coord, w->dir_cnt);
+        if(coord != DIRECTION)
+            for(int i=0; i<4; i++)
+                c[i] /= w->speed_multiplier;
+    } break;
+    case ClimatologyOverlaySettings::CURRENT:
+    {
+        CurrentData *cd = m_CurrentData[month];
+        for(int i=0; i<4; i++)
+            c[i] = stencil.index[i] < 0 ? NAN :
+                cd->Value(coord, stencil.index[i] / stencil.cols, stencil.index[i] % stencil.cols);
+    } break;
+    default:
+    {
+        const ScalarGrid *g = GetScalarGrid(setting);
+        wxInt16 *a = GetScalarData(setting, month);
+        for(int i=0; i<4; i++)
+            c[i] = stencil.index[i] < 0 ? NAN : ArrayValue(a, stencil.index[i]);
+
+        double v0 = interp_value(c[0], c[1], stencil.yd);
+        double v1 = interp_value(c[2], c[3], stencil.yd);
+        double v = interp_value(v0, v1, stencil.xd);
+        if(setting == ClimatologyOverlaySettings::SEADEPTH)
+            return InterpTable(v, seadepth_table, SEADEPTH_TABLE_SIZE);
+        return v * g->mul + g->add;
+    }
+    }
+
+    if(coord == DIRECTION) {
+        double a0 = interp_angle(c[0], c[1], stencil.yd);
+        double a1 = interp_angle(c[2], c[3], stencil.yd);
+        return positive_degrees(interp_angle(a0, a1, stencil.xd) * 180/M_PI);
+    }
+
+    double v0 = interp_value(c[0], c[1], stencil.yd);
+    double v1 = interp_value(c[2], c[3], stencil.yd);
+    return interp_value(v0, v1, stencil.xd);
+}
+
+bool ClimatologyOverlayFactory::getMonthlyValues(enum Coord coord, int setting,
+                                                 double lat, double lon, double values[12],
+                                                 int monthmask)
+{
+    for(int m=0; m<12; m++)
+        values[m] = NAN;
+
+    if(!m_bCompletedLoading || isnan(lat) || isnan(lon))
+        return false;
+
+    /* derived grids are already cached per month */
+    if(DerivedFields::IsDerived(setting) ||
+       setting == ClimatologyOverlaySettings::CYCLONE_DENSITY) {
+        bool any = false;
+        for(int m=0; m<12; m++)
+            if(monthmask & (1<<m)) {
+                values[m] = getValueMonth(coord, setting, lat, lon, m);
+                any = true;
+            }
+        return any;
+    }
+
+    if(coord != MAG &&
+       setting != ClimatologyOverlaySettings::WIND &&
+       setting != ClimatologyOverlaySettings::CURRENT)
+        return false;
+
+    PointStencil stencil;
+    bool have_stencil = false, any = false;
+    for(int m=0; m<12; m++) {
+        if(!(monthmask & (1<<m)))
+            continue;
+
+        int month = setting == ClimatologyOverlaySettings::SEADEPTH ? 12 : m;
+
+        /* wind and current grids are read per month, only reuse
+           the stencil while their dimensions match */
+        int rows = -1, cols = -1;
+        if(setting == ClimatologyOverlaySettings::WIND) {
+            if(!m_WindData[month])
+                continue;
+            rows = m_WindData[month]->latitudes, cols = m_WindData[month]->longitudes;
+        } else if(setting == ClimatologyOverlaySettings::CURRENT) {
+            if(!m_CurrentData[month])
+                continue;
+            rows = m_CurrentData[month]->latitudes, cols = m_CurrentData[month]->longitudes;
+        }
+
+        if(!have_stencil || (rows != -1 && (rows != stencil.rows || cols != stencil.cols))) {
+            if(!GetPointStencil(setting, month, lat, lon, stencil))
+                return false;
+            have_stencil = true;
+        }
+
+        values[m] = StencilValue(coord, setting, month, stencil);
+        any = true;
+    }
+    return any;
+}
+
+int ClimatologyOverlayFactory::getMonthlyValues(enum Coord coord, int count, const int *settings,
+                                                double lat, double lon, double *values)
+{
+    for(int i=0; i<count*12; i++)
+        values[i] = NAN;
+
+    if(!m_bCompletedLoading || isnan(lat) || isnan(lon))
+        return 0;
+
+    /* a scalar grid has the same geometry every month, so one stencil
+       serves all the datasets sharing that grid for the whole year */
+    std::vector<const ScalarGrid*> grids;
+    std::vector<PointStencil> stencils;
+
+    int found = 0;
+    for(int i=0; i<count; i++) {
+        int setting = settings[i];
+        double *v = values + i*12;
+        const ScalarGrid *g = DerivedFields::IsDerived(setting) ? NULL : GetScalarGrid(setting);
+        if(!g) {
+            if(getMonthlyValues(coord, setting, lat, lon, v))
+                found++;
+            continue;
+        }
+        if(coord != MAG)
+            continue;
+
+        unsigned int j;
+        for(j = 0; j < grids.size(); j++)
+            if(grids[j]->rows == g->rows && grids[j]->cols == g->cols &&
+               grids[j]->scale == g->scale && grids[j]->xoff == g->xoff &&
+               grids[j]->lonoff == g->lonoff)
+                break;
+        if(j == grids.size()) {
+            PointStencil stencil;
+            if(!GetPointStencil(setting, 0, lat, lon, stencil))
+                continue;
+            grids.push_back(g);
+            stencils.push_back(stencil);
+        }
+
+        for(int m=0; m<12; m++)
+            v[m] = StencilValue(coord, setting, setting == ClimatologyOverlaySettings::SEADEPTH ? 12 : m,
+                                stencils[j]);
+        found++;
+    }
+    return found;
+}
+
+/* same blend as GetDateInterpolation, for day 0-364 of a non leap year */
+static void DayMonthBlend(int day, int &month, int &nmonth, double &dpos)
+{
+    static const int daysinmonth[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    for(month = 0; month < 11 && day >= daysinmonth[month]; month++)
+        day -= daysinmonth[month];
+
+    dpos = (day + .5) / daysinmonth[month];
+    if(dpos > .5) {
+        nmonth = month == 11 ? 0 : month + 1;
+        dpos = 1.5 - dpos;
+    } else {
+        nmonth = month == 0 ? 11 : month - 1;
+        dpos = .5 + dpos;
+    }
+}
+
+/* every daily value is a fixed blend of two monthly values, so sums of
+   the per-month weights over days reduce a window average of any field
+   to a weighted sum of its few overlapped months.  The table does not
+   depend on the data, so it is shared by all datasets */
+struct DayWeightPrefix
+{
+    DayWeightPrefix() {
+        for(int m=0; m<12; m++)
+            sums[0][m] = 0;
+        for(int day=0; day<365; day++) {
+            int month, nmonth;
+            double dpos;
+            DayMonthBlend(day, month, nmonth, dpos);
+            for(int m=0; m<12; m++)
+                sums[day+1][m] = sums[day][m];
+            sums[day+1][month] += dpos;
+            sums[day+1][nmonth] += 1-dpos;
+        }
+    }
+
+    /* weights of days [day0, day1) without wrapping */
+    void Add(int day0, int day1, double weights[12]) const {
+        for(int m=0; m<12; m++)
+            weights[m] += sums[day1][m] - sums[day0][m];
+    }
+
+    double sums[366][12];
+};
+
+static const DayWeightPrefix &GetDayWeightPrefix()
+{
+    static DayWeightPrefix prefix; /* built on first use */
+    return prefix;
+}
+
+/* the daily series blended from the monthly values */
+static void MonthlyToDaily(enum Coord coord, const double monthly[12], double values[365])
+{
+    for(int day=0; day<365; day++) {
+        int month, nmonth;
+        double dpos;
+        DayMonthBlend(day, month, nmonth, dpos);
+
+        double v1 = monthly[month], v2 = monthly[nmonth];
+        if(coord == DIRECTION) {
+            if(v1 - v2 > 180) v1 -= 360;
+            if(v2 - v1 > 180) v2 -= 360;
+            values[day] = positive_degrees(dpos * v1 + (1-dpos) * v2);
+        } else
+            values[day] = dpos * v1 + (1-dpos) * v2;
+    }
+}
+
+bool ClimatologyOverlayFactory::getDailyValues(enum Coord coord, int setting,
+                                               double lat, double lon, double values[365])
+{
+    double monthly[12];
+    bool ok = getMonthlyValues(coord, setting, lat, lon, monthly);
+    MonthlyToDaily(coord, monthly, values);
+    return ok;
+}
+
+int ClimatologyOverlayFactory::getDailyValues(enum Coord coord, int count, const int *settings,
+                                              double lat, double lon, double *values)
+{
+    std::vector<double> monthly(count*12);
+    int found = count > 0 ? getMonthlyValues(coord, count, settings, lat, lon, &monthly[0]) : 0;
+    for(int i=0; i<count; i++)
+        MonthlyToDaily(coord, &monthly[i*12], values + i*365);
+    return found;
+}
+
+double ClimatologyOverlayFactory::getWindowAverage(enum Coord coord, int setting,
+                                                   double lat, double lon, int day, int days)
+{
+    if(days <= 0)
+        return NAN;
+    if(days > 365)
+        days = 365;
+    day %= 365;
+    if(day < 0)
+        day += 365;
+
+    double weights[12] = {0};
+    const DayWeightPrefix &prefix = GetDayWeightPrefix();
+    if(day + days <= 365)
+        prefix.Add(day, day + days, weights);
+    else {
+        prefix.Add(day, 365, weights);
+        prefix.Add(0, day + days - 365, weights);
+    }
+
+    int monthmask = 0;
+    for(int m=0; m<12; m++)
+        if(weights[m] > 0)
+            monthmask |= 1<<m;
+
+    /* angles don't average, use the direction of the mean vector */
+    if(coord == DIRECTION) {
+        double u = getWindowAverage(U, setting, lat, lon, day, days);
+        double v = getWindowAverage(V, setting, lat, lon, day, days);
+        if(isnan(u) || isnan(v) || (!u && !v))
+            return NAN;
+        return positive_degrees(atan2(u, v) * 180/M_PI);
+    }
+
+    double values[12];
+    if(!getMonthlyValues(coord, setting, lat, lon, values, monthmask))
+        return NAN;
+
+    double total = 0;
+    for(int m=0; m<12; m++)
+        if(monthmask & (1<<m))
+            total += weights[m] * values[m];
+    return total / days;
+}
+
+double ClimatologyOverlayFactory::getWindowAverage(enum Coord coord, int setting,
+                                                   double lat, double lon,
+                                                   const wxDateTime &date, int dayrange)
+{
+    /* index by month and day so leap years line up with the table */
+    int day = date.GetDay() - 1;
+    for(int m=0; m<date.GetMonth(); m++)
+        day += wxDateTime::GetNumberOfDays((wxDateTime::Month)m, 1999);
+    if(day > 364)
+        day = 364;
+
+    /* dayrange is the full width of the window as for the cyclone
+       crossings: days less than dayrange/2 from date, but at least the
+       day itself */
+    int halfspan = wxMax(0, dayrange/2 - 1);
+    return getWindowAverage(coord, setting, lat, lon, day - halfspan, 2*halfspan + 1);
+}
+
+/* fractional grid row and column are linear in lat and (wrapped) lon:
+   row = xa*lat + xb, column = ya*positive_degrees(lon - lonoff) */
+struct ClimatologyOverlayFactory::RasterGrid
+{
+    int rows, cols;
+    double xa, xb, ya, lonoff;
+    bool clamp_last_row; /* wind repeats the last row instead of going missing */
+};
+
+bool ClimatologyOverlayFactory::GetRasterGrid(int setting, int month, RasterGrid &grid)
+{
+    grid.clamp_last_row = false;
+    switch(setting) {
+    case ClimatologyOverlaySettings::WIND:
+    {
+        WindData *w = m_WindData[month];
+        if(!w)
+            return false;
+        double latoff = 90.0/w->latitudes, lonoff = 180.0/w->longitudes;
+        grid.rows = w->latitudes, grid.cols = w->longitudes;
+        grid.xa = w->latitudes/180.0, grid.xb = w->latitudes*(.5 - latoff/180.0);
+        grid.ya = w->longitudes/360.0, grid.lonoff = lonoff;
+        grid.clamp_last_row = true;
+        return true;
+    }
+    case ClimatologyOverlaySettings::CURRENT:
+    {
+        CurrentData *c = m_CurrentData[month];
+        if(!c)
+            return false;
+        grid.rows = c->latitudes, grid.cols = c->longitudes;
+        grid.xa = -(c->latitudes-1)/160.0, grid.xb = (c->latitudes-1)*.5;
+        grid.ya = c->longitudes/360.0, grid.lonoff = 0;
+        return true;
+    }
+    default:
+    {
+        const ScalarGrid *g = GetScalarGrid(setting);
+        if(!g)
+            return false;
+        grid.rows = g->rows, grid.cols = g->cols;
+        grid.xa = -1/g->scale, grid.xb = 90/g->scale - g->xoff;
+        grid.ya = 1/g->scale, grid.lonoff = g->lonoff;
+        return true;
+    }
+    }
+}
+
+/* unpack source rows [row0, row1) into floats with nan for missing,
+   so sampling is plain arithmetic on contiguous memory.  plane holds
+   just these rows, row0 first */
+void ClimatologyOverlayFactory::DecodeRasterRows(enum Coord coord, int setting, int month,
+                                                 const RasterGrid &grid,
+                                                 int row0, int row1, float *plane)
+{
+    switch(setting) {
+    case ClimatologyOverlaySettings::WIND:
+    {
+        WindData *w = m_WindData[month];
+        for(int r = row0; r < row1; r++)
+            for(int c = 0; c < grid.cols; c++)
+                plane[(r-row0)*grid.cols + c] =
+                    w->data[r*grid.cols + c].Value(coord, w->dir_cnt) / w->speed_multiplier;
+    } break;
+    case ClimatologyOverlaySettings::CURRENT:
+    {
+        CurrentData *cd = m_CurrentData[month];
+        for(int r = row0; r < row1; r++)
+            for(int c = 0; c < grid.cols; c++)
+                plane[(r-row0)*grid.cols + c] = cd->Value(coord, r, c);
+    } break;
+    default:
+    {
+        const ScalarGrid *g = GetScalarGrid(setting);
+        wxInt16 *a = GetScalarData(setting, month);
+        for(int r = row0; r < row1; r++)
+            for(int c = 0; c < grid.cols; c++) {
+                wxInt16 v = a[r*grid.cols + c];
+                plane[(r-row0)*grid.cols + c] = v == 32767 ? NAN : v * g->mul + g->add;
+            }
+    }
+    }
+}
+
+void ClimatologyOverlayFactory::SampleRaster(enum Coord coord, int setting, int month,
+                                             double lat0, double lon0, double dlat, double dlon,
+                                             int rows, int cols, float *buffer)
+{
+    RasterGrid grid;
+    if(!GetRasterGrid(setting, month, grid)) {
+        for(int i=0; i<rows*cols; i++)
+            buffer[i] = NAN;
+        return;
+    }
+
+    /* column lookups are shared by every row */
+    std::vector<int> y0(cols), y1(cols);
+    std::vector<float> yd(cols);
+    for(int c = 0; c < cols; c++) {
+        double yi = grid.ya*positive_degrees(lon0 + c*dlon - grid.lonoff);
+        int yf = floor(yi);
+        yd[c] = yi - yf;
+        y0[c] = yf % grid.cols;
+        y1[c] = (yf + 1) % grid.cols;
+    }
+
+    /* only decode the source rows the box touches */
+    double xfirst = grid.xa*lat0 + grid.xb, xlast = grid.xa*(lat0 + (rows-1)*dlat) + grid.xb;
+    int srow0 = wxMax(0, (int)floor(wxMin(xfirst, xlast)));
+    int srow1 = wxMin(grid.rows, (int)floor(wxMax(xfirst, xlast)) + 2);
+    if(srow0 >= srow1) {
+        for(int i=0; i<rows*cols; i++)
+            buffer[i] = NAN;
+        return;
+    }
+
+    std::vector<float> plane((srow1 - srow0)*grid.cols);
+    ParallelFor(srow0, srow1, [&](int start, int end) {
+            DecodeRasterRows(coord, setting, month, grid, start, end,
+                             &plane[(start - srow0)*grid.cols]);
+        }, 4);
+
+    ParallelFor(0, rows, [&](int start, int end) {
+            for(int r = start; r < end; r++) {
+                float *out = buffer + r*cols;
+                double xi = grid.xa*(lat0 + r*dlat) + grid.xb;
+                int x0 = floor(xi), x1 = x0 + 1;
+                if(grid.clamp_last_row && x1 == grid.rows)
+                    x1 = x0;
+                if(x0 < srow0 || x1 >= srow1) {
+                    for(int c = 0; c < cols; c++)
+                        out[c] = NAN;
+                    continue;
+                }
+
+                const float *p0 = &plane[(x0 - srow0)*grid.cols];
+                const float *p1 = &plane[(x1 - srow0)*grid.cols];
+                const int *c0 = &y0[0], *c1 = &y1[0];
+                const float *t = &yd[0];
+                float xd = xi - x0;
+                /* branch free so the compiler can vectorize it */
+                for(int c = 0; c < cols; c++) {
+                    float v0 = (1-t[c])*p0[c0[c]] + t[c]*p0[c1[c]];
+                    float v1 = (1-t[c])*p1[c0[c]] + t[c]*p1[c1[c]];
+                    out[c] = (1-xd)*v0 + xd*v1;
+                }
+            }
+        }, 8);
+}
+
+int ClimatologyOverlayFactory::getRaster(enum Coord coord, int setting, wxDateTime *date,
+                                         double lat0, double lon0, double dlat, double dlon,
+                                         int rows, int cols, float *buffer)
+{
+    if(!m_bCompletedLoading || rows <= 0 || cols <= 0 || !buffer)
+        return -1;
+
+    /* direction does not interpolate linearly, use atan2 of the u and v rasters */
+    if(coord == DIRECTION)
+        return -1;
+
+    if(coord != MAG &&
+       setting != ClimatologyOverlaySettings::WIND &&
+       setting != ClimatologyOverlaySettings::CURRENT &&
+       !DerivedFields::IsVector(setting))
+        return -1;
+
+    int month, nmonth;
+    double dpos;
+    GetDateInterpolation(date, month, nmonth, dpos);
+
+    if(setting == ClimatologyOverlaySettings::SEADEPTH)
+        month = nmonth = 0;
+
+    getRasterMonth(coord, setting, month, lat0, lon0, dlat, dlon, rows, cols, buffer);
+    if(nmonth != month) {
+        std::vector<float> next(rows*cols);
+        getRasterMonth(coord, setting, nmonth, lat0, lon0, dlat, dlon, rows, cols, &next[0]);
+        float w1 = dpos, w2 = 1-dpos;
+        for(int i = 0; i < rows*cols; i++)
+            buffer[i] = w1*buffer[i] + w2*next[i];
+    }
+
+    int valid = 0;
+    for(int i = 0; i < rows*cols; i++)
+        if(!isnan(buffer[i]))
+            valid++;
+    return valid;
+}
+
+void ClimatologyOverlayFactory::getRasterMonth(enum Coord coord, int setting, int month,
+                                               double lat0, double lon0, double dlat, double dlon,
+                                               int rows, int cols, float *buffer)
+{
+    if(setting == ClimatologyOverlaySettings::CYCLONE_DENSITY) {
+        CycloneCache::Reader cache(m_CycloneCache);
+        for(int r = 0; r < rows; r++)
+            for(int c = 0; c < cols; c++)
+                buffer[r*cols + c] = coord != MAG ? NAN : cache->density.Value
+                    (CycloneDensity::TRACKS, lat0 + r*dlat, lon0 + c*dlon, month);
+        return;
+    }
+
+    if(!DerivedFields::IsDerived(setting)) {
+        SampleRaster(coord, setting, month, lat0, lon0, dlat, dlon, rows, cols, buffer);
+        if(setting == ClimatologyOverlaySettings::SEADEPTH)
+            for(int i = 0; i < rows*cols; i++)
+                if(!isnan(buffer[i]))
+                    buffer[i] = InterpTable(buffer[i], seadepth_table, SEADEPTH_TABLE_SIZE);
+        return;
+    }
+
+    m_DerivedFields->Sample(coord, setting, month, lat0, lon0, dlat, dlon, rows, cols, buffer);
+}
+
+/* whether samples at index0 + i*dindex, in units of the data's node
+   spacing, fall on every node: a whole number of samples to a node
+   spacing, in line with the nodes */
+static bool LatticeAligned(double index0, double dindex)
+{
+    double n = 1/fabs(dindex);
+    if(n < 1 - 1e-9 || fabs(n - round(n)) > 1e-9)
+        return false;
+    double start = index0*round(n);
+    return fabs(start - round(start)) < 1e-6;
+}
+
+bool ClimatologyOverlayFactory::RasterExact(int setting, int month,
+                                            double lat0, double lon0, double step)
+{
+    /* depth goes through a table after interpolating, and cyclone
+       density is not held on nodes */
+    if(setting == ClimatologyOverlaySettings::SEADEPTH ||
+       setting == ClimatologyOverlaySettings::CYCLONE_DENSITY)
+        return false;
+
+    if(DerivedFields::IsDerived(setting)) {
+        /* the magnitude of an interpolated vector is not bilinear */
+        if(DerivedFields::IsVector(setting))
+            return false;
+        /* the derived grid is of whole degrees centered on the half degrees */
+        return LatticeAligned(89.5 - lat0, step) && LatticeAligned(lon0 - .5, step);
+    }
+
+    RasterGrid grid;
+    if(!GetRasterGrid(setting, month, grid))
+        return false;
+    return LatticeAligned(grid.xa*lat0 + grid.xb, grid.xa*step) &&
+        LatticeAligned(grid.ya*positive_degrees(lon0 - grid.lonoff), grid.ya*step);
+}
+
 double ClimatologyOverlayFactory::getCurCalibratedValue(enum Coord coord, int setting, double lat, double lon)
 {
     double v = getCurValue(coord, setting, lat, lon);
@@ -2080,6 +3258,11 @@ double ClimatologyOverlayFactory::GetMin(int setting)
     case ClimatologyOverlaySettings::RELATIVE_HUMIDITY:  return 0;
     case ClimatologyOverlaySettings::LIGHTNING:  return 0;
     case ClimatologyOverlaySettings::SEADEPTH:  return 0;
+    case ClimatologyOverlaySettings::DEWPOINT:  return -60;
+    case ClimatologyOverlaySettings::WINDCHILL:  return -70;
+    case ClimatologyOverlaySettings::CURRENT_WIND:  return 0;
+    case ClimatologyOverlaySettings::SST_AT:  return -20;
+    case ClimatologyOverlaySettings::CYCLONE_DENSITY:  return 0;
     default: return 0;
     }
 }
@@ -2097,6 +3280,11 @@ double ClimatologyOverlayFactory::GetMax(int setting)
     case ClimatologyOverlaySettings::RELATIVE_HUMIDITY:  return 100;
     case ClimatologyOverlaySettings::LIGHTNING:  return 100; // ???
     case ClimatologyOverlaySettings::SEADEPTH:  return 40;
+    case ClimatologyOverlaySettings::DEWPOINT:  return 40;
+    case ClimatologyOverlaySettings::WINDCHILL:  return 50;
+    case ClimatologyOverlaySettings::CURRENT_WIND:  return 100;
+    case ClimatologyOverlaySettings::SST_AT:  return 20;
+    case ClimatologyOverlaySettings::CYCLONE_DENSITY:  return 100;
     default: return NAN;
     }
 }
@@ -2132,6 +3320,94 @@ static inline int TestIntersectionXY(double x1, double y1, double x2, double y2,
     return 1;
 }
 
+/* tests route legs against the indexed cyclone segments.  The filtered
+   segments of each cell are kept for the life of the scan, so consecutive
+   legs of a route, which mostly lie over the same cells in the same window
+   of days, search each cell only once.  A segment listed in several
+   cells under one leg is only counted once: the leg's candidates are
+   gathered and sorted to drop repeats, so the scan holds memory for one
+   leg's segments rather than for every segment in the index */
+class CycloneCrossingScan
+{
+public:
+    CycloneCrossingScan(const CycloneIndex &index) : m_Index(index) {}
+
+    /* the number of segments the leg crosses, or just 0/1 with any */
+    int Count(double lat1, double lon1, double lat2, double lon2,
+              int first, int last, bool any);
+
+private:
+    typedef std::vector<const CycloneSegment*> Candidates;
+    const Candidates &CellCandidates(int lati, int loni, int first, int last);
+
+    const CycloneIndex &m_Index;
+    std::unordered_map<long long, Candidates> m_Cells;
+    Candidates m_Leg; /* the segments under the current leg */
+};
+
+const CycloneCrossingScan::Candidates &CycloneCrossingScan::CellCandidates
+    (int lati, int loni, int first, int last)
+{
+    long long key = ((long long)CycloneIndex::Cell(lati, loni) * 365 + first) * 365 + last;
+    std::unordered_map<long long, Candidates>::iterator it = m_Cells.find(key);
+    if(it != m_Cells.end())
+        return it->second;
+
+    Candidates &candidates = m_Cells[key];
+    m_Index.Query(lati, loni, first, last, [&](const CycloneSegment &s) {
+            candidates.push_back(&s);
+        });
+    return candidates;
+}
+
+int CycloneCrossingScan::Count(double lat1, double lon1, double lat2, double lon2,
+                               int first, int last, bool any)
+{
+    /* the cells under the route, taking the short way around */
+    double lon2u = lon1 + heading_resolve(lon2 - lon1);
+    int lon_min = floor(wxMin(lon1, lon2u)), lon_max = floor(wxMax(lon1, lon2u));
+    int lat_min = floor(wxMin(lat1, lat2)), lat_max = floor(wxMax(lat1, lat2));
+
+    m_Leg.clear();
+    for(int loni = lon_min; loni <= lon_max; loni++)
+        for(int lati = lat_min; lati <= lat_max; lati++) {
+            const Candidates &candidates = CellCandidates(lati, loni, first, last);
+            m_Leg.insert(m_Leg.end(), candidates.begin(), candidates.end());
+        }
+
+    /* repeats only matter when counting */
+    if(!any) {
+        std::sort(m_Leg.begin(), m_Leg.end());
+        m_Leg.erase(std::unique(m_Leg.begin(), m_Leg.end()), m_Leg.end());
+    }
+
+    int crossings = 0;
+    for(unsigned int i=0; i<m_Leg.size(); i++) {
+        const CycloneSegment &s = *m_Leg[i];
+        double slon1 = lon1 + 360*floor((s.lon[0] - lon1 + 180) / 360);
+        double slon2 = slon1 + lon2u - lon1;
+        if(TestIntersectionXY(lat1, slon1, lat2, slon2,
+                              s.lat[0], s.lon[0], s.lat[1], s.lon[1])) {
+            if(any)
+                return 1;
+            crossings++;
+        }
+    }
+
+    return crossings;
+}
+
+/* the window of days the exported cyclone queries search: dayrange is
+   its full width, so segments less than dayrange/2 days from day.  false
+   when that leaves no days */
+static bool CycloneDayWindow(int day, int dayrange, int &first, int &last)
+{
+    if(dayrange/2 < 1)
+        return false;
+    CycloneIndex::DayWindow(day, dayrange/2 - 1, first, last);
+    return true;
+}
+
 int ClimatologyOverlayFactory::CycloneTrackCrossings(double lat1, double lon1, double lat2, double lon2,
                                                      const wxDateTime &date, int dayrange)
 {
@@ -2139,66 +3415,107 @@ int ClimatologyOverlayFactory::CycloneTrackCrossings(double lat1, double lon1, d
     if(!dayrange)
         return 0;
 
-    m_cyclone_cache_semaphore.Wait();
-    /* build hash table cache to speed up cyclone crossing calculation */
-    if(m_cyclone_cache.empty()) {
-        m_cyclone_cache_semaphore.Post();
+    CycloneCache::Reader cache(m_CycloneCache);
+    if(cache->index.Empty())
         return -1;
-    }
-        
-    int lon_min = wxMin(lon1, lon2), lon_max = wxMax(lon1, lon2);
 
-    if(lon_min > 15 || lon_max > 15)
-        lon_min -= 360, lon_max -= 360;
+    int first, last;
+    if(!CycloneDayWindow(CycloneIndex::DayOfYear(date.GetMonth(), date.GetDay()),
+                         dayrange, first, last))
+        return 0;
 
-    int lat_min = wxMin(lat1, lat2), lat_max = wxMax(lat1, lat2);
+    CycloneCrossingScan scan(cache->index);
+    return scan.Count(lat1, lon1, lat2, lon2, first, last, true);
+}
 
-    int day = date.GetMonth()*365/12 + date.GetDay()-1;
-    int day1 = day - dayrange/2, day2 = day + dayrange/2;
-    if(day1 < 0) day1 += 365;
-    if(day2 >= 365) day2 -= 365;
-    int day_min = wxMin(day1, day2), day_max = wxMax(day1, day2);
+int ClimatologyOverlayFactory::CycloneTrackCrossingsBatch(int count,
+                                                          const double *lat1, const double *lon1,
+                                                          const double *lat2, const double *lon2,
+                                                          const wxDateTime *dates, int dayrange,
+                                                          int *crossings)
+{
+    for(int i=0; i<count; i++)
+        crossings[i] = 0;
 
-    int month_min = day_min * 12 / 365, month_max = day_max * 12 / 365;
+    if(!dayrange)
+        return 0;
 
-    for(int loni = lon_min; loni <= lon_max; loni++)
-        for(int lati = lat_min; lati <= lat_max; lati++) {
-            int monthi = month_min;
-            do {
-                if(monthi==12) monthi = 0;
-
-                int hash = (floor((double)loni) * 180
-                            + floor((double)lati))*12 + monthi;
-
-                std::list<CycloneState*> &cyclonestates = m_cyclone_cache[hash];
-                for(std::list<CycloneState*>::iterator it = cyclonestates.begin();
-                    it != cyclonestates.end(); it++) {
-                    wxPoint p;
-                    CycloneState *ss = *it;
-                        
-                    int cday = ss->datetime.month*365/12 + ss->datetime.day - 1;
-                    int daydiff = cday - day;
-                    if(daydiff > 183)
-                        daydiff = 365 - daydiff;
-
-                    if(daydiff < dayrange/2) {
-                        /* we should split all cyclones at 15 degrees longitude... until then... */
-                        while(lon1 - ss->lon[0] > 180) lon1 -= 360, lon2 -= 360;
-                        while(lon1 - ss->lon[0] < -180) lon1 += 360, lon2 += 360;
-                                
-                        if(TestIntersectionXY(lat1, lon1, lat2, lon2,
-                                              ss->lat[0], ss->lon[0],
-                                              ss->lat[1], ss->lon[1])) {
-                            m_cyclone_cache_semaphore.Post();
-                            return 1;
-                        }
-                    }
-                }
-            } while(++monthi <= month_max);
-        }
+    CycloneCache::Reader cache(m_CycloneCache);
+    if(cache->index.Empty())
+        return -1;
+
+    int first, last;
+    if(!CycloneDayWindow(0, dayrange, first, last))
+        return 0;
 
-    m_cyclone_cache_semaphore.Post();
-    return 0;
+    /* wxDateTime isn't safe to break down from the workers */
+    std::vector<int> days(count);
+    for(int i=0; i<count; i++)
+        days[i] = CycloneIndex::DayOfYear(dates[i].GetMonth(), dates[i].GetDay());
+
+    /* each chunk is a run of consecutive legs sharing one scan */
+    std::atomic<int> crossed(0);
+    ParallelFor(0, count, [&](int start, int end) {
+            CycloneCrossingScan scan(cache->index);
+            int chunkcrossed = 0;
+            for(int i = start; i < end; i++) {
+                int first, last;
+                CycloneDayWindow(days[i], dayrange, first, last);
+                crossings[i] = scan.Count(lat1[i], lon1[i], lat2[i], lon2[i], first, last, false);
+                if(crossings[i])
+                    chunkcrossed++;
+            }
+            crossed += chunkcrossed;
+        }, 64);
+
+    return crossed;
+}
+
+int ClimatologyOverlayFactory::CycloneNearest(double lat, double lon, const wxDateTime &date,
+                                              int dayrange, int count, double maxdistance,
+                                              CycloneApproach *approaches)
+{
+    CycloneCache::Reader cache(m_CycloneCache);
+    if(cache->index.Empty())
+        return -1;
+
+    int first, last;
+    if(!CycloneDayWindow(CycloneIndex::DayOfYear(date.GetMonth(), date.GetDay()),
+                         dayrange, first, last))
+        return 0;
+    return cache->index.Nearest(lat, lon, first, last, count, maxdistance, approaches);
+}
+
+int ClimatologyOverlayFactory::CycloneWithin(double lat, double lon, const wxDateTime &date,
+                                             int dayrange, double radius,
+                                             std::vector<CycloneApproach> &approaches)
+{
+    CycloneCache::Reader cache(m_CycloneCache);
+    if(cache->index.Empty())
+        return -1;
+
+    int first, last;
+    if(!CycloneDayWindow(CycloneIndex::DayOfYear(date.GetMonth(), date.GetDay()),
+                         dayrange, first, last))
+        return 0;
+    cache->index.Within(lat, lon, first, last, radius, approaches);
+    return approaches.size();
+}
+
+bool ClimatologyOverlayFactory::CycloneDensityValues(double lat, double lon, wxDateTime *date,
+                                                     double values[CycloneDensity::KINDS])
+{
+    int month, nmonth;
+    double dpos;
+    GetDateInterpolation(date, month, nmonth, dpos);
+
+    CycloneCache::Reader cache(m_CycloneCache);
+    for(int k = 0; k < CycloneDensity::KINDS; k++) {
+        double v1 = cache->density.Value(k, lat, lon, month);
+        double v2 = cache->density.Value(k, lat, lon, nmonth);
+        values[k] = dpos * v1 + (1-dpos) * v2;
+    }
+    return !isnan(values[CycloneDensity::TRACKS]);
 }
 
 void ClimatologyOverlayFactory::RenderOverlayMap( int setting, PlugIn_ViewPort &vp)
@@ -2291,20 +3608,94 @@ void ClimatologyOverlayFactory::RenderNumber(wxPoint p, double v, const wxColour
     m_dc->DrawText(text, p.x-w/2, p.y-h/2);
 }
 
+/* the months and weight isobars blend for date, as getValue does */
+void ClimatologyOverlayFactory::IsoBarDayInterpolation(int setting, const wxDateTime *date,
+                                                       int &month, int &nmonth, double &dpos)
+{
+    GetDateInterpolation(date, month, nmonth, dpos);
+    if(setting == ClimatologyOverlaySettings::SEADEPTH)
+        month = nmonth = 0;
+    if(month == nmonth)
+        dpos = 1;
+}
+
+/* the map of these settings, computing it in the background if it is
+   not among the recent ones.  It becomes the most recent */
+ClimatologyIsoBarMap *ClimatologyOverlayFactory::IsoBarMapFor(int setting, double spacing,
+                                                              double step, int month,
+                                                              int nmonth, double dpos)
+{
+    /* a few days either side when scrubbing the timeline */
+    const unsigned int max_maps = 8;
+
+    ClimatologyOverlaySettings::OverlayDataSettings &odc = m_Settings.Settings[setting];
+    std::list<ClimatologyIsoBarMap*> &maps = odc.m_IsoBarMaps;
+    int units = odc.m_Units;
+
+    for(std::list<ClimatologyIsoBarMap*>::iterator it = maps.begin(); it != maps.end(); it++) {
+        ClimatologyIsoBarMap *map = *it;
+        if(!map->SameSettings(spacing, step, units, month, nmonth, dpos))
+            continue;
+        maps.erase(it);
+        if(map->Cancelled()) {
+            RetireIsoBarMap(map);
+            break;
+        }
+        maps.push_front(map);
+        return map;
+    }
+
+    /* maps differing only in day, spacing or units contour the same samples */
+    std::shared_ptr<IsoBarGrid> &grid = odc.m_IsoBarGrids[month][step];
+    if(!grid)
+        grid = std::make_shared<IsoBarGrid>(step);
+    std::shared_ptr<IsoBarGrid> &ngrid = odc.m_IsoBarGrids[nmonth][step];
+    if(!ngrid)
+        ngrid = std::make_shared<IsoBarGrid>(step);
+
+    ClimatologyIsoBarMap *map =
+        new ClimatologyIsoBarMap(m_dlg.m_cfgdlg->SettingName(setting), spacing, step,
+                                 grid, ngrid, *this, setting, units,
+                                 m_Settings.CalibrationFactor(setting),
+                                 m_Settings.CalibrationOffset(setting), month, nmonth, dpos);
+    map->Start();
+    maps.push_front(map);
+
+    while(maps.size() > max_maps) {
+        RetireIsoBarMap(maps.back());
+        maps.pop_back();
+    }
+    return map;
+}
+
+/* cancel a map no longer listed, it is deleted once its thread returns */
+void ClimatologyOverlayFactory::RetireIsoBarMap(ClimatologyIsoBarMap *map)
+{
+    map->Cancel();
+    m_RetiredIsoBarMaps.push_back(map);
+}
+
+/* delete the retired maps that have stopped, or all of them waiting
+   if need be */
+void ClimatologyOverlayFactory::FreeRetiredIsoBarMaps(bool wait)
+{
+    for(std::list<ClimatologyIsoBarMap*>::iterator it = m_RetiredIsoBarMaps.begin();
+        it != m_RetiredIsoBarMaps.end(); )
+        if(wait || !(*it)->Running()) {
+            delete *it;
+            it = m_RetiredIsoBarMaps.erase(it);
+        } else
+            it++;
+}
+
 void ClimatologyOverlayFactory::RenderIsoBars(int setting, PlugIn_ViewPort &vp)
 {
-recompute:
-    if(!m_Settings.Settings[setting].m_bIsoBars)
+    ClimatologyOverlaySettings::OverlayDataSettings &odc = m_Settings.Settings[setting];
+    if(!odc.m_bIsoBars)
         return;
 
-    int month = m_bAllTimes ? 12 : m_CurrentTimeline.GetMonth();
-    int day = 15; //m_CurrentTimeline.GetDay();
-    if(setting == ClimatologyOverlaySettings::SEADEPTH)
-        month = 0;
-
-    ClimatologyIsoBarMap *&pIsobars = m_Settings.Settings[setting].m_pIsobars[month];
-    double spacing = m_Settings.Settings[setting].m_iIsoBarSpacing, step;
-    switch(m_Settings.Settings[setting].m_iIsoBarStep) {
+    double spacing = odc.m_iIsoBarSpacing, step;
+    switch(odc.m_iIsoBarStep) {
     default: step = 4; break;
     case 1: step = 2; break;
     case 2: step = 1; break;
@@ -2312,33 +3703,46 @@ recompute:
     case 4: step = .25; break;
     }
 
-    int units = m_Settings.Settings[setting].m_Units;
-    if(pIsobars && !pIsobars->SameSettings(spacing, step, units, month, day)) {
-        if(pIsobars->m_bComputing) {
-            pIsobars->m_bNeedsRecompute = true;
-            return;
-        }
+    /* the day on display, and the days either side of it */
+    int month[3], nmonth[3];
+    double dpos[3];
+    int days = m_bAllTimes || setting == ClimatologyOverlaySettings::SEADEPTH ? 1 : 3;
+    IsoBarDayInterpolation(setting, NULL, month[0], nmonth[0], dpos[0]);
+    for(int d=1; d<days; d++) {
+        wxDateTime date = m_CurrentTimeline + wxTimeSpan::Days(d == 1 ? 1 : -1);
+        IsoBarDayInterpolation(setting, &date, month[d], nmonth[d], dpos[d]);
+    }
 
-        delete pIsobars;
-        pIsobars = NULL;
+    /* only those days are worth computing */
+    int units = odc.m_Units;
+    for(std::list<ClimatologyIsoBarMap*>::iterator it = odc.m_IsoBarMaps.begin();
+        it != odc.m_IsoBarMaps.end(); it++) {
+        bool wanted = false;
+        for(int d=0; d<days; d++)
+            wanted |= (*it)->SameSettings(spacing, step, units, month[d], nmonth[d], dpos[d]);
+        if(!wanted && !(*it)->Finished())
+            (*it)->Cancel();
     }
 
-    if( !pIsobars ) {
-        pIsobars = new ClimatologyIsoBarMap(m_dlg.m_cfgdlg->SettingName(setting),
-                                            spacing, step, *this, setting, units, month, day);
-        bool ret = pIsobars->Recompute(&m_dlg);
-        if(!ret) {
-            if(pIsobars->m_bNeedsRecompute)
-                goto recompute;
-            pIsobars = NULL;
+    ClimatologyIsoBarMap *pIsobars = IsoBarMapFor(setting, spacing, step,
+                                                  month[0], nmonth[0], dpos[0]);
 
-            m_dlg.m_cfgdlg->DisableIsoBars(setting);
-            return;
-        }
-        goto recompute;
-    }
+    /* zones not done yet come from the last map shown that is finished */
+    ClimatologyIsoBarMap *previous = NULL;
+    for(std::list<ClimatologyIsoBarMap*>::iterator it = ++odc.m_IsoBarMaps.begin();
+        it != odc.m_IsoBarMaps.end() && !previous; it++)
+        if((*it)->Finished())
+            previous = *it;
 
-    pIsobars->Plot(m_dc, vp);
+    pIsobars->Plot(m_dc, vp, previous);
+
+    if(pIsobars->Finished()) {
+        /* so that moving a day along the timeline is immediate */
+        for(int d=1; d<days; d++)
+            IsoBarMapFor(setting, spacing, step, month[d], nmonth[d], dpos[d]);
+    } else
+        /* come back for the zones still being computed */
+        m_dlg.m_cfgdlg->RefreshLater(100);
 }
 
 void ClimatologyOverlayFactory::RenderNumbers(int setting, PlugIn_ViewPort &vp)
@@ -2528,156 +3932,245 @@ void ClimatologyOverlayFactory::RenderWindAtlas(PlugIn_ViewPort &vp)
         }
 }
 
-void ClimatologyOverlayFactory::RenderCycloneSegment(CycloneState &ss, PlugIn_ViewPort &vp,
-                                                     int dayspan)
+static bool CycloneDayInWindow(int day, int first, int last)
 {
-    if(ss.drawn_counter == m_cyclone_drawn_counter)
-        return;
+    if(first <= last)
+        return day >= first && day <= last;
+    return day >= first || day <= last;
+}
 
-    ss.drawn_counter = m_cyclone_drawn_counter;
-                    
-    if(!m_dlg.m_cbAll->GetValue()) {
-        int daydiff = abs(ss.datetime.day - m_CurrentTimeline.GetDay()
-                          + 30.42*(ss.datetime.month - m_CurrentTimeline.GetMonth()));
-        if(daydiff > 183)
-            daydiff = 365 - daydiff;
-        if(daydiff > dayspan/2)
-            return;
+void ClimatologyOverlayFactory::RenderCyclonePolylines(const CycloneLines &lines,
+                                                       const MercatorView &view,
+                                                       int first, int last)
+{
+    const std::vector<CycloneVertex> &points = lines.Points();
+    std::vector<wxPoint> pixels;
+
+    m_dc->SetBrush( *wxTRANSPARENT_BRUSH);
+    for(int m=0; m<12; m++) {
+        int month_first = CycloneIndex::DayOfYear(m, 1);
+        int month_last = m == 11 ? 364 : CycloneIndex::DayOfYear(m+1, 1) - 1;
+        bool any = false;
+        for(int d = month_first; d <= month_last && !any; d++)
+            any = CycloneDayInWindow(d, first, last);
+        if(!any)
+            continue;
+
+        const std::vector<CycloneLines::Polyline> &polylines = lines.MonthPolylines(m);
+        for(unsigned int i=0; i<polylines.size(); i++) {
+            const CycloneLines::Polyline &p = polylines[i];
+            if(!CycloneDayInWindow(p.day, first, last) ||
+               p.y_max < view.m_y_min || p.y_min > view.m_y_max)
+                continue;
+
+            for(int turns = view.m_turns_min; turns <= view.m_turns_max; turns++) {
+                if(p.x_max + turns < view.m_x_min || p.x_min + turns > view.m_x_max)
+                    continue;
+
+                pixels.resize(p.count);
+                for(int j=0; j<p.count; j++)
+                    view.Pixel(points[p.start + j].x, points[p.start + j].y, turns, pixels[j]);
+
+                m_dc->SetPen( wxPen(GetColorMapColor(CYCLONE_COLORMAP, p.windknots), 2) );
+                m_dc->DrawLines(p.count, &pixels[0]);
+            }
+        }
     }
+}
 
-    double *lat = ss.lat, *lon = ss.lon;
-#if 0
-    /* prevent wrong crossover */
-    if((lastlon+180 > vp.clon || lon+180 < vp.clon) &&
-       (lastlon+180 < vp.clon || lon+180 > vp.clon) &&
-       (lastlon-180 > vp.clon || lon-180 < vp.clon) &&
-       (lastlon-180 < vp.clon || lon-180 > vp.clon))
-#endif
-    {
-        wxPoint p[2];
-        GetCanvasPixLL( &vp, &p[0], lat[0], lon[0] );
-        GetCanvasPixLL( &vp, &p[1], lat[1], lon[1] );
+#ifdef USE_GLSL
+/* projects, hides vertices outside the window of days (by putting
+   them beyond the clip volume), and looks up the wind colour */
+static const GLchar* cyclone_vertex_shader_source =
+    "attribute vec2 aPos;\n"
+    "attribute vec2 aAttr;\n" /* day of year, wind knots */
+    "uniform mat2 uMatrix;\n"
+    "uniform vec2 uOrigin;\n"
+    "uniform vec2 uOffset;\n"
+    "uniform vec2 uDays;\n"
+    "varying float varWind;\n"
+    "void main() {\n"
+    "   float day = aAttr.x;\n"
+    "   bool inside = uDays.x <= uDays.y ? (day >= uDays.x && day <= uDays.y)\n"
+    "                                    : (day >= uDays.x || day <= uDays.y);\n"
+    "   varWind = (clamp(aAttr.y, 0.0, 200.0) / 200.0 * 255.0 + 0.5) / 256.0;\n"
+    "   if(inside)\n"
+    "       gl_Position = vec4(uMatrix * (aPos - uOrigin) + uOffset, 0.0, 1.0);\n"
+    "   else\n"
+    "       gl_Position = vec4(2.0, 2.0, 2.0, 1.0);\n"
+    "}\n";
+
+static const GLchar* cyclone_fragment_shader_source =
+    "precision mediump float;\n"
+    "uniform sampler2D uColormap;\n"
+    "varying float varWind;\n"
+    "void main() {\n"
+    "   gl_FragColor = texture2D(uColormap, vec2(varWind, 0.5));\n"
+    "}\n";
+
+/* the program and a 256 wide texture of the colormap over 0 to 200
+   knots, made on first use, 0 if the shaders failed */
+static GLuint s_CycloneProgram, s_CycloneColormap;
+static bool s_bCycloneProgramTried = false;
+
+static GLuint CycloneProgram()
+{
+    if(s_bCycloneProgramTried)
+        return s_CycloneProgram;
+    s_bCycloneProgramTried = true;
+
+    wxString error;
+    GLuint program = MercatorView::Program(cyclone_vertex_shader_source,
+                                           cyclone_fragment_shader_source, error);
+    if(!program) {
+        wxLogMessage(climatology_pi + _("cyclone shader: ") + error);
+        return 0;
+    }
 
-        wxColour c = GetGraphicColor(CYCLONE_SETTING, ss.windknots);
-                            
-        DrawLine(p[0].x, p[0].y, p[1].x, p[1].y, c, 2);
-                            
-        /* direction arrow */
-        wxPoint a((p[0].x+p[1].x)/2, (p[0].y+p[1].y)/2);
-        wxPoint d(p[0].x-p[1].x, p[0].y-p[1].y);
-                            
-        DrawLine(a.x, a.y, a.x + (d.x+d.y)/5, a.y + (d.y-d.x)/5, c, 2);
-        DrawLine(a.x, a.y, a.x + (d.x-d.y)/5, a.y + (d.x+d.y)/5, c, 2);
+    unsigned char colors[256][4];
+    for(int i=0; i<256; i++) {
+        wxColour c = ClimatologyOverlayFactory::GetColorMapColor(CYCLONE_COLORMAP, i*200.0/255);
+        colors[i][0] = c.Red(), colors[i][1] = c.Green();
+        colors[i][2] = c.Blue(), colors[i][3] = c.Alpha();
     }
+
+    glGenTextures(1, &s_CycloneColormap);
+    glBindTexture(GL_TEXTURE_2D, s_CycloneColormap);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 256, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, colors);
+
+    s_CycloneProgram = program;
+    return program;
 }
+#endif
 
-void ClimatologyOverlayFactory::RenderCyclones(PlugIn_ViewPort &vp)
+/* every line in one buffer.  With shaders it lives on the card and the
+   window of days is tested there, otherwise the lines are in order of
+   day so the window is at most two ranges of client side arrays */
+bool ClimatologyOverlayFactory::RenderCycloneLinesGL(const CycloneLines &lines,
+                                                     const MercatorView &view,
+                                                     int first, int last)
 {
-    /* no cyclones ever existed between 10 and 20 longitude
-       so use 15 east as the meridian to split the world on.. */
-//#define USE_DL
-#ifdef USE_DL
-    PlugIn_ViewPort nvp = vp;
-    double cclon = 15;
-    static const double NORM_FACTOR = 16;
+    const std::vector<CycloneVertex> &vertices = lines.Vertices();
 
-    if(!m_cyclonesDisplayList)
-        m_cyclonesDisplayList = glGenLists(1);
+#ifdef USE_GLSL
+    GLuint program = CycloneProgram();
+    if(!program)
+        return false;
 
-    if(!m_pdc) {
-        glPushMatrix();
+    if(m_bCycloneLinesChanged) {
+        if(!m_CycloneBuffer)
+            glGenBuffers(1, &m_CycloneBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, m_CycloneBuffer);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size()*sizeof(CycloneVertex),
+                     vertices.empty() ? NULL : &vertices[0], GL_STATIC_DRAW);
+        m_CycloneVertices = vertices.size();
+        m_bCycloneLinesChanged = false;
+    }
 
-        wxPoint point;
-        GetCanvasPixLL(&vp, &point, 0, cclon - 180);
-        glTranslatef(point.x, point.y, 0);
-        glScalef(vp.view_scale_ppm/NORM_FACTOR, vp.view_scale_ppm/NORM_FACTOR, 1);
-        glRotated(vp.rotation*180/M_PI, 0, 0, 1);
+    if(!m_CycloneVertices)
+        return true;
+
+    glUseProgram(program);
+    glBindBuffer(GL_ARRAY_BUFFER, m_CycloneBuffer);
+
+    GLint posAttrib = glGetAttribLocation(program, "aPos");
+    GLint attrAttrib = glGetAttribLocation(program, "aAttr");
+    glVertexAttribPointer(posAttrib, 2, GL_FLOAT, GL_FALSE, sizeof(CycloneVertex), (GLvoid*)0);
+    glEnableVertexAttribArray(posAttrib);
+    glVertexAttribPointer(attrAttrib, 2, GL_FLOAT, GL_FALSE, sizeof(CycloneVertex),
+                          (GLvoid*)(2*sizeof(float)));
+    glEnableVertexAttribArray(attrAttrib);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, s_CycloneColormap);
+    glUniform1i(glGetUniformLocation(program, "uColormap"), 0);
+    glUniform2f(glGetUniformLocation(program, "uDays"), first, last);
+
+    glLineWidth(2);
+    for(int turns = view.m_turns_min; turns <= view.m_turns_max; turns++) {
+        view.Uniforms(program, turns);
+        glDrawArrays(GL_LINES, 0, m_CycloneVertices);
     }
-    
-    if(!m_bUpdateCyclones)
-        glCallList(m_cyclonesDisplayList);
-    else {
-        if(!m_pdc) {
-            m_bUpdateCyclones = false;
-        
-            nvp.clat = 0;
-            nvp.clon = cclon - 180;
-            nvp.view_scale_ppm = NORM_FACTOR;
-            nvp.rotation = nvp.skew = 0;
-    
-            if(!m_cyclonesDisplayList)
-                m_cyclonesDisplayList = glGenLists(1);
-            glNewList(m_cyclonesDisplayList, GL_COMPILE_AND_EXECUTE);
+
+    glDisableVertexAttribArray(posAttrib);
+    glDisableVertexAttribArray(attrAttrib);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+#else
+    if(m_bCycloneLinesChanged) {
+        m_CycloneLineColors.resize(4*vertices.size());
+        for(unsigned int i=0; i<vertices.size(); i++) {
+            wxColour c = GetColorMapColor(CYCLONE_COLORMAP, vertices[i].windknots);
+            m_CycloneLineColors[4*i+0] = c.Red();
+            m_CycloneLineColors[4*i+1] = c.Green();
+            m_CycloneLineColors[4*i+2] = c.Blue();
+            m_CycloneLineColors[4*i+3] = c.Alpha();
         }
-#endif
+        m_bCycloneLinesChanged = false;
+    }
 
-    int dayspan = m_dlg.m_cfgdlg->m_sCycloneDaySpan->GetValue();
+    if(vertices.empty())
+        return true;
 
-    int month_start, month_end;
-    if(m_dlg.m_cbAll->GetValue()) {
-        month_start = 0;
-        month_end = 11;
+    int ranges[2][2], count = 1;
+    if(first <= last) {
+        ranges[0][0] = lines.DayStart(first), ranges[0][1] = lines.DayStart(last+1);
     } else {
-        wxDateTime dt2(m_CurrentTimeline.GetDay(), m_CurrentTimeline.GetMonth(), 1999);
-        wxTimeSpan ts_dayspan = wxTimeSpan::Days(dayspan/2);
-        month_start = (dt2 - ts_dayspan).GetMonth();
-        month_end = (dt2 + ts_dayspan).GetMonth();
+        ranges[0][0] = lines.DayStart(first), ranges[0][1] = lines.DayStart(365);
+        ranges[1][0] = 0, ranges[1][1] = lines.DayStart(last+1);
+        count = 2;
     }
 
-    m_cyclone_drawn_counter++;
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glVertexPointer(2, GL_FLOAT, sizeof(CycloneVertex), &vertices[0].x);
+    glColorPointer(4, GL_UNSIGNED_BYTE, 0, &m_CycloneLineColors[0]);
+
+    glLineWidth(2);
+    for(int turns = view.m_turns_min; turns <= view.m_turns_max; turns++) {
+        view.PushMatrix(turns);
+        for(int i=0; i<count; i++)
+            if(ranges[i][1] > ranges[i][0])
+                glDrawArrays(GL_LINES, ranges[i][0], ranges[i][1] - ranges[i][0]);
+        glPopMatrix();
+    }
 
-    wxDateTime start = wxDateTime::Now();
-    for(int lati = floor(vp.lat_min); lati <= ceil(vp.lat_max); lati++)
-        for(int loni = floor(vp.lon_min); loni <= ceil(vp.lon_max); loni++) {
-            int monthi = month_start;
-            for(;;) {
-                int lonin = loni < 15 ? loni : loni - 360;
-                int hash = (lonin * 180 + lati)*12 + monthi;
-
-                std::list<CycloneState*> &states = m_cyclone_cache[hash];
-                for(std::list<CycloneState*>::iterator it = states.begin();
-                    it != states.end(); it++)
-                    RenderCycloneSegment(**it, vp, dayspan);
-
-                if(monthi == month_end)
-                    break;
-                if(++monthi == 12) monthi = 0;
-            }
-        }
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glDisableClientState(GL_COLOR_ARRAY);
+#endif
+    return true;
+}
+
+void ClimatologyOverlayFactory::RenderCyclones(PlugIn_ViewPort &vp)
+{
+    int dayspan = m_dlg.m_cfgdlg->m_sCycloneDaySpan->GetValue();
+
+    int first = 0, last = 364;
+    if(!m_dlg.m_cbAll->GetValue())
+        CycloneIndex::DayWindow(CycloneIndex::DayOfYear(m_CurrentTimeline.GetMonth(),
+                                                        m_CurrentTimeline.GetDay()),
+                                dayspan/2, first, last);
 
+    MercatorView view(vp, CycloneLines::MERIDIAN/360);
+    wxDateTime start = wxDateTime::Now();
+    {
+        CycloneCache::Reader cache(m_CycloneCache);
+        if(m_dc->GetDC() || !view.m_bMercator ||
+           !RenderCycloneLinesGL(cache->lines, view, first, last))
+            RenderCyclonePolylines(cache->lines, view, first, last);
+    }
     wxDateTime end = wxDateTime::Now();
 
-    /* rendering is taking too long, and display lists not used */
+    /* rendering is taking too long */
     if(m_dc->GetDC() && (end - start).GetMilliseconds() >= 1200) {
         m_dlg.m_cbCyclones->SetValue(false);
         wxMessageDialog mdlg(&m_dlg, _("Computer too slow to render cyclones, disabling theater"),
                              _("Climatology"), wxOK | wxICON_WARNING);
         mdlg.ShowModal();
     }
-
-#ifdef USE_DL
-    if(!m_pdc)
-        glEndList();
-
-    if(!m_pdc) {
-        //  Does current vp cross cclon ?
-        // if so, call the display list again translated
-        // to the other side of it..
-
-        if( vp.lon_min < cclon && vp.lon_max > cclon ) {
-            double ts = 40058986*NORM_FACTOR; /* 360 degrees in normalized viewport */
-
-            glPushMatrix();
-            if( vp.clon > cclon )
-                glTranslated(-ts, 0, 0);
-            else
-                glTranslated(ts, 0, 0);
-            glCallList(m_cyclonesDisplayList);
-            glPopMatrix();
-        }
-        glPopMatrix();
-    }
-#endif
 }
 
 static void QueryGL()
@@ -2714,10 +4207,50 @@ static void QueryGL()
 #endif
 }
 
+bool ClimatologyOverlayFactory::SetExpression(const wxString &text, wxString &error)
+{
+    if(!m_DerivedFields->SetExpression(text, error))
+        return false;
+    /* stop contouring the old expression now, the maps are retired at
+       the next render */
+    std::list<ClimatologyIsoBarMap*> &maps =
+        m_Settings.Settings[ClimatologyOverlaySettings::EXPRESSION].m_IsoBarMaps;
+    for(std::list<ClimatologyIsoBarMap*>::iterator it = maps.begin(); it != maps.end(); it++)
+        (*it)->Cancel();
+    m_bExpressionChanged = true;
+    return true;
+}
+
+/* the data behind setting changed, drop its textures and isobars */
+void ClimatologyOverlayFactory::ClearSettingOverlays(int setting)
+{
+    ClimatologyOverlaySettings::OverlayDataSettings &odc = m_Settings.Settings[setting];
+    for(int m=0; m<13; m++) {
+        m_pOverlay[m][setting].Clear();
+        odc.m_IsoBarGrids[m].clear();
+    }
+    for(std::list<ClimatologyIsoBarMap*>::iterator it = odc.m_IsoBarMaps.begin();
+        it != odc.m_IsoBarMaps.end(); it++)
+        RetireIsoBarMap(*it);
+    odc.m_IsoBarMaps.clear();
+}
+
 bool ClimatologyOverlayFactory::RenderOverlay( piDC &dc, PlugIn_ViewPort &vp )
 {
     m_dc = &dc;
 
+    FreeRetiredIsoBarMaps(false);
+
+    /* textures can only be freed while rendering */
+    if(m_bExpressionChanged) {
+        ClearSettingOverlays(ClimatologyOverlaySettings::EXPRESSION);
+        m_bExpressionChanged = false;
+    }
+    if(m_bCycloneDensityChanged) {
+        ClearSettingOverlays(ClimatologyOverlaySettings::CYCLONE_DENSITY);
+        m_bCycloneDensityChanged = false;
+    }
+
     if(!dc.GetDC()) {
         if(!glQueried) {
             QueryGL();
@@ -28,11 +28,18 @@
 #include <map>
 
 #include "zuFile.h"
+#include "CycloneCache.h"
+#include "CycloneTracks.h"
 
 #include "IsoBarMap.h"
 #include "plugingl/pidc.h"
 
 class PlugIn_ViewPort;
+class MercatorView;
+class WindAtlasSampler;
+class PassageSimulator;
+class DerivedFields;
+
 enum Coord {U, V, MAG, DIRECTION};
 
 struct WindData
@@ -43,6 +50,8 @@ struct WindData
         ~WindPolar() { /*delete [] directions; delete [] speeds;*/ }
         wxUint8 gale, calm, directions[8] /*{}*/, speeds[8] /*{}*/;
         double Value(enum Coord coord, int dir_cnt);
+        /* all four coords from one pass over the directions */
+        void Values(int dir_cnt, double values[4]);
     };
 
     WindData(int lats, int lons, int dirs, float dir_res, float spd_mul)
@@ -52,6 +61,9 @@ struct WindData
     ~WindData() { delete [] data; }
 
     double InterpWind(enum Coord coord, double lat, double lon);
+    double InterpWindGradient(enum Coord coord, double lat, double lon,
+                              double &dlat, double &dlon);
+    void InterpWindVector(double lat, double lon, double values[4]);
     WindPolar *GetPolar(double lat, double lon) {
         double latoff = 90.0/latitudes, lonoff = 180.0/longitudes;
 
@@ -79,54 +91,39 @@ struct CurrentData
         { data[0] = new float[lats*lons], data[1] = new float[lats*lons]; }
     double Value(enum Coord coord, int xi, int yi);
     double InterpCurrent(enum Coord coord, double lat, double lon);
+    void InterpCurrentVector(double lat, double lon, double values[4]);
+    double InterpCurrentGradient(enum Coord coord, double lat, double lon,
+                                 double &dlat, double &dlon);
 
     int latitudes, longitudes, multiplier;
     float *data[2];
 };
 
-struct ElNinoYear
+/* layout of the wxInt16 scalar grids: row = (90-lat)/scale - xoff,
+   column = (lon-lonoff)/scale, value = raw*mul + add */
+struct ScalarGrid
 {
-    double months[12];
+    int rows, cols;
+    double scale, xoff, lonoff, mul, add;
 };
 
-/* because wxDateTime is too slow */
-class CycloneDateTime
+struct ElNinoYear
 {
-public:
-    CycloneDateTime() {}
-    CycloneDateTime(int day1, int month1, int year1, int hour1)
-        : hour(hour1), day(day1), month(month1), year(year1) {}
-    int hour, day, month, year;
-
-    wxDateTime DateTime() { return wxDateTime(day, (wxDateTime::Month)month, year, hour); }
+    double months[12];
 };
 
-class CycloneState
+/* the cyclone config settings as tested against the track columns */
+struct CycloneFilter
 {
-public:
-    enum State {TROPICAL, SUBTROPICAL, EXTRATROPICAL, WAVE, REMANENT, UNKNOWN};
-    CycloneState(State s, CycloneDateTime dt,
-                 double lat0, double lon0, double lat1, double lon1,
-                 double wk, double press)
-        : state(s), datetime(dt),
-        windknots(wk), pressure(press), drawn_counter(0)
-    {
-        lat[0] = lat0, lat[1] = lat1;
-        lon[0] = lon0, lon[1] = lon1;
+    int minwindknots, maxpressure;
+    int start, end; /* hours, inclusive */
+    int statemask, ensomask;
+
+    bool operator==(const CycloneFilter &f) const {
+        return minwindknots == f.minwindknots && maxpressure == f.maxpressure &&
+            start == f.start && end == f.end &&
+            statemask == f.statemask && ensomask == f.ensomask;
     }
-
-    State state;
-    CycloneDateTime datetime;
-    double lat[2], lon[2], windknots, pressure;
-
-    // avoid drawing the same segment twice as it may appear multiple times
-    // in the hash table
-    long drawn_counter;
-};
-
-struct Cyclone
-{
-    std::list<CycloneState*> states;
 };
 
 //----------------------------------------------------------------------------------------------------------
@@ -144,6 +141,9 @@ public:
 
     ~ClimatologyOverlay( void );
 
+    /* drop the texture or bitmap so it is rebuilt */
+    void Clear();
+
     unsigned int m_iTexture; /* opengl mode */
 
     wxBitmap *m_pDCBitmap; /* dc mode */
@@ -165,27 +165,48 @@ class ClimatologyIsoBarMap : public IsoBarMap
 {
 public:
  ClimatologyIsoBarMap(wxString name, double spacing, double step,
+                      std::shared_ptr<IsoBarGrid> grid, std::shared_ptr<IsoBarGrid> ngrid,
                       ClimatologyOverlayFactory &factory, int setting, int units,
-                      int month, int day)
-     : IsoBarMap(name, spacing, step),
-        m_factory(factory), m_setting(setting), m_units(units), m_month(month), m_day(day) {}
-
-    double CalcParameter(double lat, double lon);
-    bool SameSettings(double spacing, double step, int units, int month, int day)
+                      double calibration_factor, double calibration_offset,
+                      int month, int nmonth, double dpos)
+     : IsoBarMap(name, spacing, step, grid, ngrid, dpos),
+        m_factory(factory), m_setting(setting), m_units(units),
+        m_CalibrationFactor(calibration_factor), m_CalibrationOffset(calibration_offset),
+        m_month(month), m_nmonth(nmonth), m_dpos(dpos) {}
+    /* stop the thread calling CalcParameter while this is still whole */
+    ~ClimatologyIsoBarMap() { Stop(); }
+
+    /* source 0 is month and 1 is nmonth */
+    double CalcParameter(int source, double lat, double lon);
+    bool CalcGrid(int source, double lat0, double lon0, double step,
+                  int rows, int cols, float *values);
+    bool GridExact(int source, double lat0, double lon0, double step);
+    /* as ClimatologyOverlaySettings::CalibrateValue for the units this
+       map was made for */
+    double Calibrate(double value)
+    {
+        return m_CalibrationFactor*(value + m_CalibrationOffset);
+    }
+    bool SameSettings(double spacing, double step, int units,
+                      int month, int nmonth, double dpos)
     {
         return spacing == m_Spacing && step == m_Step && units == m_units
-            && month == m_month && day == m_day;
+            && month == m_month && nmonth == m_nmonth && dpos == m_dpos;
     }
 
 private:
     
     ClimatologyOverlayFactory &m_factory;
-    int m_setting, m_units, m_month, m_day;
+    int m_setting, m_units;
+    double m_CalibrationFactor, m_CalibrationOffset;
+    int m_month, m_nmonth;
+    double m_dpos;
 };
 
-enum {WIND_SETTING, CURRENT_SETTING, PRESSURE_SETTING, SEATEMP_SETTING,
-      AIRTEMP_SETTING, CLOUD_SETTING, PRECIPITATION_SETTING, RELHUMIDIY_SETTING,
-      LIGHTNING_SETTING, SEADEPTH_SETTING, CYCLONE_SETTING};
+enum {WIND_COLORMAP, CURRENT_COLORMAP, PRESSURE_COLORMAP, SEATEMP_COLORMAP,
+      AIRTEMP_COLORMAP, CLOUD_COLORMAP, PRECIPITATION_COLORMAP, RELHUMIDITY_COLORMAP,
+      LIGHTNING_COLORMAP, SEADEPTH_COLORMAP, CYCLONE_COLORMAP, STABILITY_COLORMAP,
+      EXPRESSION_COLORMAP, DENSITY_COLORMAP};
 
 class ClimatologyOverlayFactory {
 public:
@@ -205,6 +226,56 @@ public:
                               double *directions, double *speeds,
                               double &gale, double &calm);
 
+    /* count random draws from the wind atlas distribution, reproducible for a seed */
+    int SampleWindAtlas(wxDateTime &date, double lat, double lon, int count,
+                        wxUint64 seed, double *directions, double *speeds);
+
+    PassageSimulator &GetPassageSimulator() { return *m_PassageSimulator; }
+    DerivedFields &GetDerivedFields() { return *m_DerivedFields; }
+
+    /* compile a new user expression, its overlay is rebuilt on the next render */
+    bool SetExpression(const wxString &text, wxString &error);
+
+    /* fill buffer[row*cols + col] with the value at lat0 + row*dlat,
+       lon0 + col*dlon, returning the number of valid values or -1 */
+    int getRaster(enum Coord coord, int setting, wxDateTime *date,
+                  double lat0, double lon0, double dlat, double dlon,
+                  int rows, int cols, float *buffer);
+    /* the same for a single month, without counting */
+    void getRasterMonth(enum Coord coord, int setting, int month,
+                        double lat0, double lon0, double dlat, double dlon,
+                        int rows, int cols, float *buffer);
+    /* whether getRasterMonth of the magnitude at lat0 + row*step,
+       lon0 + col*step samples every node of the data, so it is bilinear
+       between the samples */
+    bool RasterExact(int setting, int month, double lat0, double lon0, double step);
+
+    /* the 12 monthly values, or a 365 day series blended between
+       months, at one location with the grid lookup shared by all months */
+    bool getMonthlyValues(enum Coord coord, int setting, double lat, double lon, double values[12],
+                          int monthmask = 0xfff);
+    bool getDailyValues(enum Coord coord, int setting, double lat, double lon, double values[365]);
+    /* the same for count settings at once, values[i*12 + month] or
+       values[i*365 + day] for settings[i], returning how many had values */
+    int getMonthlyValues(enum Coord coord, int count, const int *settings,
+                         double lat, double lon, double *values);
+    int getDailyValues(enum Coord coord, int count, const int *settings,
+                       double lat, double lon, double *values);
+
+    /* mean over days [day, day+days) of a non leap year (day 0 is
+       January 1st), wrapping the end of the year */
+    double getWindowAverage(enum Coord coord, int setting, double lat, double lon,
+                            int day, int days);
+    /* mean over the days less than dayrange/2 from date, rounding
+       dayrange/2 down: the 2*(dayrange/2) - 1 days within
+       dayrange/2 - 1 of date, so both 30 and 31 give date +-14 days and
+       +-15 days takes 32.  Never less than the day itself */
+    double getWindowAverage(enum Coord coord, int setting, double lat, double lon,
+                            const wxDateTime &date, int dayrange);
+
+    static const ScalarGrid *GetScalarGrid(int setting);
+    wxInt16 *GetScalarData(int setting, int month);
+
     double GetMin(int setting);
     double GetMax(int setting);
 
@@ -212,20 +283,47 @@ public:
     double getValue(enum Coord coord, int setting, double lat, double lon, wxDateTime *date);
     double getCurValue(enum Coord coord, int setting, double lat, double lon)
     { return getValue(coord, setting, lat, lon, 0); }
+    /* values indexed by Coord, filled from a single lookup per month */
+    bool getVectorMonth(int setting, double lat, double lon, int month, double values[4]);
+    bool getVector(int setting, double lat, double lon, wxDateTime *date, double values[4]);
+    /* value with its derivatives per degree of latitude and longitude */
+    double getValueGradientMonth(enum Coord coord, int setting, double lat, double lon, int month,
+                                 double &dlat, double &dlon);
+    double getValueGradient(enum Coord coord, int setting, double lat, double lon, wxDateTime *date,
+                            double &dlat, double &dlon);
+    int getValueGradients(enum Coord coord, int setting, int count,
+                          const double *lat, const double *lon, wxDateTime *date,
+                          double *value, double *dlat, double *dlon);
     double getCurCalibratedValue(enum Coord coord, int setting, double lat, double lon);
     double getCalibratedValueMonth(enum Coord coord, int setting, double lat, double lon, int month);
 
     int CycloneTrackCrossings(
         double lat1, double lon1, double lat2, double lon2,
         const wxDateTime &date, int dayrange);
-
-    wxSemaphore m_cyclone_cache_semaphore;
-    std::map<int, std::list<CycloneState*> > m_cyclone_cache;
+    /* crossings per leg rather than a flag, returns the legs crossed */
+    int CycloneTrackCrossingsBatch(int count,
+                                   const double *lat1, const double *lon1,
+                                   const double *lat2, const double *lon2,
+                                   const wxDateTime *dates, int dayrange, int *crossings);
+    /* historical tracks near a point less than dayrange/2 days from date,
+       -1 before the cache is built */
+    int CycloneNearest(double lat, double lon, const wxDateTime &date, int dayrange,
+                       int count, double maxdistance, CycloneApproach *approaches);
+    int CycloneWithin(double lat, double lon, const wxDateTime &date, int dayrange,
+                      double radius, std::vector<CycloneApproach> &approaches);
+    /* values indexed by CycloneDensity::Kind, false before the cache is built */
+    bool CycloneDensityValues(double lat, double lon, wxDateTime *date,
+                              double values[CycloneDensity::KINDS]);
+
+    CycloneCache m_CycloneCache;
 
     void BuildCycloneCache();
     bool RenderOverlay( piDC &dc, PlugIn_ViewPort &vp );
 
-    static wxColour GetGraphicColor(int setting, double val_in);
+    static int SettingColorMap(int setting);
+    static wxColour GetColorMapColor(int colormap, double val_in);
+    static wxColour GetGraphicColor(int setting, double val_in)
+    { return GetColorMapColor(SettingColorMap(setting), val_in); }
 
     wxDateTime m_CurrentTimeline;
     bool m_bAllTimes;
@@ -251,8 +349,11 @@ private:
     void ReadRelativeHumidityData(wxString filename);
     void ReadLightningData(wxString filename);
     void ReadSeaDepthData(wxString filename);
-    bool ReadCycloneData(wxString filename, std::list<Cyclone*> &cyclones, bool south=false);
+    void FillCoastalGaps(int cells);
+    bool ReadCycloneData(wxString filename, CycloneTheatre &theatre, bool south=false);
     bool ReadElNinoYears(wxString filename);
+    void ClassifyCycloneEnso();
+    void ClearSettingOverlays(int setting);
 
     void DrawLine( double x1, double y1, double x2, double y2,
                    const wxColour &color, double width );
@@ -260,15 +361,38 @@ private:
 
     ZUFILE *TryOpenFile(wxString filename);
 
+    struct PointStencil;
+    static void MakeStencil(double xi, double yi, int rows, int cols, bool clamp_last_row,
+                            PointStencil &stencil);
+    bool GetPointStencil(int setting, int month, double lat, double lon, PointStencil &stencil);
+    double StencilValue(enum Coord coord, int setting, int month, const PointStencil &stencil);
+
+    struct RasterGrid;
+    bool GetRasterGrid(int setting, int month, RasterGrid &grid);
+    void DecodeRasterRows(enum Coord coord, int setting, int month, const RasterGrid &grid,
+                          int row0, int row1, float *plane);
+    void SampleRaster(enum Coord coord, int setting, int month,
+                      double lat0, double lon0, double dlat, double dlon,
+                      int rows, int cols, float *buffer);
+
     void RenderNumber(wxPoint p, double v, const wxColour &color);
 
+    ClimatologyIsoBarMap *IsoBarMapFor(int setting, double spacing, double step,
+                                       int month, int nmonth, double dpos);
+    void RetireIsoBarMap(ClimatologyIsoBarMap *map);
+    void FreeRetiredIsoBarMaps(bool wait);
+    void IsoBarDayInterpolation(int setting, const wxDateTime *date,
+                                int &month, int &nmonth, double &dpos);
     void RenderIsoBars(int setting, PlugIn_ViewPort &vp);
     void RenderNumbers(int setting, PlugIn_ViewPort &vp);
     void RenderDirectionArrows(int setting, PlugIn_ViewPort &vp);
 
     void RenderWindAtlas(PlugIn_ViewPort &vp);
-    void RenderCycloneSegment(CycloneState &ss, PlugIn_ViewPort &vp, int dayspan);
     void RenderCyclones(PlugIn_ViewPort &vp);
+    void RenderCyclonePolylines(const CycloneLines &lines, const MercatorView &view,
+                                int first, int last);
+    bool RenderCycloneLinesGL(const CycloneLines &lines, const MercatorView &view,
+                              int first, int last);
 
     bool CreateGLTexture(ClimatologyOverlay &O, int setting, int month, PlugIn_ViewPort &vp);
     void DrawGLTexture( ClimatologyOverlay &O1, ClimatologyOverlay &O2,
@@ -288,6 +412,14 @@ private:
 
     WindData *m_WindData[13];
     CurrentData *m_CurrentData[13];
+    WindAtlasSampler *m_WindAtlasSampler;
+    PassageSimulator *m_PassageSimulator;
+    DerivedFields *m_DerivedFields;
+    bool m_bExpressionChanged, m_bCycloneDensityChanged;
+
+    /* cancelled isobar maps whose threads may still be returning, only
+       deleted once they have so rendering never waits on them */
+    std::list<ClimatologyIsoBarMap*> m_RetiredIsoBarMaps;
 
     /* 12 months + year total and average */
     wxInt16 m_slp[13][90][180];     /* 2 degree intervals   */
@@ -299,10 +431,16 @@ private:
     wxInt16 m_lightn[13][180][360]; /* 1 degree intervals */
     wxInt16 m_seadepth[180][360];   /* 1 degree intervals   */
 
-    int m_cyclonesDisplayList;
-    long m_cyclone_drawn_counter;
+    /* the cyclone lines as last sent to opengl */
+    bool m_bCycloneLinesChanged;
+    unsigned int m_CycloneBuffer;
+    int m_CycloneVertices;
+    std::vector<wxUint8> m_CycloneLineColors;
 
-    std::list<Cyclone*> m_wpa, m_epa, m_spa, m_atl, m_she, m_nio;
+    CycloneTracks m_CycloneTracks;
+    /* the filter the index was last built with */
+    CycloneFilter m_CycloneFilter;
+    bool m_bCycloneFilterValid;
 
     std::map<int, ElNinoYear> m_ElNinoYears;
 
@@ -0,0 +1,91 @@
+/******************************************************************************
+ *
+ * Project:  OpenCPN
+ * Purpose:  Climatology Plugin
+ * Author:   Sean D'Epagnier
+ *
+ ***************************************************************************
+ *   Copyright (C) 2018 by Sean D'Epagnier                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,  USA.         *
+ ***************************************************************************
+ */
+
+#include <functional>
+#include <thread>
+
+#include "CycloneCache.h"
+
+CycloneCache::CycloneCache()
+    : m_Epoch(1), m_Front(0)
+{
+    for(int i=0; i<SLOTS; i++)
+        m_Slots[i].epoch.store(0);
+}
+
+/* claim a free slot for the current epoch, starting from one picked by
+   thread so threads rarely try the same slots */
+int CycloneCache::Enter()
+{
+    int start = std::hash<std::thread::id>()(std::this_thread::get_id()) % SLOTS;
+    for(;;) {
+        for(int i=0; i<SLOTS; i++) {
+            int slot = (start + i) % SLOTS;
+            unsigned long expected = 0;
+            if(m_Slots[slot].epoch.load(std::memory_order_relaxed) == 0 &&
+               m_Slots[slot].epoch.compare_exchange_strong(expected, m_Epoch.load()))
+                return slot;
+        }
+        /* more readers than slots */
+        std::this_thread::yield();
+    }
+}
+
+CycloneCache::Reader::Reader(CycloneCache &cache)
+    : m_cache(cache), m_slot(cache.Enter()),
+      m_data(&cache.m_Buffers[cache.m_Front.load()])
+{
+}
+
+CycloneCache::Reader::~Reader()
+{
+    m_cache.Leave(m_slot);
+}
+
+void CycloneCache::Publish()
+{
+    std::lock_guard<std::mutex> lock(m_PublishMutex);
+
+    m_Front.store(1 - m_Front.load());
+    unsigned long epoch = m_Epoch.fetch_add(1) + 1;
+
+    /* a reader entering from here on sees the new front, so only wait
+       for those that entered before */
+    for(int i=0; i<SLOTS; i++)
+        for(;;) {
+            unsigned long e = m_Slots[i].epoch.load();
+            if(e == 0 || e >= epoch)
+                break;
+            std::this_thread::yield();
+        }
+}
+
+void CycloneCache::Clear()
+{
+    Back().Clear();
+    Publish();
+    Back().Clear();
+}
@@ -0,0 +1,104 @@
+/******************************************************************************
+ *
+ * Project:  OpenCPN
+ * Purpose:  Climatology Plugin
+ * Author:   Sean D'Epagnier
+ *
+ ***************************************************************************
+ *   Copyright (C) 2018 by Sean D'Epagnier                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,  USA.         *
+ ***************************************************************************
+ */
+
+
+#ifndef _CYCLONECACHE_H_
+#define _CYCLONECACHE_H_
+
+#include <atomic>
+#include <mutex>
+
+#include "CycloneIndex.h"
+#include "CycloneDensity.h"
+#include "CycloneLines.h"
+
+/* what the filtered cyclone tracks are queried and drawn through */
+struct CycloneCacheData
+{
+    void Clear() { index.Clear(); density.Clear(); lines.Clear(); }
+
+    CycloneIndex index;
+    CycloneDensity density;
+    CycloneLines lines;
+};
+
+/* two CycloneCacheData buffers, one published to readers while the
+   other is rebuilt.
+
+   Readers never wait: they note the current epoch in a free slot,
+   read the published buffer, and clear the slot when done.  Publishing
+   swaps the buffers, advances the epoch, and then waits only for
+   readers that noted an earlier epoch (and so may still be on the old
+   buffer) before handing the old buffer back for the next rebuild. */
+class CycloneCache
+{
+public:
+    CycloneCache();
+
+    /* holds the published buffer for as long as it is in scope */
+    class Reader
+    {
+    public:
+        Reader(CycloneCache &cache);
+        ~Reader();
+
+        const CycloneCacheData &operator*() const { return *m_data; }
+        const CycloneCacheData *operator->() const { return m_data; }
+
+    private:
+        CycloneCache &m_cache;
+        int m_slot;
+        const CycloneCacheData *m_data;
+    };
+
+    /* the buffer readers can't see, only for the thread that publishes */
+    CycloneCacheData &Back() { return m_Buffers[1 - m_Front.load()]; }
+    /* show readers the back buffer */
+    void Publish();
+    /* empty both buffers */
+    void Clear();
+
+private:
+    enum {SLOTS = 64};
+
+    /* each slot on its own cache line so readers don't contend */
+    struct Slot
+    {
+        std::atomic<unsigned long> epoch; /* 0 when free */
+        char pad[64 - sizeof(std::atomic<unsigned long>)];
+    };
+
+    int Enter();
+    void Leave(int slot) { m_Slots[slot].epoch.store(0); }
+
+    Slot m_Slots[SLOTS];
+    std::atomic<unsigned long> m_Epoch;
+    std::atomic<int> m_Front;
+    CycloneCacheData m_Buffers[2];
+    std::mutex m_PublishMutex;
+};
+
+#endif
@@ -0,0 +1,143 @@
+/******************************************************************************
+ *
+ * Project:  OpenCPN
+ * Purpose:  Climatology Plugin
+ * Author:   Sean D'Epagnier
+ *
+ ***************************************************************************
+ *   Copyright (C) 2018 by Sean D'Epagnier                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,  USA.         *
+ ***************************************************************************
+ */
+
+#include <wx/wx.h>
+
+#include <math.h>
+
+#include "climatology_pi.h"
+#include "CycloneTracks.h"
+#include "CycloneDensity.h"
+#include "ThreadPool.h"
+
+CycloneDensity::CycloneDensity()
+{
+    for(int m=0; m<13; m++)
+        m_Grids[m] = NULL;
+}
+
+void CycloneDensity::Clear()
+{
+    for(int m=0; m<13; m++) {
+        delete [] m_Grids[m];
+        m_Grids[m] = NULL;
+    }
+}
+
+void CycloneDensity::Build(const CycloneTracks &tracks, const std::vector<wxUint8> &keep)
+{
+    Clear();
+
+    const int cells = LATITUDES*LONGITUDES;
+    for(int m=0; m<13; m++) {
+        m_Grids[m] = new float[KINDS*cells];
+        for(int i=0; i<KINDS*cells; i++)
+            m_Grids[m][i] = 0;
+    }
+
+    /* each month writes only its own grid */
+    ParallelFor(0, 13, [&](int start, int end) {
+            for(int m = start; m < end; m++)
+                BuildMonth(tracks, keep, m);
+        });
+}
+
+void CycloneDensity::BuildMonth(const CycloneTracks &tracks, const std::vector<wxUint8> &keep,
+                                int month)
+{
+    const int cells = LATITUDES*LONGITUDES;
+    float *count = m_Grids[month] + TRACKS*cells;
+    float *intensity = m_Grids[month] + INTENSITY*cells;
+    float *maxwind = m_Grids[month] + MAXWIND*cells;
+
+    /* segments of a track are consecutive, so remembering the last
+       track seen in each cell is enough to count each track once */
+    std::vector<int> lasttrack(cells, -1);
+    std::vector<float> peak(cells);
+
+    const double radius = RADIUS/60.0; /* degrees of latitude */
+    for(int i=0; i<tracks.Segments(); i++) {
+        if(!keep[i] || (month < 12 && tracks.month[i] != month))
+            continue;
+
+        double lat0 = tracks.lat[0][i], lat1 = tracks.lat[1][i];
+        double lon0 = tracks.lon[0][i], lon1 = lon0 + heading_resolve(tracks.lon[1][i] - lon0);
+        float wk = tracks.windknots[i];
+        int track = tracks.track[i];
+
+        double latmin = wxMin(lat0, lat1) - radius, latmax = wxMax(lat0, lat1) + radius;
+        double coslat = cos(deg2rad(wxMin(85, wxMax(fabs(latmin), fabs(latmax)))));
+        double dlon = radius / coslat;
+
+        int r0 = wxMax(0, (int)ceil(89.5 - latmax)), r1 = wxMin(LATITUDES-1, (int)floor(89.5 - latmin));
+        int c0 = ceil(wxMin(lon0, lon1) - dlon - .5), c1 = floor(wxMax(lon0, lon1) + dlon - .5);
+        for(int r = r0; r <= r1; r++) {
+            double lat = 89.5 - r, k = cos(deg2rad(lat));
+
+            /* distance to the segment on a plane scaled at this row */
+            double ax = (lon1 - lon0)*k, ay = lat1 - lat0;
+            double len2 = ax*ax + ay*ay;
+            for(int c = c0; c <= c1; c++) {
+                double px = (c + .5 - lon0)*k, py = lat - lat0;
+                double t = len2 > 0 ? wxMax(0, wxMin(1, (px*ax + py*ay) / len2)) : 0;
+                double ex = px - t*ax, ey = py - t*ay;
+                if(ex*ex + ey*ey > radius*radius)
+                    continue;
+
+                int cell = r*LONGITUDES + (c % LONGITUDES + LONGITUDES) % LONGITUDES;
+                if(lasttrack[cell] != track) {
+                    lasttrack[cell] = track;
+                    count[cell]++;
+                    intensity[cell] += wk / 64;
+                    peak[cell] = wk;
+                } else if(wk > peak[cell]) {
+                    intensity[cell] += (wk - peak[cell]) / 64;
+                    peak[cell] = wk;
+                }
+                maxwind[cell] = wxMax(maxwind[cell], wk);
+            }
+        }
+    }
+}
+
+double CycloneDensity::Value(int kind, double lat, double lon, int month) const
+{
+    if(isnan(lat) || isnan(lon) || !m_Grids[month])
+        return NAN;
+
+    /* the first and last rows are half a degree from the poles, hold them there */
+    double xi = wxMax(0, wxMin(LATITUDES-1, 89.5 - lat));
+    double yi = positive_degrees(lon - .5);
+    int x0 = floor(xi), x1 = wxMin(x0 + 1, LATITUDES-1);
+    int y0 = (int)floor(yi) % LONGITUDES, y1 = (y0 + 1) % LONGITUDES;
+    double xd = xi - x0, yd = yi - floor(yi);
+
+    const float *grid = m_Grids[month] + kind*LATITUDES*LONGITUDES;
+    const float *p0 = grid + x0*LONGITUDES, *p1 = grid + x1*LONGITUDES;
+    double v0 = (1-yd)*p0[y0] + yd*p0[y1];
+    double v1 = (1-yd)*p1[y0] + yd*p1[y1];
+    return (1-xd)*v0 + xd*v1;
+}
@@ -0,0 +1,72 @@
+/******************************************************************************
+ *
+ * Project:  OpenCPN
+ * Purpose:  Climatology Plugin
+ * Author:   Sean D'Epagnier
+ *
+ ***************************************************************************
+ *   Copyright (C) 2018 by Sean D'Epagnier                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,  USA.         *
+ ***************************************************************************
+ */
+
+
+#ifndef _CYCLONEDENSITY_H_
+#define _CYCLONEDENSITY_H_
+
+#include <vector>
+
+#include "wx/wx.h"
+
+class CycloneTracks;
+
+/* how often cyclones pass near each point, per month on a 1 degree
+   grid.  A track counts toward every cell centre it passes within
+   RADIUS nautical miles of, once per cell however many of its segments
+   are near.
+
+   Besides the number of tracks, each cell keeps an intensity weighted
+   count, where a track counts its strongest wind near the cell over 64
+   knots (so a hurricane counts about one), and the strongest wind of
+   any of them. */
+class CycloneDensity
+{
+public:
+    enum Kind {TRACKS, INTENSITY, MAXWIND, KINDS};
+    enum {LATITUDES = 180, LONGITUDES = 360};
+    enum {RADIUS = 100};
+
+    CycloneDensity();
+    ~CycloneDensity() { Clear(); }
+
+    /* count the segments of tracks with keep set into new grids,
+       month 12 covering the whole year */
+    void Build(const CycloneTracks &tracks, const std::vector<wxUint8> &keep);
+    void Clear();
+
+    bool Empty() const { return !m_Grids[0]; }
+
+    /* bilinear between cell centres, NaN until built */
+    double Value(int kind, double lat, double lon, int month) const;
+
+private:
+    void BuildMonth(const CycloneTracks &tracks, const std::vector<wxUint8> &keep, int month);
+
+    float *m_Grids[13]; /* [KINDS][LATITUDES*LONGITUDES] */
+};
+
+#endif
@@ -0,0 +1,213 @@
+/******************************************************************************
+ *
+ * Project:  OpenCPN
+ * Purpose:  Climatology Plugin
+ * Author:   Sean D'Epagnier
+ *
+ ***************************************************************************
+ *   Copyright (C) 2018 by Sean D'Epagnier                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,  USA.         *
+ ***************************************************************************
+ */
+
+
+#include <wx/wx.h>
+
+#include <math.h>
+
+#include "climatology_pi.h"
+#include "CycloneIndex.h"
+
+void CycloneIndex::Clear()
+{
+    m_Offsets.clear();
+    m_Segments.clear();
+    m_Count = 0;
+}
+
+int CycloneIndex::DayOfYear(int month, int day)
+{
+    static const int firstday[12] = {0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334};
+    return wxMin(364, firstday[month] + day - 1);
+}
+
+void CycloneIndex::DayWindow(int day, int halfspan, int &first, int &last)
+{
+    if(halfspan >= 182) {
+        first = 0, last = 364;
+        return;
+    }
+    first = (day - halfspan + 365) % 365;
+    last = (day + halfspan) % 365;
+}
+
+/* the cells covered by a segment's bounding box, with the longitudes
+   of the second end taken the short way around from the first */
+template<typename F>
+static void SegmentCells(const CycloneSegment &s, F fn)
+{
+    double lon0 = s.lon[0], lon1 = lon0 + heading_resolve(s.lon[1] - s.lon[0]);
+    int lat_min = floor(wxMin(s.lat[0], s.lat[1])), lat_max = floor(wxMax(s.lat[0], s.lat[1]));
+    int lon_min = floor(wxMin(lon0, lon1)), lon_max = floor(wxMax(lon0, lon1));
+    for(int lati = lat_min; lati <= lat_max; lati++)
+        for(int loni = lon_min; loni <= lon_max; loni++)
+            fn(CycloneIndex::Cell(lati, loni));
+}
+
+static bool DayOrder(const CycloneSegment &a, const CycloneSegment &b)
+{
+    return a.day < b.day;
+}
+
+void CycloneIndex::Build(const std::vector<CycloneSegment> &segments)
+{
+    Clear();
+    if(segments.empty())
+        return;
+
+    /* count, prefix sum, then scatter */
+    const int cells = LATITUDES*LONGITUDES;
+    m_Offsets.assign(cells + 1, 0);
+    for(unsigned int i=0; i<segments.size(); i++)
+        SegmentCells(segments[i], [this](int cell) { m_Offsets[cell+1]++; });
+
+    for(int cell = 0; cell < cells; cell++)
+        m_Offsets[cell+1] += m_Offsets[cell];
+
+    m_Segments.resize(m_Offsets[cells]);
+    std::vector<unsigned int> fill(m_Offsets.begin(), m_Offsets.end() - 1);
+    for(unsigned int i=0; i<segments.size(); i++)
+        SegmentCells(segments[i], [&](int cell) { m_Segments[fill[cell]++] = segments[i]; });
+
+    for(int cell = 0; cell < cells; cell++)
+        std::stable_sort(m_Segments.begin() + m_Offsets[cell],
+                         m_Segments.begin() + m_Offsets[cell+1], DayOrder);
+
+    m_Count = segments.size();
+}
+
+/* the closest point of each segment in the cell to lat, lon, on a
+   plane scaled to nautical miles at lat, kept per track */
+void CycloneIndex::ApproachCell(double lat, double lon, int lati, int loni, int first, int last,
+                                Approaches &approaches) const
+{
+    double k = cos(deg2rad(wxMin(85, fabs(lat))));
+    Query(lati, loni, first, last, [&](const CycloneSegment &s) {
+            double lon0 = lon + heading_resolve(s.lon[0] - lon);
+            double lon1 = lon0 + heading_resolve(s.lon[1] - s.lon[0]);
+            double ax = (lon1 - lon0)*k, ay = s.lat[1] - s.lat[0];
+            double px = (lon - lon0)*k, py = lat - s.lat[0];
+            double len2 = ax*ax + ay*ay;
+            double t = len2 > 0 ? wxMax(0, wxMin(1, (px*ax + py*ay) / len2)) : 0;
+            double distance = 60*hypot(px - t*ax, py - t*ay);
+
+            Approaches::iterator it = approaches.find(s.track);
+            if(it != approaches.end() && it->second.distance <= distance)
+                return;
+
+            CycloneApproach &a = approaches[s.track];
+            a.track = s.track;
+            a.distance = distance;
+            a.lat = s.lat[0] + t*(s.lat[1] - s.lat[0]);
+            a.lon = heading_resolve(lon0 + t*(lon1 - lon0));
+            a.windknots = s.windknots;
+            a.pressure = s.pressure;
+            a.hours = s.hours;
+        });
+}
+
+static bool ApproachLess(const CycloneApproach &a, const CycloneApproach &b)
+{
+    return a.distance < b.distance;
+}
+
+void CycloneIndex::SortApproaches(const Approaches &approaches,
+                                  std::vector<CycloneApproach> &sorted)
+{
+    sorted.clear();
+    for(Approaches::const_iterator it = approaches.begin(); it != approaches.end(); it++)
+        sorted.push_back(it->second);
+    std::sort(sorted.begin(), sorted.end(), ApproachLess);
+}
+
+/* search rings of cells outward until no unsearched cell can be
+   closer than the count-th nearest track found.  A segment is listed
+   in every cell its bounding box touches, so one missing from the
+   rings searched lies wholly outside them */
+int CycloneIndex::Nearest(double lat, double lon, int first, int last, int count,
+                          double maxdistance, CycloneApproach *approaches) const
+{
+    if(count <= 0 || m_Segments.empty() || isnan(lat) || isnan(lon))
+        return 0;
+
+    int lati0 = floor(lat), loni0 = floor(lon);
+    double k = cos(deg2rad(wxMin(85, fabs(lat))));
+    Approaches found;
+    std::vector<CycloneApproach> sorted;
+    for(int d = 0; d <= LATITUDES; d++) {
+        for(int lati = lati0 - d; lati <= lati0 + d; lati++) {
+            if(lati < -90 || lati > 90)
+                continue;
+            bool edge = lati == lati0 - d || lati == lati0 + d;
+            for(int loni = loni0 - d; loni <= loni0 + d; loni += edge ? 1 : 2*d)
+                ApproachCell(lat, lon, lati, loni, first, last, found);
+        }
+
+        /* the nearest any unsearched cell can be, once the rings wrap
+           all the way around only latitude is left */
+        double bound = 60*d*(2*d + 1 >= LONGITUDES ? 1 : k);
+        if(bound > maxdistance)
+            break;
+        if((int)found.size() >= count) {
+            SortApproaches(found, sorted);
+            if(sorted[count-1].distance <= bound)
+                break;
+        }
+    }
+
+    SortApproaches(found, sorted);
+    int n = 0;
+    for(; n < count && n < (int)sorted.size() && sorted[n].distance <= maxdistance; n++)
+        approaches[n] = sorted[n];
+    return n;
+}
+
+void CycloneIndex::Within(double lat, double lon, int first, int last, double radius,
+                          std::vector<CycloneApproach> &approaches) const
+{
+    approaches.clear();
+    if(m_Segments.empty() || isnan(lat) || isnan(lon) || radius < 0)
+        return;
+
+    double dlat = radius/60;
+    double dlon = wxMin(180, dlat / cos(deg2rad(wxMin(85, fabs(lat)))));
+
+    Approaches found;
+    for(int lati = floor(lat - dlat); lati <= floor(lat + dlat); lati++) {
+        if(lati < -90 || lati > 90)
+            continue;
+        int lon_min = floor(lon - dlon), lon_max = wxMin(floor(lon + dlon), lon_min + LONGITUDES - 1);
+        for(int loni = lon_min; loni <= lon_max; loni++)
+            ApproachCell(lat, lon, lati, loni, first, last, found);
+    }
+
+    SortApproaches(found, approaches);
+    std::vector<CycloneApproach>::iterator end = approaches.begin();
+    while(end != approaches.end() && end->distance <= radius)
+        end++;
+    approaches.erase(end, approaches.end());
+}
@@ -0,0 +1,147 @@
+/******************************************************************************
+ *
+ * Project:  OpenCPN
+ * Purpose:  Climatology Plugin
+ * Author:   Sean D'Epagnier
+ *
+ ***************************************************************************
+ *   Copyright (C) 2018 by Sean D'Epagnier                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,  USA.         *
+ ***************************************************************************
+ */
+
+
+#ifndef _CYCLONEINDEX_H_
+#define _CYCLONEINDEX_H_
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include "wx/wx.h"
+
+/* one segment of a cyclone track as stored in the index */
+struct CycloneSegment
+{
+    float lat[2], lon[2];
+    float windknots, pressure;
+    wxInt16 day; /* day of the year, 0 to 364 */
+    wxUint8 state;
+    int id;      /* the same for every copy of a segment */
+    int track;   /* the same for every segment of a storm */
+    int hours;   /* start time, see CycloneTracks::Hours */
+};
+
+/* the closest a track came to a point */
+struct CycloneApproach
+{
+    int track;
+    double distance; /* nautical miles */
+    double lat, lon; /* where */
+    float windknots, pressure;
+    int hours;       /* start of the closest segment */
+};
+
+/* flat spatial index over the filtered cyclone segments.
+
+   The world is split into 1 degree cells, and each cell keeps copies of
+   the segments whose bounding box touches it in one contiguous run of
+   m_Segments, starting at m_Offsets[cell].  Within a cell the segments
+   are sorted by day of the year, so a time window is a binary search
+   rather than a test of every segment.
+
+   Longitudes are counted from 15 east, where no cyclone has ever been,
+   so tracks don't need splitting at the antimeridian. */
+class CycloneIndex
+{
+public:
+    enum {LATITUDES = 181, LONGITUDES = 360};
+
+    CycloneIndex() : m_Count(0) {}
+
+    void Clear();
+    /* segment ids must be their position in segments */
+    void Build(const std::vector<CycloneSegment> &segments);
+
+    bool Empty() const { return m_Segments.empty(); }
+    int Count() const { return m_Count; }
+
+    static int DayOfYear(int month, int day);
+
+    /* the inclusive window of days within halfspan of day, which
+       wraps around the year when first > last */
+    static void DayWindow(int day, int halfspan, int &first, int &last);
+
+    static int Cell(int lati, int loni)
+    {
+        loni = ((loni - 15) % LONGITUDES + LONGITUDES) % LONGITUDES;
+        return (wxMax(-90, wxMin(90, lati)) + 90) * LONGITUDES + loni;
+    }
+
+    /* call fn(segment) for segments in the cell with a day in [first, last] */
+    template<typename F>
+    void Query(int lati, int loni, int first, int last, F fn) const
+    {
+        if(m_Segments.empty())
+            return;
+
+        int cell = Cell(lati, loni);
+        const CycloneSegment *begin = &m_Segments[0] + m_Offsets[cell];
+        const CycloneSegment *end = &m_Segments[0] + m_Offsets[cell+1];
+        if(begin == end)
+            return;
+
+        if(first <= last)
+            QueryRange(begin, end, first, last, fn);
+        else {
+            QueryRange(begin, end, first, 364, fn);
+            QueryRange(begin, end, 0, last, fn);
+        }
+    }
+
+    /* the count tracks passing closest to lat, lon within the day
+       window and maxdistance nautical miles, nearest first, returns how
+       many were found */
+    int Nearest(double lat, double lon, int first, int last, int count, double maxdistance,
+                CycloneApproach *approaches) const;
+    /* every track passing within radius nautical miles, nearest first */
+    void Within(double lat, double lon, int first, int last, double radius,
+                std::vector<CycloneApproach> &approaches) const;
+
+private:
+    typedef std::map<int, CycloneApproach> Approaches;
+    void ApproachCell(double lat, double lon, int lati, int loni, int first, int last,
+                      Approaches &approaches) const;
+    static void SortApproaches(const Approaches &approaches, std::vector<CycloneApproach> &sorted);
+
+    static bool DayLess(const CycloneSegment &s, int day) { return s.day < day; }
+
+    template<typename F>
+    static void QueryRange(const CycloneSegment *begin, const CycloneSegment *end,
+                           int first, int last, F &fn)
+    {
+        for(const CycloneSegment *s = std::lower_bound(begin, end, first, DayLess);
+            s != end && s->day <= last; s++)
+            fn(*s);
+    }
+
+    std::vector<unsigned int> m_Offsets; /* LATITUDES*LONGITUDES + 1 */
+    std::vector<CycloneSegment> m_Segments;
+    int m_Count;
+};
+
+#endif
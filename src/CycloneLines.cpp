@@ -0,0 +1,140 @@
+/******************************************************************************
+ *
+ * Project:  OpenCPN
+ * Purpose:  Climatology Plugin
+ * Author:   Sean D'Epagnier
+ *
+ ***************************************************************************
+ *   Copyright (C) 2018 by Sean D'Epagnier                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,  USA.         *
+ ***************************************************************************
+ */
+
+#include <wx/wx.h>
+
+#include <math.h>
+
+#include "climatology_pi.h"
+#include "CycloneLines.h"
+#include "MercatorView.h"
+
+const double CycloneLines::MERIDIAN = 15;
+
+void CycloneLines::Clear()
+{
+    m_Vertices.clear();
+    m_DayStarts.clear();
+    m_Points.clear();
+    for(int m=0; m<12; m++)
+        m_Polylines[m].clear();
+}
+
+/* the track, then the arrow halves from its middle, the arrow being
+   the segment reversed, a fifth as long, and turned 45 degrees each way */
+static void SegmentVertices(const CycloneSegment &s, CycloneVertex v[CycloneLines::SEGMENT_VERTICES])
+{
+    double lon0 = CycloneLines::MERIDIAN + positive_degrees(s.lon[0] - CycloneLines::MERIDIAN);
+    double lon1 = lon0 + heading_resolve(s.lon[1] - s.lon[0]);
+
+    double x0, y0, x1, y1;
+    MercatorView::Mercator(s.lat[0], lon0, x0, y0);
+    MercatorView::Mercator(s.lat[1], lon1, x1, y1);
+
+    double mx = (x0 + x1)/2, my = (y0 + y1)/2;
+    double dx = x0 - x1, dy = y0 - y1;
+
+    double p[CycloneLines::SEGMENT_VERTICES][2] = {
+        {x0, y0}, {x1, y1},
+        {mx, my}, {mx + (dx-dy)/5, my + (dx+dy)/5},
+        {mx, my}, {mx + (dx+dy)/5, my + (dy-dx)/5}};
+
+    for(int i=0; i<CycloneLines::SEGMENT_VERTICES; i++) {
+        v[i].x = p[i][0];
+        v[i].y = p[i][1];
+        v[i].day = s.day;
+        v[i].windknots = s.windknots;
+    }
+}
+
+static int DayMonth(int day)
+{
+    int month = 0;
+    while(month < 11 && CycloneIndex::DayOfYear(month+1, 1) <= day)
+        month++;
+    return month;
+}
+
+void CycloneLines::Build(const std::vector<CycloneSegment> &segments)
+{
+    Clear();
+
+    /* counting sort by day */
+    m_DayStarts.assign(366, 0);
+    for(unsigned int i=0; i<segments.size(); i++)
+        m_DayStarts[segments[i].day+1] += SEGMENT_VERTICES;
+    for(int d=1; d<366; d++)
+        m_DayStarts[d] += m_DayStarts[d-1];
+
+    m_Vertices.resize(m_DayStarts[365]);
+    std::vector<int> next(m_DayStarts.begin(), m_DayStarts.end() - 1);
+
+    Polyline polyline;
+    polyline.count = 0;
+    CycloneVertex v[SEGMENT_VERTICES];
+    for(unsigned int i=0; i<segments.size(); i++) {
+        const CycloneSegment &s = segments[i];
+        SegmentVertices(s, v);
+
+        for(int j=0; j<SEGMENT_VERTICES; j++)
+            m_Vertices[next[s.day]++] = v[j];
+
+        /* segments of a track are consecutive */
+        bool join = false;
+        if(polyline.count) {
+            const CycloneSegment &p = segments[i-1];
+            join = p.track == s.track && p.day == s.day && p.windknots == s.windknots &&
+                p.lat[1] == s.lat[0] && p.lon[1] == s.lon[0];
+            if(!join)
+                m_Polylines[DayMonth(polyline.day)].push_back(polyline);
+        }
+
+        if(!join) {
+            polyline.start = m_Points.size();
+            polyline.count = 1;
+            polyline.day = s.day;
+            polyline.windknots = s.windknots;
+            polyline.x_min = polyline.x_max = v[0].x;
+            polyline.y_min = polyline.y_max = v[0].y;
+            m_Points.push_back(v[0]);
+        }
+
+        /* out and back along each half of the arrow, then on to the end */
+        static const int order[] = {2, 3, 2, 5, 2, 1};
+        for(int j=0; j<6; j++) {
+            const CycloneVertex &w = v[order[j]];
+            polyline.x_min = wxMin(polyline.x_min, w.x);
+            polyline.x_max = wxMax(polyline.x_max, w.x);
+            polyline.y_min = wxMin(polyline.y_min, w.y);
+            polyline.y_max = wxMax(polyline.y_max, w.y);
+            m_Points.push_back(w);
+        }
+        polyline.count += 6;
+    }
+
+    if(polyline.count)
+        m_Polylines[DayMonth(polyline.day)].push_back(polyline);
+}
@@ -0,0 +1,87 @@
+/******************************************************************************
+ *
+ * Project:  OpenCPN
+ * Purpose:  Climatology Plugin
+ * Author:   Sean D'Epagnier
+ *
+ ***************************************************************************
+ *   Copyright (C) 2018 by Sean D'Epagnier                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,  USA.         *
+ ***************************************************************************
+ */
+
+#ifndef _CYCLONELINES_H_
+#define _CYCLONELINES_H_
+
+#include <vector>
+
+#include "wx/wx.h"
+
+#include "CycloneIndex.h"
+
+/* a point in mercator coordinates (see MercatorView) */
+struct CycloneVertex
+{
+    float x, y;
+    float day, windknots;
+};
+
+/* the filtered tracks ready to draw.
+
+   For opengl every segment is three lines, the track itself and the
+   two halves of its direction arrow, stored in order of day so a
+   window of days is one or two ranges of vertices.
+
+   For a dc, segments that follow on from each other with the same day
+   and wind are joined into polylines (tracing out and back along each
+   arrow) and kept by month.
+
+   Longitudes are unwrapped east from MERIDIAN, where no cyclone has
+   ever been, so nothing crosses the edge of the data. */
+class CycloneLines
+{
+public:
+    enum {SEGMENT_VERTICES = 6};
+    static const double MERIDIAN;
+
+    struct Polyline
+    {
+        int start, count;  /* into Points() */
+        int day;
+        float windknots;
+        float x_min, x_max, y_min, y_max;
+    };
+
+    void Build(const std::vector<CycloneSegment> &segments);
+    void Clear();
+
+    const std::vector<CycloneVertex> &Vertices() const { return m_Vertices; }
+    /* first vertex of a day, day 365 being the end */
+    int DayStart(int day) const { return m_DayStarts.empty() ? 0 : m_DayStarts[day]; }
+
+    const std::vector<CycloneVertex> &Points() const { return m_Points; }
+    const std::vector<Polyline> &MonthPolylines(int month) const { return m_Polylines[month]; }
+
+private:
+    std::vector<CycloneVertex> m_Vertices;
+    std::vector<int> m_DayStarts;
+
+    std::vector<CycloneVertex> m_Points;
+    std::vector<Polyline> m_Polylines[12];
+};
+
+#endif
@@ -0,0 +1,248 @@
+/******************************************************************************
+ *
+ * Project:  OpenCPN
+ * Purpose:  Climatology Plugin
+ * Author:   Sean D'Epagnier
+ *
+ ***************************************************************************
+ *   Copyright (C) 2018 by Sean D'Epagnier                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,  USA.         *
+ ***************************************************************************
+ */
+
+#include <wx/wx.h>
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "CycloneIndex.h"
+#include "CycloneTracks.h"
+
+CycloneTracks::CycloneTracks()
+    : m_Arena(NULL)
+{
+    Clear();
+}
+
+void CycloneTracks::Clear()
+{
+    free(m_Arena);
+    m_Arena = NULL;
+    m_Segments = 0;
+
+    lat[0] = lat[1] = lon[0] = lon[1] = windknots = pressure = NULL;
+    hours = NULL;
+    day = year = NULL;
+    month = state = enso = NULL;
+    track = trackoffsets = NULL;
+    for(int i=0; i<=THEATRES; i++)
+        theatreoffsets[i] = 0;
+}
+
+/* counting days from the march before year 0 so the leap day falls at
+   the end of each year */
+int CycloneTracks::Hours(int year, int month, int day, int hour)
+{
+    int y = year - (month < 2), m = (month + 10) % 12;
+    int days = 365*y + y/4 - y/100 + y/400 + (153*m + 2)/5 + day - 1;
+    return days*24 + hour;
+}
+
+wxDateTime CycloneTracks::DateTime(int hours)
+{
+    int days = hours / 24;
+    int y = (10000LL*days + 14780) / 3652425;
+    int dd = days - (365*y + y/4 - y/100 + y/400);
+    if(dd < 0) {
+        y--;
+        dd = days - (365*y + y/4 - y/100 + y/400);
+    }
+    int m = (5*dd + 2) / 153; /* from march */
+    int day = dd - (153*m + 2)/5 + 1, month = (m + 2) % 12;
+    return wxDateTime(day, (wxDateTime::Month)month, y + (month < 2), hours % 24);
+}
+
+/* walk the theatre, filling in the columns at the running counts
+   when tracks is given */
+long CycloneTracks::Parse(const CycloneTheatre &theatre, CycloneTracks *tracks,
+                          int &trackcount, int &segmentcount)
+{
+    const wxUint8 *data = theatre.data.empty() ? NULL : &theatre.data[0];
+    long size = theatre.data.size(), pos = 0;
+    int sign = theatre.south ? -1 : 1;
+
+#define READ(var) \
+    if(pos + (long)sizeof var > size) return pos; \
+    memcpy(&var, data + pos, sizeof var); \
+    pos += sizeof var;
+
+    while(pos + 2 <= size) {
+        wxUint16 lyear;
+        READ(lyear);
+#ifdef __MSVC__
+        if(lyear < 1972)
+            lyear = 1972;
+#endif
+        if(tracks)
+            tracks->trackoffsets[trackcount] = segmentcount;
+        trackcount++;
+
+        wxUint16 llastmonth = 0;
+        wxUint8 wk = 0;
+        wxUint16 press = 0;
+        int laststate = UNKNOWN;
+        int lastday = 1, lastmonth = 0, lastyear = 1900, lasthour = 0;
+        wxInt16 lastlat=-10000, lastlon=-10000;
+        for(;;) {
+            signed char lstate;
+            READ(lstate);
+
+            if(lstate == -128)
+                break;
+
+            int cyclonestate;
+            switch(lstate) {
+            case '*': cyclonestate = TROPICAL; break;
+            case 'S': cyclonestate = SUBTROPICAL; break;
+            case 'E': cyclonestate = EXTRATROPICAL; break;
+            case 'W': cyclonestate = WAVE; break;
+            case 'L': cyclonestate = REMANENT; break;
+            case 'D': case 'X': cyclonestate = UNKNOWN; break;
+            default: return pos - 1;
+            }
+
+            char lday, lmonth;
+            READ(lday);
+            READ(lmonth);
+
+            if(lmonth < llastmonth)
+                lyear++;
+            llastmonth = lmonth;
+
+            int day = lday/4, hour = (lday%4)*6;
+            if(lmonth < 1 || lmonth > 12 ||
+               day < 1 || day > wxDateTime::GetNumberOfDays((wxDateTime::Month)(lmonth-1), lyear) ||
+               hour < 0 || hour >= 24)
+                return pos;
+
+            wxInt16 llat, llon;
+            READ(llat);
+            READ(llon);
+
+            // make sure it's in range
+            if(fabsf((double)llat/10) >= 90 || (double)llon/10 > 15 || (double)llon/10 < -360)
+                return pos;
+
+            if(lastlat != -10000) {
+                if(tracks) {
+                    int i = segmentcount;
+                    tracks->lat[0][i] = sign * (double)lastlat/10;
+                    tracks->lon[0][i] = (double)lastlon/10;
+                    tracks->lat[1][i] = sign * (double)llat/10;
+                    tracks->lon[1][i] = (double)llon/10;
+                    tracks->windknots[i] = wk;
+                    tracks->pressure[i] = press;
+                    tracks->hours[i] = Hours(lastyear, lastmonth, lastday, lasthour);
+                    tracks->day[i] = CycloneIndex::DayOfYear(lastmonth, lastday);
+                    tracks->year[i] = lastyear;
+                    tracks->month[i] = lastmonth;
+                    tracks->state[i] = laststate;
+                    tracks->enso[i] = ENSO_NOT_AVAILABLE;
+                    tracks->track[i] = trackcount - 1;
+                }
+                segmentcount++;
+            }
+
+            laststate = cyclonestate;
+            lastday = day, lastmonth = lmonth-1, lastyear = lyear, lasthour = hour;
+            lastlat = llat, lastlon = llon;
+
+            READ(wk);
+            READ(press);
+        }
+    }
+#undef READ
+
+    return -1;
+}
+
+long CycloneTracks::Scan(CycloneTheatre &theatre)
+{
+    theatre.tracks = theatre.segments = 0;
+    long corrupt = Parse(theatre, NULL, theatre.tracks, theatre.segments);
+    if(corrupt != -1) {
+        theatre.data.clear();
+        theatre.tracks = theatre.segments = 0;
+    }
+    return corrupt;
+}
+
+/* advance p past count items of T, keeping 8 byte alignment */
+template<typename T>
+static T *Carve(uintptr_t &p, int count)
+{
+    T *column = (T*)p;
+    p += (sizeof(T)*count + 7) & ~7;
+    return column;
+}
+
+bool CycloneTracks::Build(const CycloneTheatre theatres[THEATRES])
+{
+    Clear();
+
+    int trackcount = 0, segmentcount = 0;
+    for(int i=0; i<THEATRES; i++) {
+        trackcount += theatres[i].tracks;
+        segmentcount += theatres[i].segments;
+    }
+
+    /* the layout is worked out twice, first from 0 to size it */
+    for(int pass = 0; pass < 2; pass++) {
+        uintptr_t p = (uintptr_t)m_Arena;
+        for(int j=0; j<2; j++) {
+            lat[j] = Carve<float>(p, segmentcount);
+            lon[j] = Carve<float>(p, segmentcount);
+        }
+        windknots = Carve<float>(p, segmentcount);
+        pressure = Carve<float>(p, segmentcount);
+        hours = Carve<int>(p, segmentcount);
+        track = Carve<int>(p, segmentcount);
+        trackoffsets = Carve<int>(p, trackcount + 1);
+        day = Carve<wxInt16>(p, segmentcount);
+        year = Carve<wxInt16>(p, segmentcount);
+        month = Carve<wxUint8>(p, segmentcount);
+        state = Carve<wxUint8>(p, segmentcount);
+        enso = Carve<wxUint8>(p, segmentcount);
+
+        if(!pass && !(m_Arena = malloc(p))) {
+            Clear();
+            return false;
+        }
+    }
+
+    int tracks = 0, segments = 0;
+    for(int i=0; i<THEATRES; i++) {
+        theatreoffsets[i] = tracks;
+        Parse(theatres[i], this, tracks, segments);
+    }
+    theatreoffsets[THEATRES] = tracks;
+    trackoffsets[tracks] = segments;
+    m_Segments = segments;
+    return true;
+}
@@ -0,0 +1,100 @@
+/******************************************************************************
+ *
+ * Project:  OpenCPN
+ * Purpose:  Climatology Plugin
+ * Author:   Sean D'Epagnier
+ *
+ ***************************************************************************
+ *   Copyright (C) 2018 by Sean D'Epagnier                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,  USA.         *
+ ***************************************************************************
+ */
+
+
+#ifndef _CYCLONETRACKS_H_
+#define _CYCLONETRACKS_H_
+
+#include <vector>
+
+#include "wx/wx.h"
+
+/* the raw contents of one theatre file, sized up by CycloneTracks::Scan */
+struct CycloneTheatre
+{
+    CycloneTheatre() : south(false), tracks(0), segments(0) {}
+
+    std::vector<wxUint8> data;
+    bool south;
+    int tracks, segments;
+};
+
+/* every cyclone track of the six theatres as columns, one per
+   attribute of a segment (the step from one fix to the next, carrying
+   the state, time, wind and pressure of the first fix), all carved out
+   of a single allocation.
+
+   The segments of track t are [trackoffsets[t], trackoffsets[t+1]) and
+   the tracks of theatre i are [theatreoffsets[i], theatreoffsets[i+1]) */
+class CycloneTracks
+{
+public:
+    enum State {TROPICAL, SUBTROPICAL, EXTRATROPICAL, WAVE, REMANENT, UNKNOWN};
+    enum EnsoPhase {ENSO_NOT_AVAILABLE = 1, EL_NINO = 2, LA_NINA = 4, NEUTRAL = 8};
+    enum {THEATRES = 6};
+
+    CycloneTracks();
+    ~CycloneTracks() { Clear(); }
+
+    /* count the tracks and segments of a theatre read into memory,
+       returns -1, or the offset of the first corrupt byte */
+    static long Scan(CycloneTheatre &theatre);
+    /* replace the tracks with those of the scanned theatres,
+       false if there isn't the memory */
+    bool Build(const CycloneTheatre theatres[THEATRES]);
+    void Clear();
+
+    int Segments() const { return m_Segments; }
+    int Tracks() const { return theatreoffsets[THEATRES]; }
+    int TheatreTracks(int theatre) const
+    { return theatreoffsets[theatre+1] - theatreoffsets[theatre]; }
+
+    /* month from 0, hours from year 0 for comparing times */
+    static int Hours(int year, int month, int day, int hour);
+    static wxDateTime DateTime(int hours);
+
+    float *lat[2], *lon[2];
+    float *windknots, *pressure;
+    int *hours;
+    wxInt16 *day;    /* day of the year, 0 to 364 */
+    wxInt16 *year;
+    wxUint8 *month;  /* from 0 */
+    wxUint8 *state;  /* State */
+    wxUint8 *enso;   /* EnsoPhase, filled in by the owner */
+    int *track;      /* the track the segment belongs to */
+
+    int *trackoffsets;
+    int theatreoffsets[THEATRES+1];
+
+private:
+    static long Parse(const CycloneTheatre &theatre, CycloneTracks *tracks,
+                      int &trackcount, int &segmentcount);
+
+    void *m_Arena;
+    int m_Segments;
+};
+
+#endif
@@ -0,0 +1,355 @@
+/******************************************************************************
+ *
+ * Project:  OpenCPN
+ * Purpose:  Climatology Plugin
+ * Author:   Sean D'Epagnier
+ *
+ ***************************************************************************
+ *   Copyright (C) 2018 by Sean D'Epagnier                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,  USA.         *
+ ***************************************************************************
+ */
+
+
+#include <wx/wx.h>
+
+#include <math.h>
+#include <vector>
+
+#include "climatology_pi.h"
+#include "DerivedFields.h"
+#include "Expression.h"
+#include "ThreadPool.h"
+
+/* dew point by the Magnus formula */
+static void DewPointKernel(int count, const float *const *in, float *const *out)
+{
+    const float b = 17.625f, c = 243.04f;
+    const float *at = in[0], *rh = in[1];
+    for(int i=0; i<count; i++) {
+        float h = rh[i] < 1 ? 1 : rh[i] > 100 ? 100 : rh[i];
+        float g = logf(h/100) + b*at[i]/(c + at[i]);
+        out[0][i] = c*g/(b - g);
+    }
+}
+
+/* north american wind chill index, which only applies at or below
+   10 celcius with more than 4.8 km/h of wind */
+static void WindChillKernel(int count, const float *const *in, float *const *out)
+{
+    const float *at = in[0], *ws = in[1];
+    for(int i=0; i<count; i++) {
+        float t = at[i], v = ws[i] * 1.852f; /* knots to km/h */
+        if(isnan(v))
+            out[0][i] = NAN;
+        else if(t <= 10 && v > 4.8f) {
+            float p = powf(v, .16f);
+            out[0][i] = 13.12f + .6215f*t - 11.37f*p + .3965f*t*p;
+        } else
+            out[0][i] = t;
+    }
+}
+
+/* wind points where it blows from and current where it flows to, so
+   the wind felt while drifting with the current is their sum.  Where
+   there is no current data the wind is used as is. */
+static void CurrentWindKernel(int count, const float *const *in, float *const *out)
+{
+    const float *wu = in[0], *wv = in[1], *cu = in[2], *cv = in[3];
+    for(int i=0; i<count; i++) {
+        out[0][i] = wu[i] + (isnan(cu[i]) ? 0 : cu[i]);
+        out[1][i] = wv[i] + (isnan(cv[i]) ? 0 : cv[i]);
+    }
+}
+
+/* positive when the sea is warmer than the air (unstable) */
+static void SeaAirKernel(int count, const float *const *in, float *const *out)
+{
+    const float *sst = in[0], *at = in[1];
+    for(int i=0; i<count; i++)
+        out[0][i] = sst[i] - at[i];
+}
+
+static const DerivedFields::Field s_Fields[] = {
+    {ClimatologyOverlaySettings::DEWPOINT, false, 2,
+     {{ClimatologyOverlaySettings::AT, MAG},
+      {ClimatologyOverlaySettings::RELATIVE_HUMIDITY, MAG}}, DewPointKernel},
+    {ClimatologyOverlaySettings::WINDCHILL, false, 2,
+     {{ClimatologyOverlaySettings::AT, MAG},
+      {ClimatologyOverlaySettings::WIND, MAG}}, WindChillKernel},
+    {ClimatologyOverlaySettings::CURRENT_WIND, true, 4,
+     {{ClimatologyOverlaySettings::WIND, U}, {ClimatologyOverlaySettings::WIND, V},
+      {ClimatologyOverlaySettings::CURRENT, U}, {ClimatologyOverlaySettings::CURRENT, V}},
+     CurrentWindKernel},
+    {ClimatologyOverlaySettings::SST_AT, false, 2,
+     {{ClimatologyOverlaySettings::SST, MAG},
+      {ClimatologyOverlaySettings::AT, MAG}}, SeaAirKernel},
+};
+
+static const int s_FieldCount = (sizeof s_Fields) / (sizeof *s_Fields);
+
+DerivedFields::DerivedFields(ClimatologyOverlayFactory &factory)
+    : m_factory(factory), m_pExpression(NULL)
+{
+    m_Grids = new GridRef[(s_FieldCount+1)*13];
+}
+
+DerivedFields::~DerivedFields()
+{
+    Clear();
+    delete [] m_Grids;
+    delete m_pExpression.load();
+}
+
+/* the expression grids follow the registered fields */
+int DerivedFields::FieldIndex(int setting)
+{
+    for(int i=0; i<s_FieldCount; i++)
+        if(s_Fields[i].setting == setting)
+            return i;
+    if(setting == ClimatologyOverlaySettings::EXPRESSION)
+        return s_FieldCount;
+    return -1;
+}
+
+bool DerivedFields::IsDerived(int setting)
+{
+    return FieldIndex(setting) >= 0;
+}
+
+bool DerivedFields::IsVector(int setting)
+{
+    const Field *field = GetField(setting);
+    return field && field->vector;
+}
+
+const DerivedFields::Field *DerivedFields::GetField(int setting)
+{
+    int index = FieldIndex(setting);
+    return index < 0 || index == s_FieldCount ? NULL : &s_Fields[index];
+}
+
+void DerivedFields::Clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for(int i=0; i<(s_FieldCount+1)*13; i++)
+        std::atomic_store(&m_Grids[i], GridRef());
+}
+
+bool DerivedFields::SetExpression(const wxString &text, wxString &error)
+{
+    Expression *expression = NULL;
+    wxString trimmed = text;
+    if(!trimmed.Trim().Trim(false).IsEmpty()) {
+        expression = new Expression;
+        if(!expression->Compile(text, error)) {
+            delete expression;
+            return false;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    delete m_pExpression.exchange(expression);
+    for(int m=0; m<13; m++)
+        std::atomic_store(&m_Grids[s_FieldCount*13 + m], GridRef());
+    return true;
+}
+
+DerivedFields::Grid *DerivedFields::BuildGrid(int inputs, const Input *input, const std::function
+                                              <void(int, const float *const *, float *const *)> &kernel,
+                                              int month)
+{
+    const int size = LATITUDES*LONGITUDES;
+
+    /* cell centers, starting at 89.5 north and 0.5 east */
+    std::vector<std::vector<float> > rasters(inputs);
+    for(int k=0; k<inputs; k++) {
+        rasters[k].resize(size);
+        m_factory.getRasterMonth((enum Coord)input[k].coord, input[k].setting, month,
+                                 89.5, .5, -1, 1, LATITUDES, LONGITUDES, &rasters[k][0]);
+    }
+
+    Grid *grid = new Grid;
+    ParallelFor(0, LATITUDES, [&](int start, int end) {
+            std::vector<const float*> in(inputs);
+            float *out[MAX_OUTPUTS];
+            for(int r = start; r < end; r++) {
+                for(int k=0; k<inputs; k++)
+                    in[k] = &rasters[k][r*LONGITUDES];
+                for(int k=0; k<MAX_OUTPUTS; k++)
+                    out[k] = grid->data[k] + r*LONGITUDES;
+                kernel(LONGITUDES, in.empty() ? NULL : &in[0], out);
+            }
+        }, 8);
+    return grid;
+}
+
+DerivedFields::GridRef DerivedFields::GetGrid(int setting, int month)
+{
+    int index = FieldIndex(setting);
+    if(index < 0 || month < 0 || month > 12)
+        return GridRef();
+
+    GridRef &slot = m_Grids[index*13 + month];
+    GridRef grid = std::atomic_load(&slot);
+    if(grid)
+        return grid;
+
+    /* nothing to build without an expression */
+    if(index == s_FieldCount && !m_pExpression)
+        return grid;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    grid = std::atomic_load(&slot);
+    if(grid)
+        return grid;
+
+    if(index < s_FieldCount) {
+        const Field &field = s_Fields[index];
+        grid.reset(BuildGrid(field.inputs, field.input, field.kernel, month));
+    } else {
+        Expression *expression = m_pExpression;
+        if(!expression)
+            return grid;
+
+        std::vector<Input> input(expression->Inputs());
+        for(int k=0; k<expression->Inputs(); k++) {
+            input[k].setting = expression->InputSetting(k);
+            input[k].coord = expression->InputCoord(k);
+        }
+        grid.reset(BuildGrid(input.size(), input.empty() ? NULL : &input[0],
+                             [expression](int count, const float *const *in, float *const *out) {
+                                 expression->Evaluate(count, in, out[0]);
+                             }, month));
+    }
+    std::atomic_store(&slot, grid);
+    return grid;
+}
+
+double DerivedFields::Value(int coord, int setting, double lat, double lon, int month)
+{
+    return Value(GetGrid(setting, month), coord, setting, lat, lon);
+}
+
+double DerivedFields::Value(const GridRef &grid, int coord, int setting, double lat, double lon)
+{
+    double values[4];
+    if(!grid || !Lookup(*grid, IsVector(setting), lat, lon, values))
+        return NAN;
+    return values[coord];
+}
+
+bool DerivedFields::Values(int setting, double lat, double lon, int month, double values[4])
+{
+    values[U] = values[V] = values[MAG] = values[DIRECTION] = NAN;
+    GridRef grid = GetGrid(setting, month);
+    return grid && Lookup(*grid, IsVector(setting), lat, lon, values);
+}
+
+/* the values by Coord of the interpolated outputs */
+void DerivedFields::Outputs(bool vector, const double v[MAX_OUTPUTS], double values[4])
+{
+    if(!vector) {
+        values[U] = values[V] = values[DIRECTION] = NAN;
+        values[MAG] = v[0];
+        return;
+    }
+
+    values[U] = v[0];
+    values[V] = v[1];
+    values[MAG] = hypot(v[0], v[1]);
+    values[DIRECTION] = positive_degrees(rad2deg(atan2(v[0], v[1])));
+}
+
+bool DerivedFields::Lookup(const Grid &grid, bool vector, double lat, double lon, double values[4])
+{
+    values[U] = values[V] = values[MAG] = values[DIRECTION] = NAN;
+    if(isnan(lat) || isnan(lon))
+        return false;
+
+    /* the first and last rows are half a degree from the poles, hold them there */
+    double xi = wxMax(0, wxMin(LATITUDES-1, 89.5 - lat));
+    double yi = positive_degrees(lon - .5);
+    int x0 = floor(xi), x1 = wxMin(x0 + 1, LATITUDES-1);
+    int y0 = (int)floor(yi) % LONGITUDES, y1 = (y0 + 1) % LONGITUDES;
+    double xd = xi - x0, yd = yi - floor(yi);
+
+    double v[MAX_OUTPUTS] = {NAN, NAN};
+    for(int k = 0; k < (vector ? 2 : 1); k++) {
+        const float *p0 = grid.data[k] + x0*LONGITUDES, *p1 = grid.data[k] + x1*LONGITUDES;
+        double v0 = (1-yd)*p0[y0] + yd*p0[y1];
+        double v1 = (1-yd)*p1[y0] + yd*p1[y1];
+        v[k] = (1-xd)*v0 + xd*v1;
+    }
+    Outputs(vector, v, values);
+    return true;
+}
+
+void DerivedFields::Sample(int coord, int setting, int month,
+                           double lat0, double lon0, double dlat, double dlon,
+                           int rows, int cols, float *buffer)
+{
+    GridRef grid = GetGrid(setting, month);
+    if(!grid) {
+        for(int i=0; i<rows*cols; i++)
+            buffer[i] = NAN;
+        return;
+    }
+    bool vector = IsVector(setting);
+
+    /* column lookups are shared by every row */
+    std::vector<int> y0(cols), y1(cols);
+    std::vector<double> yd(cols);
+    for(int c = 0; c < cols; c++) {
+        double yi = positive_degrees(lon0 + c*dlon - .5);
+        y0[c] = (int)floor(yi) % LONGITUDES;
+        y1[c] = (y0[c] + 1) % LONGITUDES;
+        yd[c] = yi - floor(yi);
+    }
+
+    ParallelFor(0, rows, [&](int start, int end) {
+            for(int r = start; r < end; r++) {
+                float *out = buffer + r*cols;
+                double lat = lat0 + r*dlat;
+                if(isnan(lat)) {
+                    for(int c = 0; c < cols; c++)
+                        out[c] = NAN;
+                    continue;
+                }
+
+                double xi = wxMax(0, wxMin(LATITUDES-1, 89.5 - lat));
+                int x0 = floor(xi), x1 = wxMin(x0 + 1, LATITUDES-1);
+                double xd = xi - x0;
+                const float *p0[MAX_OUTPUTS], *p1[MAX_OUTPUTS];
+                for(int k = 0; k < MAX_OUTPUTS; k++) {
+                    p0[k] = grid->data[k] + x0*LONGITUDES;
+                    p1[k] = grid->data[k] + x1*LONGITUDES;
+                }
+
+                for(int c = 0; c < cols; c++) {
+                    double v[MAX_OUTPUTS] = {NAN, NAN}, values[4];
+                    for(int k = 0; k < (vector ? 2 : 1); k++) {
+                        double v0 = (1-yd[c])*p0[k][y0[c]] + yd[c]*p0[k][y1[c]];
+                        double v1 = (1-yd[c])*p1[k][y0[c]] + yd[c]*p1[k][y1[c]];
+                        v[k] = (1-xd)*v0 + xd*v1;
+                    }
+                    Outputs(vector, v, values);
+                    out[c] = values[coord];
+                }
+            }
+        }, 8);
+}
@@ -0,0 +1,131 @@
+/******************************************************************************
+ *
+ * Project:  OpenCPN
+ * Purpose:  Climatology Plugin
+ * Author:   Sean D'Epagnier
+ *
+ ***************************************************************************
+ *   Copyright (C) 2018 by Sean D'Epagnier                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,  USA.         *
+ ***************************************************************************
+ */
+
+
+#ifndef _DERIVEDFIELDS_H_
+#define _DERIVEDFIELDS_H_
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+#include "wx/wx.h"
+
+class ClimatologyOverlayFactory;
+class Expression;
+
+/* fields computed from several datasets, like dew point from air
+   temperature and relative humidity.  Each field names the datasets it
+   reads, and its kernel combines whole rows of them at once.
+
+   The inputs are resampled onto a common 1 degree grid with one raster
+   pass each, so differing source resolutions don't matter, and the
+   result is cached per month the first time it is asked for.  After
+   that a derived value costs the same as a built in one.
+
+   The EXPRESSION setting works the same way, with its inputs and
+   kernel coming from the compiled user expression. */
+class DerivedFields
+{
+public:
+    enum {MAX_INPUTS = 4, MAX_OUTPUTS = 2};
+    enum {LATITUDES = 180, LONGITUDES = 360};
+
+    struct Input
+    {
+        int setting;
+        int coord;
+    };
+
+    /* combine count cells of each input into the outputs, which are
+       the magnitude of scalar fields, or u and v of vector fields */
+    typedef void (*Kernel)(int count, const float *const *in, float *const *out);
+
+    struct Field
+    {
+        int setting;
+        bool vector;
+        int inputs;
+        Input input[MAX_INPUTS];
+        Kernel kernel;
+    };
+
+    DerivedFields(ClimatologyOverlayFactory &factory);
+    ~DerivedFields();
+
+    /* the registered field computing setting, or NULL */
+    static const Field *GetField(int setting);
+    static bool IsDerived(int setting);
+    static bool IsVector(int setting);
+
+    /* replace the user expression, an empty text removes it */
+    bool SetExpression(const wxString &text, wxString &error);
+
+    struct Grid
+    {
+        float data[MAX_OUTPUTS][LATITUDES*LONGITUDES];
+    };
+    /* a grid held by its reader, it outlives a change of expression */
+    typedef std::shared_ptr<const Grid> GridRef;
+
+    /* the cached grid for month, building it if needed.  Fetching it
+       takes a lock shared by every grid, so many lookups should fetch
+       it once and pass it to Value */
+    GridRef GetGrid(int setting, int month);
+
+    /* bilinear lookup in the cached grid for month */
+    double Value(int coord, int setting, double lat, double lon, int month);
+    static double Value(const GridRef &grid, int coord, int setting, double lat, double lon);
+    /* values indexed by Coord */
+    bool Values(int setting, double lat, double lon, int month, double values[4]);
+    /* the rows of a raster as ClimatologyOverlayFactory::getRasterMonth,
+       from a single fetch of the grid */
+    void Sample(int coord, int setting, int month,
+                double lat0, double lon0, double dlat, double dlon,
+                int rows, int cols, float *buffer);
+
+    /* discard the cached grids, the source data is being freed */
+    void Clear();
+
+private:
+    static int FieldIndex(int setting);
+    static bool Lookup(const Grid &grid, bool vector, double lat, double lon, double values[4]);
+    static void Outputs(bool vector, const double v[MAX_OUTPUTS], double values[4]);
+    Grid *BuildGrid(int inputs, const Input *input, const std::function
+                    <void(int, const float *const *, float *const *)> &kernel, int month);
+
+    ClimatologyOverlayFactory &m_factory;
+
+    std::mutex m_mutex;
+    /* [field count + expression][13], swapped with std::atomic_load and
+       std::atomic_store so a reader keeps its grid alive while the
+       expression is replaced or the cache cleared under it */
+    GridRef *m_Grids;
+    std::atomic<Expression*> m_pExpression;
+};
+
+#endif
@@ -0,0 +1,405 @@
+/******************************************************************************
+ *
+ * Project:  OpenCPN
+ * Purpose:  Climatology Plugin
+ * Author:   Sean D'Epagnier
+ *
+ ***************************************************************************
+ *   Copyright (C) 2018 by Sean D'Epagnier                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,  USA.         *
+ ***************************************************************************
+ */
+
+
+#include <wx/wx.h>
+
+#include <math.h>
+#include <stdlib.h>
+#include <string>
+
+#include "climatology_pi.h"
+#include "Expression.h"
+
+static const struct {
+    const char *name;
+    int setting;
+    enum Coord coord;
+} s_Datasets[] = {
+    {"wind", ClimatologyOverlaySettings::WIND, MAG},
+    {"wind_u", ClimatologyOverlaySettings::WIND, U},
+    {"wind_v", ClimatologyOverlaySettings::WIND, V},
+    {"current", ClimatologyOverlaySettings::CURRENT, MAG},
+    {"current_u", ClimatologyOverlaySettings::CURRENT, U},
+    {"current_v", ClimatologyOverlaySettings::CURRENT, V},
+    {"pressure", ClimatologyOverlaySettings::SLP, MAG},
+    {"sst", ClimatologyOverlaySettings::SST, MAG},
+    {"at", ClimatologyOverlaySettings::AT, MAG},
+    {"cloud", ClimatologyOverlaySettings::CLOUD, MAG},
+    {"precip", ClimatologyOverlaySettings::PRECIPITATION, MAG},
+    {"humidity", ClimatologyOverlaySettings::RELATIVE_HUMIDITY, MAG},
+    {"lightning", ClimatologyOverlaySettings::LIGHTNING, MAG},
+    {"depth", ClimatologyOverlaySettings::SEADEPTH, MAG},
+};
+
+static const int s_DatasetCount = (sizeof s_Datasets) / (sizeof *s_Datasets);
+
+/* recursive descent, emitting code as it goes:
+
+   compare := sum [('<' | '>' | '<=' | '>=') sum]
+   sum     := product {('+' | '-') product}
+   product := unary {('*' | '/') unary}
+   unary   := '-' unary | power
+   power   := primary ['^' unary]
+   primary := number | dataset | function '(' compare {',' compare} ')'
+            | '(' compare ')'                                          */
+class Expression::Parser
+{
+public:
+    Parser(Expression &expression, const std::string &text)
+        : m_expression(expression), m_text(text), m_pos(0) {}
+
+    bool Parse(wxString &error)
+    {
+        if(!Compare())
+            return Fail(error);
+        SkipSpace();
+        if(m_pos < m_text.size()) {
+            m_error = wxString::Format(_("unexpected '%c'"), m_text[m_pos]);
+            return Fail(error);
+        }
+        return true;
+    }
+
+private:
+    bool Fail(wxString &error)
+    {
+        error = wxString::Format(_("column %d: "), (int)m_pos + 1) + m_error;
+        return false;
+    }
+
+    void SkipSpace()
+    {
+        while(m_pos < m_text.size() && isspace((unsigned char)m_text[m_pos]))
+            m_pos++;
+    }
+
+    bool Accept(const char *token)
+    {
+        SkipSpace();
+        size_t len = strlen(token);
+        if(m_text.compare(m_pos, len, token))
+            return false;
+        m_pos += len;
+        return true;
+    }
+
+    bool Expect(const char *token)
+    {
+        if(Accept(token))
+            return true;
+        m_error = wxString::Format(_("expected '%s'"), token);
+        return false;
+    }
+
+    bool Compare()
+    {
+        if(!Sum())
+            return false;
+        Op op;
+        if(Accept("<="))     op = LESS_EQUAL;
+        else if(Accept(">=")) op = GREATER_EQUAL;
+        else if(Accept("<"))  op = LESS;
+        else if(Accept(">"))  op = GREATER;
+        else
+            return true;
+        if(!Sum())
+            return false;
+        m_expression.Emit(op);
+        return true;
+    }
+
+    bool Sum()
+    {
+        if(!Product())
+            return false;
+        for(;;) {
+            Op op;
+            if(Accept("+"))      op = ADD;
+            else if(Accept("-")) op = SUB;
+            else
+                return true;
+            if(!Product())
+                return false;
+            m_expression.Emit(op);
+        }
+    }
+
+    bool Product()
+    {
+        if(!Unary())
+            return false;
+        for(;;) {
+            Op op;
+            if(Accept("*"))      op = MUL;
+            else if(Accept("/")) op = DIV;
+            else
+                return true;
+            if(!Unary())
+                return false;
+            m_expression.Emit(op);
+        }
+    }
+
+    bool Unary()
+    {
+        if(Accept("-")) {
+            if(!Unary())
+                return false;
+            m_expression.Emit(NEG);
+            return true;
+        }
+        return Power();
+    }
+
+    bool Power()
+    {
+        if(!Primary())
+            return false;
+        if(!Accept("^"))
+            return true;
+        if(!Unary())
+            return false;
+        m_expression.Emit(POW);
+        return true;
+    }
+
+    bool Function(const std::string &name)
+    {
+        static const struct { const char *name; Op op; int args; } functions[] = {
+            {"min", MIN, 2}, {"max", MAX, 2}, {"pow", POW, 2},
+            {"abs", ABS, 1}, {"sqrt", SQRT, 1}, {"log", LOG, 1}, {"exp", EXP, 1}};
+
+        for(unsigned int i=0; i < (sizeof functions) / (sizeof *functions); i++) {
+            if(name != functions[i].name)
+                continue;
+            for(int arg = 0; arg < functions[i].args; arg++)
+                if((arg && !Expect(",")) || !Compare())
+                    return false;
+            if(!Expect(")"))
+                return false;
+            m_expression.Emit(functions[i].op);
+            return true;
+        }
+        m_error = wxString::Format(_("unknown function '%s'"), name.c_str());
+        return false;
+    }
+
+    bool Primary()
+    {
+        SkipSpace();
+        if(m_pos == m_text.size()) {
+            m_error = _("unexpected end");
+            return false;
+        }
+
+        if(Accept("(")) {
+            if(!Compare())
+                return false;
+            return Expect(")");
+        }
+
+        const char *start = m_text.c_str() + m_pos;
+        if(isdigit((unsigned char)*start) || *start == '.') {
+            /* scan the literal ourselves and convert in the C locale so
+               a decimal comma locale still reads "1.5" as one and a half */
+            size_t end = m_pos;
+            while(end < m_text.size() && (isdigit((unsigned char)m_text[end]) || m_text[end] == '.'))
+                end++;
+            if(end < m_text.size() && (m_text[end] == 'e' || m_text[end] == 'E')) {
+                size_t exp = end + 1;
+                if(exp < m_text.size() && (m_text[exp] == '+' || m_text[exp] == '-'))
+                    exp++;
+                if(exp < m_text.size() && isdigit((unsigned char)m_text[exp])) {
+                    while(exp < m_text.size() && isdigit((unsigned char)m_text[exp]))
+                        exp++;
+                    end = exp;
+                }
+            }
+
+            double value;
+            wxString literal = wxString::FromUTF8(m_text.substr(m_pos, end - m_pos).c_str());
+            if(!literal.ToCDouble(&value)) {
+                m_error = _("invalid number") + _T(" '") + literal + _T("'");
+                return false;
+            }
+            m_pos = end;
+            m_expression.Emit(PUSH_CONST, 0, value);
+            return true;
+        }
+
+        if(!isalpha((unsigned char)*start)) {
+            m_error = wxString::Format(_("unexpected '%c'"), *start);
+            return false;
+        }
+
+        size_t end = m_pos;
+        while(end < m_text.size() && (isalnum((unsigned char)m_text[end]) || m_text[end] == '_'))
+            end++;
+        std::string name = m_text.substr(m_pos, end - m_pos);
+        m_pos = end;
+
+        if(Accept("("))
+            return Function(name);
+
+        for(int i=0; i<s_DatasetCount; i++)
+            if(name == s_Datasets[i].name) {
+                m_expression.Emit(PUSH_INPUT, m_expression.InputIndex
+                                  (s_Datasets[i].setting, s_Datasets[i].coord));
+                return true;
+            }
+
+        m_error = wxString::Format(_("unknown dataset '%s'"), name.c_str());
+        return false;
+    }
+
+    Expression &m_expression;
+    std::string m_text;
+    size_t m_pos;
+    wxString m_error;
+};
+
+int Expression::InputIndex(int setting, int coord)
+{
+    for(unsigned int i=0; i<m_Inputs.size(); i++)
+        if(m_Inputs[i].setting == setting && m_Inputs[i].coord == coord)
+            return i;
+
+    InputRef ref = {setting, coord};
+    m_Inputs.push_back(ref);
+    return m_Inputs.size() - 1;
+}
+
+void Expression::Emit(Op op, int input, float value)
+{
+    Instruction instruction = {op, input, value};
+    m_Code.push_back(instruction);
+
+    switch(op) {
+    case PUSH_INPUT: case PUSH_CONST:
+        m_Depth++;
+        break;
+    case NEG: case ABS: case SQRT: case LOG: case EXP:
+        break;
+    default: /* binary */
+        m_Depth--;
+    }
+    m_StackDepth = wxMax(m_StackDepth, m_Depth);
+}
+
+bool Expression::Compile(const wxString &text, wxString &error)
+{
+    m_Code.clear();
+    m_Inputs.clear();
+    m_StackDepth = m_Depth = 0;
+
+    Parser parser(*this, std::string(text.mb_str()));
+    if(parser.Parse(error))
+        return true;
+
+    m_Code.clear();
+    m_Inputs.clear();
+    return false;
+}
+
+wxString Expression::Help()
+{
+    wxString help = _("Datasets:");
+    for(int i=0; i<s_DatasetCount; i++)
+        help += " " + wxString(s_Datasets[i].name);
+    return help + "\n" + _("Operators: + - * / ^ < > <= >=") + "\n"
+        + _("Functions: min max pow abs sqrt log exp");
+}
+
+/* operations write into the stack slot of their first operand, while
+   inputs are referenced in place without copying */
+#define UNARY(expr)                                                     \
+    {                                                                   \
+        const float *a = src[sp-1];                                     \
+        float *o = &stack[(sp-1)*count];                                \
+        for(int i=0; i<count; i++)                                      \
+            o[i] = expr;                                                \
+        src[sp-1] = o;                                                  \
+    } break
+
+#define BINARY(expr)                                                    \
+    {                                                                   \
+        const float *a = src[sp-2], *b = src[sp-1];                     \
+        float *o = &stack[(sp-2)*count];                                \
+        for(int i=0; i<count; i++)                                      \
+            o[i] = expr;                                                \
+        src[sp-2] = o;                                                  \
+        sp--;                                                           \
+    } break
+
+void Expression::Evaluate(int count, const float *const *in, float *out) const
+{
+    if(m_Code.empty()) {
+        for(int i=0; i<count; i++)
+            out[i] = NAN;
+        return;
+    }
+
+    std::vector<float> stack(m_StackDepth*count);
+    std::vector<const float*> src(m_StackDepth);
+    int sp = 0;
+
+    for(unsigned int pc = 0; pc < m_Code.size(); pc++) {
+        const Instruction &ins = m_Code[pc];
+        switch(ins.op) {
+        case PUSH_INPUT:
+            src[sp++] = in[ins.input];
+            break;
+        case PUSH_CONST:
+        {
+            float *o = &stack[sp*count];
+            for(int i=0; i<count; i++)
+                o[i] = ins.value;
+            src[sp++] = o;
+        } break;
+        case NEG:  UNARY(-a[i]);
+        case ABS:  UNARY(fabsf(a[i]));
+        case SQRT: UNARY(sqrtf(a[i]));
+        case LOG:  UNARY(logf(a[i]));
+        case EXP:  UNARY(expf(a[i]));
+        case ADD:  BINARY(a[i] + b[i]);
+        case SUB:  BINARY(a[i] - b[i]);
+        case MUL:  BINARY(a[i] * b[i]);
+        case DIV:  BINARY(a[i] / b[i]);
+        case POW:  BINARY(powf(a[i], b[i]));
+        /* nan in either argument gives nan */
+        case LESS:          BINARY(isnan(a[i]) || isnan(b[i]) ? NAN : a[i] < b[i] ? 1.f : 0.f);
+        case GREATER:       BINARY(isnan(a[i]) || isnan(b[i]) ? NAN : a[i] > b[i] ? 1.f : 0.f);
+        case LESS_EQUAL:    BINARY(isnan(a[i]) || isnan(b[i]) ? NAN : a[i] <= b[i] ? 1.f : 0.f);
+        case GREATER_EQUAL: BINARY(isnan(a[i]) || isnan(b[i]) ? NAN : a[i] >= b[i] ? 1.f : 0.f);
+        case MIN: BINARY(a[i] < b[i] || isnan(a[i]) ? a[i] : b[i]);
+        case MAX: BINARY(a[i] > b[i] || isnan(a[i]) ? a[i] : b[i]);
+        }
+    }
+
+    for(int i=0; i<count; i++)
+        out[i] = src[0][i];
+}
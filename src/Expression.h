@@ -0,0 +1,90 @@
+/******************************************************************************
+ *
+ * Project:  OpenCPN
+ * Purpose:  Climatology Plugin
+ * Author:   Sean D'Epagnier
+ *
+ ***************************************************************************
+ *   Copyright (C) 2018 by Sean D'Epagnier                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,  USA.         *
+ ***************************************************************************
+ */
+
+
+#ifndef _EXPRESSION_H_
+#define _EXPRESSION_H_
+
+#include <vector>
+
+#include "wx/wx.h"
+
+/* a user typed formula over the climatology datasets, such as
+   "precip*cloud/100" or "max(wind-20, 0)".
+
+   The text is compiled to a short stack program.  Each instruction
+   works on a whole row of grid cells, so the interpreter dispatches once
+   per row rather than once per cell and every operation is a plain loop
+   the compiler can vectorize. */
+class Expression
+{
+public:
+    Expression() : m_StackDepth(0), m_Depth(0) {}
+
+    /* returns false and describes the problem on a syntax error */
+    bool Compile(const wxString &text, wxString &error);
+
+    /* the datasets read, in the order Evaluate expects their rows */
+    int Inputs() const { return m_Inputs.size(); }
+    int InputSetting(int i) const { return m_Inputs[i].setting; }
+    int InputCoord(int i) const { return m_Inputs[i].coord; }
+
+    /* out[i] for count cells given a row of each input */
+    void Evaluate(int count, const float *const *in, float *out) const;
+
+    /* names accepted for datasets and functions, for help text */
+    static wxString Help();
+
+private:
+    enum Op {PUSH_INPUT, PUSH_CONST, NEG, ADD, SUB, MUL, DIV, POW,
+             LESS, GREATER, LESS_EQUAL, GREATER_EQUAL,
+             MIN, MAX, ABS, SQRT, LOG, EXP};
+
+    struct Instruction
+    {
+        Op op;
+        int input;
+        float value;
+    };
+
+    struct InputRef
+    {
+        int setting;
+        int coord;
+    };
+
+    class Parser;
+
+    int InputIndex(int setting, int coord);
+    void Emit(Op op, int input = 0, float value = 0);
+
+    std::vector<Instruction> m_Code;
+    std::vector<InputRef> m_Inputs;
+    int m_StackDepth;
+    int m_Depth; /* while compiling */
+};
+
+#endif
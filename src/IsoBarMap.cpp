@@ -24,9 +24,12 @@
  ***************************************************************************
  */
 
+#include <chrono>
+#include <deque>
+#include <unordered_map>
+
 #include <wx/wx.h>
 #include <wx/glcanvas.h>
-#include <wx/progdlg.h>
 
 #ifdef __WXOSX__
 # include <OpenGL/OpenGL.h>
@@ -41,79 +44,255 @@
 #include "ocpn_plugin.h"
 
 #include "IsoBarMap.h"
+#include "MercatorView.h"
+#include "ThreadPool.h"
 #include "defs.h"
 #include "gldefs.h"
 #include "plugingl/pidc.h"
 
-/* initialize cache to contain data */
-void ParamCache::Initialize(double step)
+IsoBarGrid::IsoBarGrid(double step)
+    : m_bFilled(false), m_bExact(false), m_Step(step),
+      m_Rows(round(2*MAX_LAT / step) + 1), m_Cols(round(360 / step) + 1)
 {
-    if(m_step != step) {
-        m_step = step;
-        delete [] values;
-        int size = 360/step;
-        values = new double[size];
-    }
-    m_lat=100; /* invalidate data */
 }
 
-/* attempt a cache read returning a hit or miss */
-bool ParamCache::Read(double lat, double lon, double &value)
+bool IsoBarGrid::Read(double lat, double lon, double &value) const
 {
-    if(lat != m_lat)
-        return false;
-    lon += 180;
-    if(lon > 360)
-        lon -= 360;
-    if(lon < 0 || lon >= 360)
-        return false;
-    double div = lon / m_step;
-    if(div != floor(div))
+    double r = (lat + MAX_LAT) / m_Step, c = (lon + 180) / m_Step;
+    if(r != floor(r) || c != floor(c) ||
+       r < 0 || r >= m_Rows || c < 0 || c >= m_Cols)
         return false;
 
-    value = values[(int)div];
+    value = m_Values[(int)r*m_Cols + (int)c];
     return true;
 }
 
-/* build up cache for all longitudes */
-void IsoBarMap::BuildParamCache(ParamCache &cache, double lat)
-{
-    int i=0;
-    for(double lon = -180; lon < 180; lon += m_Step, i++)
-        cache.values[i] = Parameter(lat, lon);
-    cache.m_lat = lat;
-}
-
-IsoBarMap::IsoBarMap(wxString name, double spacing, double step) :
-    m_bNeedsRecompute(false), m_bComputing(false),
+IsoBarMap::IsoBarMap(wxString name, double spacing, double step,
+                     std::shared_ptr<IsoBarGrid> grid, std::shared_ptr<IsoBarGrid> ngrid,
+                     double weight) :
     m_Spacing(spacing), m_Step(step), m_PoleAccuracy(1e-4),
+    m_bCancel(false), m_bFinished(false), m_bRunning(false),
+    m_Sources(ngrid && weight != 1 ? 2 : 1), m_Weight(m_Sources == 2 ? weight : 1),
     m_MinContour(NAN), m_MaxContour(NAN),
     m_contourcachesize(0), m_contourcache(NULL),
     lastx(0), lasty(0),
     m_Name(name), m_bPolar(false), m_Color(*wxBLACK)
-     {}
+{
+    m_Grid[0] = grid ? grid : std::make_shared<IsoBarGrid>(step);
+    if(m_Sources == 2)
+        m_Grid[1] = ngrid;
+
+    for(int latind=0; latind<LATITUDE_ZONES; latind++)
+        m_bZoneDone[latind] = false;
+}
+
+IsoBarMap::~IsoBarMap()
+{
+    Stop();
+    ClearMap();
+}
+
+void IsoBarMap::Start()
+{
+    m_bRunning = true;
+    m_Thread = std::thread([this]() {
+            Recompute();
+            m_bRunning = false;
+        });
+}
+
+void IsoBarMap::Stop()
+{
+    m_bCancel = true;
+    if(m_Thread.joinable())
+        m_Thread.join();
+}
+
+void IsoBarMap::ZoneDone(int latind)
+{
+    if(m_bCancel)
+        return;
+    StitchZone(latind);
+    m_bZoneDone[latind] = true;
+}
+
+/* where segment ends meet, the cells either side of an edge finding
+   the same crossing give or take rounding */
+static long long StitchKey(double lat, double lon)
+{
+    return llround(lat*1e6)*1000000000LL + llround(lon*1e6);
+}
+
+static void AddPolyline(IsoBarLines &lines, const float *xy, int count, double contour)
+{
+    IsoBarLines::Polyline p;
+    p.start = lines.points.size()/2;
+    p.count = count;
+    p.contour = contour;
+    p.x_min = p.y_min = INFINITY;
+    p.x_max = p.y_max = -INFINITY;
+    for(int j=0; j<count; j++) {
+        float x = xy[2*j], y = xy[2*j+1];
+        p.x_min = wxMin(p.x_min, x), p.x_max = wxMax(p.x_max, x);
+        p.y_min = wxMin(p.y_min, y), p.y_max = wxMax(p.y_max, y);
+    }
+    lines.points.insert(lines.points.end(), xy, xy + 2*count);
+    for(int j=1; j<count; j++)
+        lines.vertices.insert(lines.vertices.end(), xy + 2*(j-1), xy + 2*(j+1));
+    lines.polylines.push_back(p);
+}
+
+/* distance from p to the segment a b */
+static double SegmentDistance(const float *p, const float *a, const float *b)
+{
+    double dx = b[0] - a[0], dy = b[1] - a[1], l = dx*dx + dy*dy;
+    double t = l ? ((p[0] - a[0])*dx + (p[1] - a[1])*dy) / l : 0;
+    t = wxMax(0, wxMin(1, t));
+    return hypot(a[0] + t*dx - p[0], a[1] + t*dy - p[1]);
+}
+
+/* douglas-peucker: keep the ends of each polyline, and between two kept
+   points the one furthest from the segment joining them, as long as it
+   is further than tolerance.  Simplifying the previous level rather than
+   the full lines adds up the tolerances, so stays within twice. */
+static void SimplifyLines(const IsoBarLines &in, IsoBarLines &out, double tolerance)
+{
+    std::vector<bool> keep;
+    std::vector<std::pair<int, int> > stack;
+    std::vector<float> xy;
+    for(unsigned int i=0; i<in.polylines.size(); i++) {
+        const IsoBarLines::Polyline &p = in.polylines[i];
+        const float *q = &in.points[2*p.start];
+
+        keep.assign(p.count, false);
+        keep[0] = keep[p.count-1] = true;
+        stack.push_back(std::make_pair(0, p.count-1));
+        while(!stack.empty()) {
+            int a = stack.back().first, b = stack.back().second;
+            stack.pop_back();
+
+            int furthest = -1;
+            double max = tolerance;
+            for(int j=a+1; j<b; j++) {
+                double d = SegmentDistance(q + 2*j, q + 2*a, q + 2*b);
+                if(d > max)
+                    max = d, furthest = j;
+            }
+            if(furthest < 0)
+                continue;
+            keep[furthest] = true;
+            stack.push_back(std::make_pair(a, furthest));
+            stack.push_back(std::make_pair(furthest, b));
+        }
+
+        xy.clear();
+        for(int j=0; j<p.count; j++)
+            if(keep[j]) {
+                xy.push_back(q[2*j]);
+                xy.push_back(q[2*j+1]);
+            }
+        AddPolyline(out, &xy[0], xy.size()/2, p.contour);
+    }
+    out.count = out.vertices.size()/2;
+}
+
+/* join the segments of a zone of latitude end to end into polylines,
+   and free the segments */
+void IsoBarMap::StitchZone(int latind)
+{
+    std::vector<PlotLineSeg> segs;
+    for(int lonind=0; lonind<LONGITUDE_ZONES; lonind++) {
+        std::vector<PlotLineSeg> &region = m_map[latind][lonind];
+        segs.insert(segs.end(), region.begin(), region.end());
+        std::vector<PlotLineSeg>().swap(region);
+    }
+
+    /* segment i's first end is 2*i, its second 2*i+1 */
+    std::unordered_multimap<long long, int> ends;
+    for(unsigned int i=0; i<segs.size(); i++) {
+        ends.insert(std::make_pair(StitchKey(segs[i].lat1, segs[i].lon1), 2*i));
+        ends.insert(std::make_pair(StitchKey(segs[i].lat2, segs[i].lon2), 2*i+1));
+    }
+
+    std::vector<bool> used(segs.size());
+    /* the unused segment with an end at (lat, lon) on contour, taking
+       the other end of it, false if there isn't one */
+    auto next = [&](double contour, double &lat, double &lon) {
+        auto range = ends.equal_range(StitchKey(lat, lon));
+        for(auto it = range.first; it != range.second; it++) {
+            int i = it->second/2;
+            if(used[i] || segs[i].contour != contour)
+                continue;
+            used[i] = true;
+            if(it->second&1)
+                lat = segs[i].lat1, lon = segs[i].lon1;
+            else
+                lat = segs[i].lat2, lon = segs[i].lon2;
+            return true;
+        }
+        return false;
+    };
+
+    IsoBarLines &lines = m_lines[latind][0];
+    std::deque<std::pair<double, double> > chain;
+    std::vector<float> xy;
+    for(unsigned int i=0; i<segs.size(); i++) {
+        if(used[i])
+            continue;
+        used[i] = true;
+
+        double contour = segs[i].contour;
+        chain.clear();
+        chain.push_back(std::make_pair(segs[i].lat1, segs[i].lon1));
+        chain.push_back(std::make_pair(segs[i].lat2, segs[i].lon2));
+
+        double lat = segs[i].lat2, lon = segs[i].lon2;
+        while(next(contour, lat, lon))
+            chain.push_back(std::make_pair(lat, lon));
+        lat = segs[i].lat1, lon = segs[i].lon1;
+        while(next(contour, lat, lon))
+            chain.push_front(std::make_pair(lat, lon));
+
+        xy.resize(2*chain.size());
+        for(unsigned int j=0; j<chain.size(); j++) {
+            double x, y;
+            MercatorView::Mercator(chain[j].first, chain[j].second, x, y);
+            xy[2*j] = x, xy[2*j+1] = y;
+        }
+        AddPolyline(lines, &xy[0], chain.size(), contour);
+    }
+    lines.count = lines.vertices.size()/2;
 
-IsoBarMap::~IsoBarMap() { ClearMap(); }
+    double tolerance = ISOBAR_TOLERANCE;
+    for(int level = 1; level < ISOBAR_LEVELS; level++) {
+        tolerance *= 4;
+        SimplifyLines(m_lines[latind][level-1], m_lines[latind][level], tolerance);
+    }
+}
 
 /* a possible speedup would be to cache the last 4-10 values
-   calculated as well as the two main cache banks to speed
-   up the recursion in PlotRegion */
-double IsoBarMap::CachedParameter(double lat, double lon)
+   calculated as well as the grid to speed up the recursion in PlotRegion */
+double IsoBarMap::CachedParameter(IsoBarBand &band, double lat, double lon)
 {
-    double value;
-    if(!m_Cache[0].Read(lat, lon, value) &&
-       !m_Cache[1].Read(lat, lon, value))
-        value = Parameter(lat, lon);
-    return value;
+    double value, nvalue;
+    if(!m_Grid[0]->Read(lat, lon, value))
+        return Parameter(band, lat, lon);
+    if(m_Sources == 2 && m_Grid[1]->Read(lat, lon, nvalue))
+        value = m_Weight*value + (1-m_Weight)*nvalue;
+    return Calibrate(value);
 }
 
-double IsoBarMap::Parameter(double lat, double lon)
+/* the range is kept per band and combined once all bands are done */
+double IsoBarMap::Parameter(IsoBarBand &band, double lat, double lon)
 {
-    double ret = CalcParameter(lat, lon);
-    if(isnan(m_MinContour) || ret < m_MinContour)
-        m_MinContour = ret;
-    if(isnan(m_MaxContour) || ret > m_MaxContour)
-        m_MaxContour = ret;
+    double ret = CalcParameter(0, lat, lon);
+    if(m_Sources == 2)
+        ret = m_Weight*ret + (1-m_Weight)*CalcParameter(1, lat, lon);
+    ret = Calibrate(ret);
+    if(isnan(band.min) || ret < band.min)
+        band.min = ret;
+    if(isnan(band.max) || ret > band.max)
+        band.max = ret;
     return ret;
 }
 
@@ -123,8 +302,8 @@ double IsoBarMap::Parameter(double lat, double lon)
    to allow computing new y values along te segment.   rx is set to nan if
    there is no intersection.  True is returned if success, otherwise false
    to signify that we need to dig deeper to get a decent map. */
-bool IsoBarMap::Interpolate(double x1, double x2, double y1, double y2, bool lat,
-                                  double lonval, double&rx, double &ry)
+bool IsoBarMap::Interpolate(IsoBarBand &band, double x1, double x2, double y1, double y2,
+                            bool lat, double lonval, double&rx, double &ry)
 {
     if(fabs(x1-x2) < m_PoleAccuracy) { /* to avoid recursing too far. make this value
                                           smaller to get more accuracy especially near the magnetic poles */
@@ -179,9 +358,9 @@ bool IsoBarMap::Interpolate(double x1, double x2, double y1, double y2, bool lat
    
         double p;
         if(lat)
-            p = Parameter(rx, lonval);
+            p = Parameter(band, rx, lonval);
         else
-            p = Parameter(lonval, rx);
+            p = Parameter(band, lonval, rx);
 
         if(isnan(p)) /* is this actually correct? */
             return true;
@@ -212,7 +391,7 @@ bool IsoBarMap::Interpolate(double x1, double x2, double y1, double y2, bool lat
 }
 
 /* once we have a final line segment, store it in the database */
-void AddLineSeg(std::list<PlotLineSeg> &region, double lat1, double lon1, double lat2, double lon2,
+void AddLineSeg(std::vector<PlotLineSeg> &region, double lat1, double lon1, double lat2, double lon2,
                 double contour1, double contour2)
 {
     if(contour1 != contour2) /* this should not be possible */
@@ -234,17 +413,17 @@ void AddLineSeg(std::list<PlotLineSeg> &region, double lat1, double lon1, double
               lon4
 
 */
-void IsoBarMap::PlotRegion(std::list<PlotLineSeg> &region,
+void IsoBarMap::PlotRegion(IsoBarBand &band, std::vector<PlotLineSeg> &region,
                            double lat1, double lon1, double lat2, double lon2,
                            int maxdepth)
 {
     if(maxdepth == 0)
         return;
 
-    double p1 = CachedParameter(lat1, lon1);
-    double p2 = CachedParameter(lat1, lon2);
-    double p3 = CachedParameter(lat2, lon1);
-    double p4 = CachedParameter(lat2, lon2);
+    double p1 = CachedParameter(band, lat1, lon1);
+    double p2 = CachedParameter(band, lat1, lon2);
+    double p3 = CachedParameter(band, lat2, lon1);
+    double p4 = CachedParameter(band, lat2, lon2);
 
     if(isnan(p1) || isnan(p2) || isnan(p3) || isnan(p4))
         return;
@@ -253,20 +432,20 @@ void IsoBarMap::PlotRegion(std::list<PlotLineSeg> &region,
     double lon3, lon4, lat3, lat4;
     /* horizontal interpolate to determine intermediate longitudes as well
        as the contours they are on. */
-    if(!Interpolate(lon1, lon2, p1, p2, false, lat1, lon3, ry1) ||
-       !Interpolate(lon1, lon2, p3, p4, false, lat2, lon4, ry2)) {
+    if(!Interpolate(band, lon1, lon2, p1, p2, false, lat1, lon3, ry1) ||
+       !Interpolate(band, lon1, lon2, p3, p4, false, lat2, lon4, ry2)) {
         lon3 = (lon1+lon2)/2;
-        PlotRegion(region, lat1, lon1, lat2, lon3, maxdepth-1);
-        PlotRegion(region, lat1, lon3, lat2, lon2, maxdepth-1);
+        PlotRegion(band, region, lat1, lon1, lat2, lon3, maxdepth-1);
+        PlotRegion(band, region, lat1, lon3, lat2, lon2, maxdepth-1);
         return;
     }
     
     /* vertical interpolate */
-    if(!Interpolate(lat1, lat2, p1, p3, true, lon1, lat3, ry3) ||
-       !Interpolate(lat1, lat2, p2, p4, true, lon2, lat4, ry4)) {
+    if(!Interpolate(band, lat1, lat2, p1, p3, true, lon1, lat3, ry3) ||
+       !Interpolate(band, lat1, lat2, p2, p4, true, lon2, lat4, ry4)) {
         lat3 = (lat1+lat2)/2;
-        PlotRegion(region, lat1, lon1, lat3, lon2, maxdepth-1);
-        PlotRegion(region, lat3, lon1, lat2, lon2, maxdepth-1);
+        PlotRegion(band, region, lat1, lon1, lat3, lon2, maxdepth-1);
+        PlotRegion(band, region, lat3, lon1, lat2, lon2, maxdepth-1);
         return;
     }
 
@@ -278,10 +457,10 @@ void IsoBarMap::PlotRegion(std::list<PlotLineSeg> &region,
     case 0: /* all 4 sides? need to recurse to get better resolution */
         lon3 = (lon1+lon2)/2;
         lat3 = (lat1+lat2)/2;
-        PlotRegion(region, lat1, lon1, lat3, lon3, maxdepth-1);
-        PlotRegion(region, lat1, lon3, lat3, lon2, maxdepth-1);
-        PlotRegion(region, lat3, lon1, lat2, lon3, maxdepth-1);
-        PlotRegion(region, lat3, lon3, lat2, lon2, maxdepth-1);
+        PlotRegion(band, region, lat1, lon1, lat3, lon3, maxdepth-1);
+        PlotRegion(band, region, lat1, lon3, lat3, lon2, maxdepth-1);
+        PlotRegion(band, region, lat3, lon1, lat2, lon3, maxdepth-1);
+        PlotRegion(band, region, lat3, lon3, lat2, lon2, maxdepth-1);
         break;
     case 1: case 2: case 4: case 8: case 7: case 11: case 13: case 14: break; /* impossible! */
     case 3: /* horizontal */ AddLineSeg(region, lat3, lon1, lat4, lon2, ry3, ry4); break;
@@ -316,74 +495,234 @@ bool MagneticPlotMap::Recompute(wxDateTime date)
 #endif
 
 
-bool IsoBarMap::Recompute(wxWindow *parent)
+/* marching squares over one cell of the sampled grid, the corners
+   being counterclockwise from (lat, lon):
+
+    lat+step  3-----2
+              |     |
+    lat       0-----1
+             lon   lon+step
+
+   A contour crosses an edge where its ends are on opposite sides,
+   at the point linear interpolation along the edge gives.  When all
+   four edges are crossed (a saddle) the average of the corners, which
+   is the value at the centre, decides which corners are cut off. */
+void IsoBarMap::ContourCell(std::vector<PlotLineSeg> &region, double lat, double lon,
+                            const double v[4])
 {
-    /* clear out old data */
-  ClearMap();
+    static const int corner_lat[4] = {0, 0, 1, 1}, corner_lon[4] = {0, 1, 1, 0};
 
-  m_bComputing = true;
+    if(isnan(v[0] + v[1] + v[2] + v[3]))
+        return;
 
-  wxProgressDialog *progressdialog = nullptr;
-  wxDateTime start = wxDateTime::Now();
+    double vmin = v[0], vmax = v[0];
+    for(int i=1; i<4; i++) {
+        vmin = wxMin(vmin, v[i]);
+        vmax = wxMax(vmax, v[i]);
+    }
 
-  int cachepage = 0;
-   m_Cache[0].Initialize(m_Step);
-   m_Cache[1].Initialize(m_Step);
+    for(double k = ceil(vmin / m_Spacing); k*m_Spacing <= vmax; k++) {
+        double contour = k*m_Spacing;
+
+        bool above[4];
+        for(int i=0; i<4; i++)
+            above[i] = v[i] >= contour;
+
+        /* edge i runs from corner i to corner i+1 */
+        double elat[4], elon[4];
+        int crossings = 0;
+        for(int i=0; i<4; i++) {
+            int j = (i+1)%4;
+            if(above[i] == above[j])
+                continue;
+            double t = (contour - v[i]) / (v[j] - v[i]);
+            elat[i] = lat + m_Step*(corner_lat[i] + t*(corner_lat[j] - corner_lat[i]));
+            elon[i] = lon + m_Step*(corner_lon[i] + t*(corner_lon[j] - corner_lon[i]));
+            crossings++;
+        }
 
-   double min = -MAX_LAT, max = MAX_LAT;
+        if(crossings == 2) {
+            int e[2], n = 0;
+            for(int i=0; i<4; i++)
+                if(above[i] != above[(i+1)%4])
+                    e[n++] = i;
+            region.push_back(PlotLineSeg(elat[e[0]], elon[e[0]], elat[e[1]], elon[e[1]], contour));
+        } else if(crossings == 4) {
+            bool center = (v[0] + v[1] + v[2] + v[3])/4 >= contour;
+            /* cut off each corner on the other side from the centre,
+               between the two edges that meet there */
+            for(int i=0; i<4; i++)
+                if(above[i] != center) {
+                    int e = (i+3)%4;
+                    region.push_back(PlotLineSeg(elat[e], elon[e], elat[i], elon[i], contour));
+                }
+        }
+    }
+}
 
-  BuildParamCache(m_Cache[cachepage], min);
+/* the calibrated value at a grid sample, blending the sources */
+double IsoBarMap::GridValue(int index)
+{
+    double value = m_Grid[0]->m_Values[index];
+    if(m_Sources == 2)
+        value = m_Weight*value + (1-m_Weight)*m_Grid[1]->m_Values[index];
+    return Calibrate(value);
+}
 
-  for(double lat = min; lat + m_Step <= max; lat += m_Step) {
-      if(m_bNeedsRecompute) {
-          if (progressdialog) progressdialog->Destroy();
-          return false;
-      }
-
-      wxDateTime now = wxDateTime::Now();
-      if(progressdialog) {
-          if((now-start).GetMilliseconds() > 1200) {
-              if(!progressdialog->Update(lat - min)) {
-                  progressdialog->Destroy();
-                  return false;
-              }
-              start = now;
-          }
-      } else if((now-start).GetMilliseconds() > 500) {
-          if(lat < (max - min)/2) {
-              progressdialog = new wxProgressDialog(
-                  _("Building Isobar Map"), m_Name, max - min + 1, parent,
-                  wxPD_ELAPSED_TIME
-//#ifndef WIN32
-                  | wxPD_CAN_ABORT
-//#endif
-                  );
-              progressdialog->Update(0);
-          }
-      }
+/* fill the grid of a source unless a map sharing it already has,
+   false if cancelled first */
+bool IsoBarMap::SampleGrid(int source)
+{
+    IsoBarGrid &grid = *m_Grid[source];
+    /* another map may be filling it, which can take a while */
+    std::unique_lock<std::mutex> lock(grid.m_Mutex, std::defer_lock);
+    while(!lock.try_lock()) {
+        if(m_bCancel)
+            return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    if(grid.m_bFilled)
+        return true;
+    /* cancelled while another map filled it */
+    if(m_bCancel)
+        return false;
 
-      cachepage = !cachepage;
-      BuildParamCache(m_Cache[cachepage], lat+m_Step);
+    const int band = 16;
+    int rows = grid.m_Rows, cols = grid.m_Cols;
+    grid.m_Values.resize(rows*cols);
+    float *values = &grid.m_Values[0];
+    grid.m_bExact = GridExact(source, -MAX_LAT, -180, m_Step);
+    bool probed = false;
+    for(int r0 = 0; r0 < rows && !m_bCancel; r0 += band) {
+        int r1 = wxMin(r0 + band, rows);
+        if(CalcGrid(source, -MAX_LAT + r0*m_Step, -180, m_Step, r1 - r0, cols, values + r0*cols))
+            continue;
+
+        grid.m_bExact = false;
+        /* anything CalcParameter sets up on first use is set up here,
+           before the rows call it from several threads */
+        if(!probed)
+            CalcParameter(source, 0, 0);
+        probed = true;
+        ParallelFor(r0, r1, [&](int start, int end) {
+                for(int r = start; r < end && !m_bCancel; r++)
+                    for(int c = 0; c < cols; c++)
+                        values[r*cols + c] = CalcParameter(source, -MAX_LAT + r*m_Step,
+                                                           -180 + c*m_Step);
+            });
+    }
 
-      int latind = floor((lat+MAX_LAT)/ZONE_SIZE);
-      if(latind>LATITUDE_ZONES-1)
-          latind = LATITUDE_ZONES-1;
-      for(double lon = -180; lon+m_Step <= 180; lon += m_Step) {
-          int lonind = floor((lon+180)/ZONE_SIZE);
+    if(m_bCancel)
+        return false;
+    grid.m_bFilled = true;
+    return true;
+}
 
-          PlotRegion(m_map[latind][lonind], lat, lon, lat+m_Step, lon+m_Step,
+/* contour each cell of the grid calibrated, false if the grids are not
+   exact between samples or the cells do not fit the zones */
+bool IsoBarMap::ContourGrid()
+{
+    double cellsperzone = ZONE_SIZE / m_Step;
+    if(!m_Grid[0]->m_bExact || (m_Sources == 2 && !m_Grid[1]->m_bExact) ||
+       cellsperzone != floor(cellsperzone))
+        return false;
+
+    int rows = m_Grid[0]->m_Rows, cols = m_Grid[0]->m_Cols;
+    std::vector<float> values(rows*cols);
+    for(int i=0; i<rows*cols; i++)
+        values[i] = GridValue(i);
+
+    /* zones only add to their own segments */
+    int zonecells = cellsperzone;
+    ParallelFor(0, LATITUDE_ZONES, [&](int zstart, int zend) {
+            for(int latind = zstart; latind < zend && !m_bCancel; latind++) {
+                for(int r = latind*zonecells; r < (latind+1)*zonecells && r < rows-1; r++) {
+                    const float *row0 = &values[r*cols], *row1 = row0 + cols;
+                    for(int c = 0; c < cols-1; c++) {
+                        double v[4] = {row0[c], row0[c+1], row1[c+1], row1[c]};
+                        ContourCell(m_map[latind][c / zonecells],
+                                    -MAX_LAT + r*m_Step, -180 + c*m_Step, v);
+                    }
+                }
+                ZoneDone(latind);
+            }
+        });
+
+    return true;
+}
+
+/* the rows of one zone of latitude, which only add to that zone's lists */
+void IsoBarMap::ComputeZone(IsoBarBand &band, int latind)
+{
+    double min = -MAX_LAT + latind*ZONE_SIZE, max = min + ZONE_SIZE;
+
+    band.min = band.max = NAN;
+
+    for(double lat = min; lat < max && lat + m_Step <= MAX_LAT; lat += m_Step) {
+        if(m_bCancel)
+            return;
+
+        for(double lon = -180; lon+m_Step <= 180; lon += m_Step) {
+            int lonind = floor((lon+180)/ZONE_SIZE);
+
+            PlotRegion(band, m_map[latind][lonind], lat, lon, lat+m_Step, lon+m_Step,
 #ifdef WIN32
-                     4
+                       4
 #else
-                     5
+                       5
 #endif
 );
-      }
+        }
+    }
+}
+
+/* the recursive search over every zone, false if cancelled */
+bool IsoBarMap::ComputeZones()
+{
+  IsoBarBand bands[LATITUDE_ZONES];
+  ParallelFor(0, LATITUDE_ZONES, [&](int zstart, int zend) {
+          for(int latind = zstart; latind < zend && !m_bCancel; latind++) {
+              ComputeZone(bands[latind], latind);
+              ZoneDone(latind);
+          }
+      });
+
+  if(m_bCancel)
+      return false;
+
+  for(int latind = 0; latind < LATITUDE_ZONES; latind++) {
+      IsoBarBand &band = bands[latind];
+      if(isnan(band.min))
+          continue;
+      if(isnan(m_MinContour) || band.min < m_MinContour)
+          m_MinContour = band.min;
+      if(isnan(m_MaxContour) || band.max > m_MaxContour)
+          m_MaxContour = band.max;
   }
 
-  if (progressdialog) progressdialog->Destroy();
+  return true;
+}
 
-  m_bComputing = false;
+/* runs on the map's own thread */
+bool IsoBarMap::Recompute()
+{
+  for(int source = 0; source < m_Sources; source++)
+      if(!SampleGrid(source))
+          return false;
+
+  for(unsigned int i=0; i<m_Grid[0]->m_Values.size(); i++) {
+      double v = GridValue(i);
+      if(isnan(m_MinContour) || v < m_MinContour)
+          m_MinContour = v;
+      if(isnan(m_MaxContour) || v > m_MaxContour)
+          m_MaxContour = v;
+  }
+
+  /* contouring the grid is exact for data that is bilinear between
+     samples, and much faster */
+  bool ret = (!m_bPolar && ContourGrid()) || ComputeZones();
+  if(!ret || m_bCancel)
+      return false;
 
   m_MinContour /= m_Spacing;
   m_MinContour = floor(m_MinContour);
@@ -402,39 +741,10 @@ bool IsoBarMap::Recompute(wxWindow *parent)
   for(int i=0; i<m_contourcachesize; i++)
       m_contourcache[i] = ContourCacheData(m_MinContour + i*m_Spacing);
 
+  m_bFinished = true;
   return true;
 }
 
-/* draw a line segment in opengl from lat/lon and viewport */
-void DrawLineSeg(piDC *dc, PlugIn_ViewPort &VP, double lat1, double lon1, double lat2, double lon2)
-{
-    /* avoid lines which cross over the view port the long way */
-    if(lon1+180 < VP.clon && lon2+180 > VP.clon)
-        return;
-    if(lon1+180 > VP.clon && lon2+180 < VP.clon)
-        return;
-    if(lon1-180 < VP.clon && lon2-180 > VP.clon)
-        return;
-    if(lon1-180 > VP.clon && lon2-180 < VP.clon)
-        return;
-
-    wxPoint r1, r2;
-    GetCanvasPixLL(&VP, &r1, lat1, lon1);
-    GetCanvasPixLL(&VP, &r2, lat2, lon2);
-
-    if(dc)
-        dc->DrawLine(r1.x, r1.y, r2.x, r2.y);
-    else
-    {
-#if 0
-        glBegin(GL_LINES);
-        glVertex2i(r1.x, r1.y);
-        glVertex2i(r2.x, r2.y);
-        glEnd();
-#endif
-    }
-}
-
 /* reset the map and clear all the data so it can be reused */
 void IsoBarMap::ClearMap()
 {
@@ -442,6 +752,16 @@ void IsoBarMap::ClearMap()
         for(int lonind=0; lonind<LONGITUDE_ZONES; lonind++)
             m_map[latind][lonind].clear();
 
+    for(int latind=0; latind<LATITUDE_ZONES; latind++)
+        for(int level=0; level<ISOBAR_LEVELS; level++) {
+            IsoBarLines &lines = m_lines[latind][level];
+#ifdef USE_GLSL
+            if(lines.buffer)
+                glDeleteBuffers(1, &lines.buffer);
+#endif
+            lines = IsoBarLines();
+        }
+
     delete [] m_contourcache;
 
     m_MinContour = m_MaxContour = NAN;
@@ -461,15 +781,15 @@ ContourText IsoBarMap::ContourCacheData(double value)
 }
 
 /* draw text of the value of a conptour at a given location */
-void IsoBarMap::DrawContour(piDC *dc, PlugIn_ViewPort &VP, double contour, double lat, double lon)
+void IsoBarMap::DrawContour(piDC *dc, PlugIn_ViewPort &VP, double contour, const wxPoint &r)
 {
     int index = (contour - m_MinContour) / m_Spacing;
     if(index < 0 || index >= m_contourcachesize)
         return;
 
-    wxPoint r;
+    if(r.x < 0 || r.y < 0 || r.x > VP.pix_width || r.y > VP.pix_height)
+        return;
 
-    GetCanvasPixLL(&VP, &r, lat, lon);
     ContourText &ct = m_contourcache[index];
 
     double dist_squared1 = square(r.x-ct.lastx)
@@ -487,47 +807,203 @@ void IsoBarMap::DrawContour(piDC *dc, PlugIn_ViewPort &VP, double contour, doubl
     dc->DrawText(ct.text, r.x - ct.w/2, r.y - ct.h/2);
 }
 
-/* plot to dc, or opengl is dc is NULL */
-void IsoBarMap::Plot(piDC *dc, PlugIn_ViewPort &vp)
+/* the map to plot a zone from, previous while not yet done here */
+IsoBarMap *IsoBarMap::PlotMap(int latind, IsoBarMap *previous)
+{
+    if(m_bZoneDone[latind])
+        return this;
+    if(previous && previous->m_bZoneDone[latind])
+        return previous;
+    return NULL;
+}
+
+#ifdef USE_GLSL
+static const GLchar* isobar_vertex_shader_source =
+    "attribute vec2 aPos;\n"
+    "uniform mat2 uMatrix;\n"
+    "uniform vec2 uOrigin;\n"
+    "uniform vec2 uOffset;\n"
+    "void main() {\n"
+    "   gl_Position = vec4(uMatrix * (aPos - uOrigin) + uOffset, 0.0, 1.0);\n"
+    "}\n";
+
+static const GLchar* isobar_fragment_shader_source =
+    "precision mediump float;\n"
+    "uniform vec4 uColor;\n"
+    "void main() {\n"
+    "   gl_FragColor = uColor;\n"
+    "}\n";
+
+/* made on first use, 0 if the shaders failed */
+static GLuint s_IsoBarProgram;
+static bool s_bIsoBarProgramTried = false;
+
+static GLuint IsoBarProgram()
+{
+    if(s_bIsoBarProgramTried)
+        return s_IsoBarProgram;
+    s_bIsoBarProgramTried = true;
+
+    wxString error;
+    s_IsoBarProgram = MercatorView::Program(isobar_vertex_shader_source,
+                                            isobar_fragment_shader_source, error);
+    if(!s_IsoBarProgram)
+        wxLogMessage(wxString("climatology_pi: ") + _("isobar shader: ") + error);
+    return s_IsoBarProgram;
+}
+#endif
+
+/* each zone of latitude is one draw of its segments for each turn
+   of the globe in view, the projection being done by opengl.  With
+   shaders the segments are moved to the card the first time */
+bool IsoBarMap::PlotGL(const MercatorView &view, IsoBarMap *previous, int level,
+                       int startlatind, int endlatind)
+{
+#ifdef USE_GLSL
+    GLuint program = IsoBarProgram();
+    if(!program)
+        return false;
+
+    glUseProgram(program);
+    glUniform4f(glGetUniformLocation(program, "uColor"), m_Color.Red()/255.0,
+                m_Color.Green()/255.0, m_Color.Blue()/255.0, m_Color.Alpha()/255.0);
+    GLint posAttrib = glGetAttribLocation(program, "aPos");
+    glEnableVertexAttribArray(posAttrib);
+    glLineWidth(3);
+
+    for(int latind = startlatind; latind <= endlatind; latind++) {
+        IsoBarMap *map = PlotMap(latind, previous);
+        if(!map)
+            continue;
+        IsoBarLines *lines = &map->m_lines[latind][level];
+        if(!lines->count)
+            continue;
+
+        if(!lines->buffer) {
+            glGenBuffers(1, &lines->buffer);
+            glBindBuffer(GL_ARRAY_BUFFER, lines->buffer);
+            glBufferData(GL_ARRAY_BUFFER, lines->vertices.size()*sizeof(float),
+                         &lines->vertices[0], GL_STATIC_DRAW);
+            std::vector<float>().swap(lines->vertices);
+        } else
+            glBindBuffer(GL_ARRAY_BUFFER, lines->buffer);
+
+        glVertexAttribPointer(posAttrib, 2, GL_FLOAT, GL_FALSE, 0, (GLvoid*)0);
+        for(int turns = view.m_turns_min; turns <= view.m_turns_max; turns++) {
+            view.Uniforms(program, turns);
+            glDrawArrays(GL_LINES, 0, lines->count);
+        }
+    }
+
+    glDisableVertexAttribArray(posAttrib);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+#else
+    glColor4ub(m_Color.Red(), m_Color.Green(), m_Color.Blue(), m_Color.Alpha());
+    glLineWidth(3);
+    glEnableClientState(GL_VERTEX_ARRAY);
+
+    for(int turns = view.m_turns_min; turns <= view.m_turns_max; turns++) {
+        view.PushMatrix(turns);
+        for(int latind = startlatind; latind <= endlatind; latind++) {
+            IsoBarMap *map = PlotMap(latind, previous);
+            if(!map || !map->m_lines[latind][level].count)
+                continue;
+            IsoBarLines *lines = &map->m_lines[latind][level];
+            glVertexPointer(2, GL_FLOAT, 0, &lines->vertices[0]);
+            glDrawArrays(GL_LINES, 0, lines->count);
+        }
+        glPopMatrix();
+    }
+
+    glDisableClientState(GL_VERTEX_ARRAY);
+#endif
+    return true;
+}
+
+void IsoBarMap::PlotDC(piDC *dc, const MercatorView &view, IsoBarMap *previous, int level,
+                       int startlatind, int endlatind)
 {
-    if(dc) {
-        dc->SetPen(wxPen(m_Color, 3));
-    } else {
-//        glLineWidth(3.0);
-//        glColor4ub(m_Color.Red(), m_Color.Green(), m_Color.Blue(), m_Color.Alpha());
+    std::vector<wxPoint> pixels;
+
+    dc->SetPen(wxPen(m_Color, 3));
+    for(int latind = startlatind; latind <= endlatind; latind++) {
+        IsoBarMap *map = PlotMap(latind, previous);
+        if(!map)
+            continue;
+        IsoBarLines *lines = &map->m_lines[latind][level];
+
+        for(unsigned int i=0; i<lines->polylines.size(); i++) {
+            const IsoBarLines::Polyline &p = lines->polylines[i];
+            if(p.y_max < view.m_y_min || p.y_min > view.m_y_max)
+                continue;
+
+            for(int turns = view.m_turns_min; turns <= view.m_turns_max; turns++) {
+                if(p.x_max + turns < view.m_x_min || p.x_min + turns > view.m_x_max)
+                    continue;
+
+                pixels.resize(p.count);
+                const float *q = &lines->points[2*p.start];
+                for(int j=0; j<p.count; j++)
+                    view.Pixel(q[2*j], q[2*j+1], turns, pixels[j]);
+                dc->DrawLines(p.count, &pixels[0]);
+            }
+        }
     }
+}
 
+/* contour labels are only known once the whole map is, and are tried
+   every so many points along each polyline */
+void IsoBarMap::PlotLabels(piDC *dc, const MercatorView &view, IsoBarMap *previous, int level,
+                           int startlatind, int endlatind)
+{
+    const int spacing = 16;
+    for(int latind = startlatind; latind <= endlatind; latind++) {
+        IsoBarMap *map = PlotMap(latind, previous);
+        if(!map || !map->m_bFinished)
+            continue;
+
+        IsoBarLines &lines = map->m_lines[latind][level];
+        for(unsigned int i=0; i<lines.polylines.size(); i++) {
+            const IsoBarLines::Polyline &p = lines.polylines[i];
+            if(p.y_max < view.m_y_min || p.y_min > view.m_y_max)
+                continue;
+
+            for(int turns = view.m_turns_min; turns <= view.m_turns_max; turns++) {
+                if(p.x_max + turns < view.m_x_min || p.x_min + turns > view.m_x_max)
+                    continue;
+
+                const float *q = &lines.points[2*p.start];
+                for(int j = wxMin(p.count/2, spacing/2); j < p.count; j += spacing) {
+                    wxPoint r;
+                    view.Pixel(q[2*j], q[2*j+1], turns, r);
+                    map->DrawContour(dc, view.m_vp, p.contour, r);
+                }
+            }
+        }
+    }
+}
+
+/* plot to dc, the segments going straight to opengl in mercator */
+void IsoBarMap::Plot(piDC *dc, PlugIn_ViewPort &vp, IsoBarMap *previous)
+{
     int startlatind = floor((vp.lat_min+MAX_LAT)/ZONE_SIZE);
     if(startlatind < 0) startlatind = 0;
 
     int endlatind = floor((vp.lat_max+MAX_LAT)/ZONE_SIZE);
     if(endlatind > LATITUDE_ZONES-1) endlatind = LATITUDE_ZONES-1;
 
-    double lon_min = vp.lon_min; /* expected +- 360 convert to +- 180 */
-    if(lon_min<-180) lon_min+=360; else if(lon_min>=180) lon_min-=360;
-    int startlonind = floor((lon_min+180)/ZONE_SIZE);
-    if(startlonind < 0) startlonind = LONGITUDE_ZONES-1;
-    if(startlonind > LONGITUDE_ZONES-1) startlonind = 0;
-
-    double lon_max = vp.lon_max; /* expected +- 360 convert to +- 180 */
-    if(lon_max<-180) lon_max+=360; else if(lon_max>=180) lon_max-=360;
-    int endlonind = floor((lon_max+180)/ZONE_SIZE);
-    if(endlonind < 0) endlonind = LONGITUDE_ZONES-1;
-    if(endlonind > LONGITUDE_ZONES-1) endlonind = 0;
-
-    for(int latind = startlatind; latind <= endlatind; latind++)
-        for(int lonind = startlonind;;lonind++) {
-            if(lonind > LONGITUDE_ZONES-1)
-                lonind = 0;
-            for(std::list<PlotLineSeg>::iterator it = m_map[latind][lonind].begin();
-                it!=m_map[latind][lonind].end(); it++) {
-                DrawLineSeg(dc, vp, (*it).lat1, (*it).lon1, (*it).lat2, (*it).lon2);
-                wxString msg;
-                DrawContour(dc, vp, (*it).contour,
-                            ((*it).lat1 + (*it).lat2)/2,
-                            ((*it).lon1 + (*it).lon2)/2);
-            }
-            if(lonind == endlonind)
-                break;
-        }
+    /* the coarsest level still within half a pixel, keeping about as
+       many segments on screen at any scale */
+    double pixels_per_turn = vp.view_scale_ppm * 40075016.7 * cos(deg2rad(vp.clat));
+    double tolerance = ISOBAR_TOLERANCE;
+    int level = 0;
+    while(level < ISOBAR_LEVELS-1 && 2*4*tolerance*pixels_per_turn <= .5)
+        level++, tolerance *= 4;
+
+    MercatorView view(vp, -.5);
+    if(dc->GetDC() || !view.m_bMercator ||
+       !PlotGL(view, previous, level, startlatind, endlatind))
+        PlotDC(dc, view, previous, level, startlatind, endlatind);
+
+    PlotLabels(dc, view, previous, level, startlatind, endlatind);
 }
@@ -24,7 +24,11 @@
  ***************************************************************************
  */
 
-#include <list>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 
 /* must be a power of 2, and also divide 360 and 176;
@@ -37,6 +41,11 @@
 #define LATITUDE_ZONES (2*MAX_LAT/ZONE_SIZE) /* perfectly divisible */
 #define LONGITUDE_ZONES (360/ZONE_SIZE)
 
+/* each level of detail after the first keeps the lines to within
+   ISOBAR_TOLERANCE * 4^level turns of longitude of the full lines */
+#define ISOBAR_LEVELS 6
+#define ISOBAR_TOLERANCE 2.5e-6
+
 /* a single line segment in the plot */
 class PlotLineSeg
 {
@@ -47,18 +56,55 @@ public:
     double contour;
 };
 
-/* cache values computed to improve speed */
-class ParamCache
+/* a zone of latitude's segments joined end to end into polylines, in
+   mercator coordinates (see MercatorView) */
+struct IsoBarLines
+{
+    struct Polyline
+    {
+        int start, count; /* points, into points */
+        double contour;
+        float x_min, x_max, y_min, y_max;
+    };
+
+    IsoBarLines() : buffer(0), count(0) {}
+
+    std::vector<float> points; /* x, y */
+    std::vector<Polyline> polylines;
+
+    /* every segment again as its own pair of points so opengl draws
+       the zone in one call, moved to the card when there are shaders */
+    std::vector<float> vertices;
+    unsigned int buffer, count;
+};
+
+/* the parameter sampled at every step over the map, before it is
+   calibrated.  Maps of the same data at the same step share one, so
+   changing only how it is contoured (spacing, units) does not sample
+   it again */
+class IsoBarGrid
 {
 public:
-ParamCache() : values(NULL), m_step(0) {}
-    ~ParamCache() { delete [] values; }
-    void Initialize(double step);
-    bool Read(double lat, double lon, double &value);
-
-    double *values;
-    double m_step;
-    double m_lat;
+    IsoBarGrid(double step);
+    /* the value at a sample, false if (lat, lon) is not one */
+    bool Read(double lat, double lon, double &value) const;
+
+    std::mutex m_Mutex; /* held while filling, waited for with try_lock
+                           so a cancelled map need not wait */
+    bool m_bFilled;
+    bool m_bExact; /* from CalcGrid and GridExact, so bilinear between samples */
+
+    double m_Step;
+    int m_Rows, m_Cols; /* north from -MAX_LAT, east from -180 */
+    std::vector<float> m_Values;
+};
+
+/* what one band of latitudes is computed with, so that bands can be
+   computed at the same time */
+struct IsoBarBand
+{
+    /* range of the values found away from the grid samples */
+    double min, max;
 };
 
 class ContourText
@@ -70,44 +116,101 @@ public:
 };
 
 class piDC;
+class MercatorView;
 /* main model map suitable for a single plot type */
 class IsoBarMap
 {
 public:
-    IsoBarMap(wxString name, double spacing, double step);
+    /* the map is of source 0, or with ngrid of source 0 at weight
+       blended with source 1 (as months are blended by day).  Grids are
+       shared with other maps of the same source, or NULL */
+    IsoBarMap(wxString name, double spacing, double step,
+              std::shared_ptr<IsoBarGrid> grid = std::shared_ptr<IsoBarGrid>(),
+              std::shared_ptr<IsoBarGrid> ngrid = std::shared_ptr<IsoBarGrid>(),
+              double weight = 1);
     virtual ~IsoBarMap();
 
-    bool Recompute(wxWindow *parent);
+    /* compute on a thread of its own */
+    void Start();
+    /* ask the thread to stop as soon as possible without waiting for
+       it, Running() tells when it has */
+    void Cancel() { m_bCancel = true; }
+    /* cancel and wait for the thread, subclasses must call this in
+       their destructor as CalcParameter is still being called */
+    void Stop();
+    bool Running() const { return m_bRunning; }
+    bool Finished() const { return m_bFinished; }
+    /* stopped before it finished, it has to be started again */
+    bool Cancelled() const { return m_bCancel && !m_bFinished; }
 
-    void Plot(piDC *dc, PlugIn_ViewPort &vp);
+    /* zones not done yet are plotted from previous if given */
+    void Plot(piDC *dc, PlugIn_ViewPort &vp, IsoBarMap *previous = NULL);
 
-    bool m_bNeedsRecompute, m_bComputing;
 protected:
     double m_Spacing, m_Step, m_PoleAccuracy;
 
 private:
-    virtual double CalcParameter(double lat, double lon) = 0;
-    double Parameter(double lat, double lon);
+    /* called from several threads at once while recomputing */
+    virtual double CalcParameter(int source, double lat, double lon) = 0;
+    /* contours are of calibrated values, the grid is not */
+    virtual double Calibrate(double value) { return value; }
+    /* fill values[row*cols + col] with the parameter at lat0 + row*step,
+       lon0 + col*step, or return false to have these rows found by
+       probing CalcParameter instead.  It is asked for a band of rows at
+       a time so cancelling is not held up by a whole grid */
+    virtual bool CalcGrid(int /*source*/, double /*lat0*/, double /*lon0*/, double /*step*/,
+                          int /*rows*/, int /*cols*/, float * /*values*/) { return false; }
+    /* whether the parameter is bilinear between the samples of a grid
+       from lat0, lon0 at step, as when the samples hold every node of a
+       bilinear source.  Only then is contouring the grid exact */
+    virtual bool GridExact(int /*source*/, double /*lat0*/, double /*lon0*/, double /*step*/)
+    { return false; }
+    double Parameter(IsoBarBand &band, double lat, double lon);
+    double GridValue(int index);
+
+    bool Recompute();
+    bool SampleGrid(int source);
 
-    void PlotRegion(std::list<PlotLineSeg> &region,
+    bool ContourGrid();
+    void ContourCell(std::vector<PlotLineSeg> &region, double lat, double lon, const double v[4]);
+
+    bool ComputeZones();
+    void ComputeZone(IsoBarBand &band, int latind);
+    void ZoneDone(int latind);
+    void StitchZone(int latind);
+    void PlotRegion(IsoBarBand &band, std::vector<PlotLineSeg> &region,
                     double lat1, double lon1, double lat2, double lon2,
                     int maxdepth);
-    void BuildParamCache(ParamCache &cache, double lat);
-    double CachedParameter(double lat, double lon);
-    bool Interpolate(double x1, double x2, double y1, double y2, bool lat,
+    double CachedParameter(IsoBarBand &band, double lat, double lon);
+    bool Interpolate(IsoBarBand &band, double x1, double x2, double y1, double y2, bool lat,
                      double lonval, double &rx, double &ry);
 
     void ClearMap();
     ContourText ContourCacheData(double value);
-    void DrawContour(piDC *dc, PlugIn_ViewPort &VP, double contour, double lat, double lon);
+    void DrawContour(piDC *dc, PlugIn_ViewPort &VP, double contour, const wxPoint &r);
+
+    IsoBarMap *PlotMap(int latind, IsoBarMap *previous);
+    bool PlotGL(const MercatorView &view, IsoBarMap *previous, int level,
+                int startlatind, int endlatind);
+    void PlotDC(piDC *dc, const MercatorView &view, IsoBarMap *previous, int level,
+                int startlatind, int endlatind);
+    void PlotLabels(piDC *dc, const MercatorView &view, IsoBarMap *previous, int level,
+                    int startlatind, int endlatind);
 
-    /* two caches for all longitudes alternate
-       places (step over each other) to cover the two latitudes
-       currently being built */
-    ParamCache m_Cache[2];
+    /* the line segments for the entire globe split into zones while
+       computing, each zone of latitude stitched into m_lines (at every
+       level of detail) once done */
+    std::vector<PlotLineSeg> m_map[LATITUDE_ZONES][LONGITUDE_ZONES];
+    IsoBarLines m_lines[LATITUDE_ZONES][ISOBAR_LEVELS];
 
-    /* the line segments for the entire globe split into zones */
-    std::list<PlotLineSeg> m_map[LATITUDE_ZONES][LONGITUDE_ZONES];
+    /* a zone is only added to by the computing thread until it is done,
+       and only read by the plot once it is */
+    std::thread m_Thread;
+    std::atomic<bool> m_bCancel, m_bFinished, m_bRunning;
+    std::atomic<bool> m_bZoneDone[LATITUDE_ZONES];
+    std::shared_ptr<IsoBarGrid> m_Grid[2];
+    int m_Sources;
+    double m_Weight;
 
     double m_MinContour, m_MaxContour;
     int m_contourcachesize;
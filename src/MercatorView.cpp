@@ -0,0 +1,183 @@
+/******************************************************************************
+ *
+ * Project:  OpenCPN
+ * Purpose:  Climatology Plugin
+ * Author:   Sean D'Epagnier
+ *
+ ***************************************************************************
+ *   Copyright (C) 2018 by Sean D'Epagnier                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,  USA.         *
+ ***************************************************************************
+ */
+
+#include <wx/wx.h>
+#include <wx/glcanvas.h>
+
+#ifdef __WXOSX__
+# include <OpenGL/OpenGL.h>
+# include <OpenGL/gl3.h>
+#endif
+
+#ifdef __OCPN__ANDROID__
+#include <qopengl.h>
+#include "GL/gl_private.h"
+#endif
+
+#ifdef USE_GLES2
+#include "GLES2/gl2.h"
+#endif
+
+#include <math.h>
+
+#include "climatology_pi.h"
+#include "MercatorView.h"
+
+MercatorView::MercatorView(PlugIn_ViewPort &vp, double west)
+    : m_vp(vp), m_bMercator(vp.m_projection_type == PI_PROJECTION_MERCATOR)
+{
+    m_turns_min = m_turns_max = 0;
+    m_x_min = m_y_min = -INFINITY;
+    m_x_max = m_y_max = INFINITY;
+    if(!m_bMercator)
+        return;
+
+    Mercator(vp.clat, vp.clon, m_center[0], m_center[1]);
+    wxPoint c, e, w;
+    GetCanvasPixLL(&vp, &c, vp.clat, vp.clon);
+    m_pixel[0] = c.x, m_pixel[1] = c.y;
+
+    /* measure eastward across a few thousand pixels for precision,
+       mercator is conformal so north is east turned a right angle */
+    double ppd = vp.view_scale_ppm * 40075016.7 / 360;
+    double span = wxMin(90, 2000 / ppd);
+    GetCanvasPixLL(&vp, &e, vp.clat, vp.clon + span);
+    GetCanvasPixLL(&vp, &w, vp.clat, vp.clon - span);
+    double ax = (e.x - w.x) / (2*span/360), ay = (e.y - w.y) / (2*span/360);
+    m_matrix[0][0] = ax, m_matrix[0][1] = ay;
+    m_matrix[1][0] = ay, m_matrix[1][1] = -ax;
+
+    /* invert at the corners for the bounds */
+    double det = m_matrix[0][0]*m_matrix[1][1] - m_matrix[0][1]*m_matrix[1][0];
+    if(!det)
+        return;
+    m_x_min = m_y_min = INFINITY;
+    m_x_max = m_y_max = -INFINITY;
+    for(int i=0; i<4; i++) {
+        double px = (i&1 ? vp.pix_width : 0) - m_pixel[0];
+        double py = (i&2 ? vp.pix_height : 0) - m_pixel[1];
+        double x = m_center[0] + ( m_matrix[1][1]*px - m_matrix[1][0]*py)/det;
+        double y = m_center[1] + (-m_matrix[0][1]*px + m_matrix[0][0]*py)/det;
+        m_x_min = wxMin(m_x_min, x), m_x_max = wxMax(m_x_max, x);
+        m_y_min = wxMin(m_y_min, y), m_y_max = wxMax(m_y_max, y);
+    }
+
+    m_turns_min = ceil(m_x_min - west - 1);
+    m_turns_max = floor(m_x_max - west);
+}
+
+void MercatorView::Mercator(double lat, double lon, double &x, double &y)
+{
+    /* finite, and past where isobars stop so they map back exactly */
+    lat = wxMax(-89, wxMin(89, lat));
+    x = lon / 360;
+    y = log(tan(M_PI/4 + deg2rad(lat)/2)) / (2*M_PI);
+}
+
+void MercatorView::Pixel(double x, double y, int turns, wxPoint &p) const
+{
+    if(!m_bMercator) {
+        double lat = rad2deg(atan(sinh(2*M_PI*y)));
+        GetCanvasPixLL(&m_vp, &p, lat, 360*x);
+        return;
+    }
+
+    x += turns - m_center[0], y -= m_center[1];
+    p.x = round(m_pixel[0] + m_matrix[0][0]*x + m_matrix[1][0]*y);
+    p.y = round(m_pixel[1] + m_matrix[0][1]*x + m_matrix[1][1]*y);
+}
+
+#ifdef USE_GLSL
+static GLuint CompileShader(GLenum type, const GLchar *source, wxString &error)
+{
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+
+    GLint success;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+    if(!success) {
+        char log[512];
+        glGetShaderInfoLog(shader, sizeof log, NULL, log);
+        error = log;
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+unsigned int MercatorView::Program(const char *vertex_source, const char *fragment_source,
+                                   wxString &error)
+{
+    GLuint vertex = CompileShader(GL_VERTEX_SHADER, vertex_source, error);
+    GLuint fragment = CompileShader(GL_FRAGMENT_SHADER, fragment_source, error);
+    if(!vertex || !fragment)
+        return 0;
+
+    GLuint program = glCreateProgram();
+    glAttachShader(program, vertex);
+    glAttachShader(program, fragment);
+    glLinkProgram(program);
+
+    GLint success;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if(!success) {
+        char log[512];
+        glGetProgramInfoLog(program, sizeof log, NULL, log);
+        error = log;
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+void MercatorView::Uniforms(unsigned int program, int turns) const
+{
+    /* pixels to clip coordinates */
+    double sx = 2.0 / m_vp.pix_width, sy = -2.0 / m_vp.pix_height;
+    GLfloat matrix[4] = {(GLfloat)(sx*m_matrix[0][0]), (GLfloat)(sy*m_matrix[0][1]),
+                         (GLfloat)(sx*m_matrix[1][0]), (GLfloat)(sy*m_matrix[1][1])};
+    glUniformMatrix2fv(glGetUniformLocation(program, "uMatrix"), 1, GL_FALSE, matrix);
+    glUniform2f(glGetUniformLocation(program, "uOffset"),
+                sx*m_pixel[0] - 1, sy*m_pixel[1] + 1);
+    glUniform2f(glGetUniformLocation(program, "uOrigin"),
+                m_center[0] - turns, m_center[1]);
+}
+#else
+void MercatorView::PushMatrix(int turns) const
+{
+    double ox = m_center[0] - turns, oy = m_center[1];
+    GLdouble matrix[16] = {
+        m_matrix[0][0], m_matrix[0][1], 0, 0,
+        m_matrix[1][0], m_matrix[1][1], 0, 0,
+        0, 0, 1, 0,
+        m_pixel[0] - m_matrix[0][0]*ox - m_matrix[1][0]*oy,
+        m_pixel[1] - m_matrix[0][1]*ox - m_matrix[1][1]*oy, 0, 1};
+
+    glPushMatrix();
+    glMultMatrixd(matrix);
+}
+#endif
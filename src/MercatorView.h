@@ -0,0 +1,73 @@
+/******************************************************************************
+ *
+ * Project:  OpenCPN
+ * Purpose:  Climatology Plugin
+ * Author:   Sean D'Epagnier
+ *
+ ***************************************************************************
+ *   Copyright (C) 2018 by Sean D'Epagnier                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,  USA.         *
+ ***************************************************************************
+ */
+
+#ifndef _MERCATORVIEW_H_
+#define _MERCATORVIEW_H_
+
+#include "wx/wx.h"
+
+class PlugIn_ViewPort;
+
+/* maps mercator coordinates, x being longitude in turns and y the
+   same scale northward, to the pixels of a viewport.  A mercator view
+   is an affine map of them, so opengl can project whole buffers of
+   lines; other projections go through the canvas a point at a time. */
+class MercatorView
+{
+public:
+    /* for data covering one turn east of west (in turns) */
+    MercatorView(PlugIn_ViewPort &vp, double west);
+
+    static void Mercator(double lat, double lon, double &x, double &y);
+
+    void Pixel(double x, double y, int turns, wxPoint &p) const;
+
+#ifdef USE_GLSL
+    /* link a program, 0 with error set if it fails */
+    static unsigned int Program(const char *vertex, const char *fragment, wxString &error);
+    /* set uMatrix, uOrigin and uOffset of program, which take aPos
+       drawn turns east to gl_Position = uMatrix*(aPos-uOrigin)+uOffset */
+    void Uniforms(unsigned int program, int turns) const;
+#else
+    /* push the modelview matrix and multiply in the map to pixels of
+       data drawn turns east, glPopMatrix undoes it */
+    void PushMatrix(int turns) const;
+#endif
+
+    PlugIn_ViewPort &m_vp;
+    bool m_bMercator;
+
+    double m_center[2]; /* mercator of the view centre */
+    double m_pixel[2];  /* and where it is on the screen */
+    double m_matrix[2][2]; /* pixels per unit east and north */
+
+    /* mercator covered by the view, and how many whole turns east
+       the data has to be drawn at to cover it */
+    double m_x_min, m_x_max, m_y_min, m_y_max;
+    int m_turns_min, m_turns_max;
+};
+
+#endif
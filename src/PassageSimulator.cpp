@@ -0,0 +1,168 @@
+/******************************************************************************
+ *
+ * Project:  OpenCPN
+ * Purpose:  Climatology Plugin
+ * Author:   Sean D'Epagnier
+ *
+ ***************************************************************************
+ *   Copyright (C) 2018 by Sean D'Epagnier                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,  USA.         *
+ ***************************************************************************
+ */
+
+#include <wx/wx.h>
+
+#include <math.h>
+#include <atomic>
+
+#include "climatology_pi.h"
+#include "PassageSimulator.h"
+#include "WindAtlasSampler.h"
+#include "ThreadPool.h"
+
+/* index and fraction of x in an ascending table, clamped at the ends */
+static int TableIndex(const double *table, int count, double x, double &d)
+{
+    if(count < 2 || x <= table[0]) {
+        d = 0;
+        return 0;
+    }
+    if(x >= table[count-1]) {
+        d = 1;
+        return count - 2;
+    }
+
+    int i = 0;
+    while(x > table[i+1])
+        i++;
+    d = (x - table[i]) / (table[i+1] - table[i]);
+    return i;
+}
+
+double SpeedPolar::BoatSpeed(double twa, double tws) const
+{
+    if(angles < 1 || windspeeds < 1)
+        return 0;
+
+    double ad, sd;
+    int a0 = TableIndex(angle, angles, twa, ad), a1 = wxMin(a0 + 1, angles - 1);
+    int s0 = TableIndex(windspeed, windspeeds, tws, sd), s1 = wxMin(s0 + 1, windspeeds - 1);
+
+    double b0 = (1-sd)*boatspeed[a0*windspeeds + s0] + sd*boatspeed[a0*windspeeds + s1];
+    double b1 = (1-sd)*boatspeed[a1*windspeeds + s0] + sd*boatspeed[a1*windspeeds + s1];
+    return (1-ad)*b0 + ad*b1;
+}
+
+double SpeedPolar::VMG(double twa, double tws) const
+{
+    double best = BoatSpeed(twa, tws);
+    for(int i=0; i<angles; i++) {
+        double vmg = BoatSpeed(angle[i], tws) * cos(deg2rad(angle[i] - twa));
+        if(vmg > best)
+            best = vmg;
+    }
+    return wxMax(best, 0);
+}
+
+bool PassageSimulator::RunMember(int member, const double *lat, const double *lon, int waypoints,
+                                 const SpeedPolar &polar, const wxDateTime &departure,
+                                 double window_days, double step_hours, double max_days,
+                                 wxUint64 seed, double &hours, double &gale_hours)
+{
+    wxUint64 memberseed = SplitMix64(seed ^ SplitMix64(member));
+
+    /* departure offset within the window, in whole minutes */
+    double offset = (SplitMix64(memberseed) >> 11) * (1.0 / 9007199254740992.0) * window_days;
+    wxDateTime start = departure + wxTimeSpan::Minutes((long)(offset * 24 * 60));
+
+    double plat = lat[0], plon = lon[0], t = 0;
+    gale_hours = 0;
+
+    for(int leg = 1, step = 0; leg < waypoints; step++) {
+        if(t > max_days * 24)
+            return false;
+
+        wxDateTime date = start + wxTimeSpan::Minutes((long)(t * 60));
+
+        double wdir, wspd;
+        if(m_factory.SampleWindAtlas(date, plat, plon, 1, SplitMix64(memberseed + step + 1),
+                                     &wdir, &wspd) != 1) {
+            /* no atlas here, fall back to the mean wind */
+            double values[4];
+            m_factory.getVector(ClimatologyOverlaySettings::WIND, plat, plon, &date, values);
+            wdir = values[DIRECTION], wspd = values[MAG];
+            if(isnan(wdir) || isnan(wspd))
+                wdir = wspd = 0;
+        }
+
+        double cu = 0, cv = 0, values[4];
+        if(m_factory.getVector(ClimatologyOverlaySettings::CURRENT, plat, plon, &date, values) &&
+           !isnan(values[U]) && !isnan(values[V]))
+            cu = values[U], cv = values[V];
+
+        /* rhumb line toward the next waypoint in nautical miles */
+        double dlon = heading_resolve(lon[leg] - plon);
+        double dx = dlon * cos(deg2rad((plat + lat[leg]) / 2)) * 60, dy = (lat[leg] - plat) * 60;
+        double dist = hypot(dx, dy), bearing = atan2(dx, dy);
+
+        double twa = fabs(heading_resolve(rad2deg(bearing) - wdir));
+        double vmg = polar.VMG(twa, wspd);
+        double ve = vmg*sin(bearing) + cu, vn = vmg*cos(bearing) + cv;
+        double along = ve*sin(bearing) + vn*cos(bearing);
+
+        double dt = step_hours;
+        if(along > 0 && along * dt >= dist) {
+            dt = dist / along;
+            plat = lat[leg], plon = lon[leg];
+            leg++;
+        } else {
+            plat += vn * dt / 60;
+            plon += ve * dt / 60 / wxMax(cos(deg2rad(plat)), .01);
+        }
+
+        if(wspd >= GALE_KNOTS)
+            gale_hours += dt;
+        t += dt;
+    }
+
+    hours = t;
+    return true;
+}
+
+int PassageSimulator::Run(const double *lat, const double *lon, int waypoints,
+                          const SpeedPolar &polar, const wxDateTime &departure,
+                          double window_days, int members, double step_hours,
+                          double max_days, wxUint64 seed,
+                          double *hours, double *gale_hours)
+{
+    if(waypoints < 2 || members < 1 || step_hours <= 0)
+        return -1;
+
+    std::atomic<int> arrived(0);
+    /* one member per chunk, members vary a lot in length */
+    ParallelFor(0, members, [&](int start, int end) {
+            for(int i = start; i < end; i++) {
+                if(RunMember(i, lat, lon, waypoints, polar, departure, window_days,
+                             step_hours, max_days, seed, hours[i], gale_hours[i]))
+                    arrived++;
+                else
+                    hours[i] = NAN;
+            }
+        });
+
+    return arrived;
+}
@@ -0,0 +1,73 @@
+/******************************************************************************
+ *
+ * Project:  OpenCPN
+ * Purpose:  Climatology Plugin
+ * Author:   Sean D'Epagnier
+ *
+ ***************************************************************************
+ *   Copyright (C) 2018 by Sean D'Epagnier                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,  USA.         *
+ ***************************************************************************
+ */
+
+#ifndef _PASSAGESIMULATOR_H_
+#define _PASSAGESIMULATOR_H_
+
+#include "wx/wx.h"
+
+class ClimatologyOverlayFactory;
+
+/* boat speed in knots by true wind angle and speed, both ascending */
+struct SpeedPolar
+{
+    int angles, windspeeds;
+    const double *angle, *windspeed;
+    const double *boatspeed; /* boatspeed[angle*windspeeds + windspeed] */
+
+    double BoatSpeed(double twa, double tws) const;
+    /* best speed made good toward a course twa off the wind, tacking or
+       gybing when sailing at another angle is faster */
+    double VMG(double twa, double tws) const;
+};
+
+/* sails an ensemble of boats along a route through the climatology.
+   Each member departs at a random time in the window and every step
+   draws its wind from the wind atlas and drifts with the mean current,
+   giving a distribution of passage times rather than a single answer */
+class PassageSimulator
+{
+public:
+    PassageSimulator(ClimatologyOverlayFactory &factory) : m_factory(factory) {}
+
+    /* hours[i] is the passage time of member i or nan if it didn't
+       arrive within max_days, gale_hours[i] its time in winds of gale
+       force or more.  Returns how many members arrived */
+    int Run(const double *lat, const double *lon, int waypoints,
+            const SpeedPolar &polar, const wxDateTime &departure, double window_days,
+            int members, double step_hours, double max_days, wxUint64 seed,
+            double *hours, double *gale_hours);
+
+private:
+    bool RunMember(int member, const double *lat, const double *lon, int waypoints,
+                   const SpeedPolar &polar, const wxDateTime &departure, double window_days,
+                   double step_hours, double max_days, wxUint64 seed,
+                   double &hours, double &gale_hours);
+
+    ClimatologyOverlayFactory &m_factory;
+};
+
+#endif
@@ -0,0 +1,192 @@
+/******************************************************************************
+ *
+ * Project:  OpenCPN
+ * Purpose:  Climatology Plugin
+ * Author:   Sean D'Epagnier
+ *
+ ***************************************************************************
+ *   Copyright (C) 2018 by Sean D'Epagnier                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,  USA.         *
+ ***************************************************************************
+ */
+
+#include <algorithm>
+
+#include "ThreadPool.h"
+
+/* set while running loop chunks so nested loops don't wait on themselves */
+static thread_local bool s_bInLoop = false;
+
+ThreadPool::ThreadPool(int threads)
+    : m_fn(NULL), m_grain(1),
+      m_generation(0), m_active(0), m_bExit(false)
+{
+    if(threads <= 0)
+        threads = std::thread::hardware_concurrency();
+    if(threads <= 0)
+        threads = 1;
+
+    m_shares = new Share[threads];
+    for(int i=0; i<threads; i++)
+        m_shares[i].next = m_shares[i].end = 0;
+
+    for(int i=1; i<threads; i++)
+        m_threads.push_back(std::thread(&ThreadPool::Worker, this, i));
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_bExit = true;
+    }
+    m_wake.notify_all();
+
+    for(unsigned int i=0; i<m_threads.size(); i++)
+        m_threads[i].join();
+
+    delete [] m_shares;
+}
+
+ThreadPool &ThreadPool::Global()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+/* move the upper half of the fullest other share into ours */
+bool ThreadPool::Steal(int index)
+{
+    int count = Size();
+    for(;;) {
+        int victim = -1, most = 0;
+        for(int i=0; i<count; i++) {
+            if(i == index)
+                continue;
+            std::lock_guard<std::mutex> lock(m_shares[i].mutex);
+            int left = m_shares[i].end - m_shares[i].next;
+            if(left > most) {
+                most = left;
+                victim = i;
+            }
+        }
+
+        /* a share may belong to a worker that hasn't woken yet, so
+           take even the last few items rather than leave them */
+        if(victim == -1)
+            return false;
+
+        int start, end;
+        {
+            std::lock_guard<std::mutex> lock(m_shares[victim].mutex);
+            Share &v = m_shares[victim];
+            int left = v.end - v.next;
+            if(left <= 0)
+                continue; /* raced with the owner, look again */
+            end = v.end;
+            start = v.next + left/2;
+            v.end = start;
+        }
+
+        std::lock_guard<std::mutex> lock(m_shares[index].mutex);
+        m_shares[index].next = start;
+        m_shares[index].end = end;
+        return true;
+    }
+}
+
+void ThreadPool::RunChunks(int index)
+{
+    Share &share = m_shares[index];
+    for(;;) {
+        int start, end;
+        {
+            std::lock_guard<std::mutex> lock(share.mutex);
+            start = share.next;
+            end = std::min(start + m_grain, share.end);
+            share.next = end;
+        }
+
+        if(start < end)
+            (*m_fn)(start, end);
+        else if(!Steal(index))
+            break;
+    }
+}
+
+void ThreadPool::Worker(int index)
+{
+    s_bInLoop = true;
+    unsigned int generation = 0;
+    for(;;) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [&]{ return m_bExit || (m_fn && m_generation != generation); });
+            if(m_bExit)
+                return;
+            generation = m_generation;
+            m_active++;
+        }
+
+        RunChunks(index);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(--m_active == 0)
+            m_done.notify_all();
+    }
+}
+
+void ThreadPool::ParallelFor(int begin, int end, const std::function<void(int, int)> &fn, int grain)
+{
+    if(grain < 1)
+        grain = 1;
+
+    /* not worth waking anyone, or already inside a parallel loop */
+    if(end - begin <= grain || m_threads.empty() || s_bInLoop ||
+       !m_busy.try_lock()) {
+        for(int start = begin; start < end; start += grain)
+            fn(start, std::min(start + grain, end));
+        return;
+    }
+
+    /* equal contiguous shares, stealing evens out the rest */
+    int count = Size();
+    for(int i=0; i<count; i++) {
+        std::lock_guard<std::mutex> lock(m_shares[i].mutex);
+        m_shares[i].next = begin + (long)(end - begin) * i / count;
+        m_shares[i].end = begin + (long)(end - begin) * (i+1) / count;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_fn = &fn;
+        m_grain = grain;
+        m_generation++;
+    }
+    m_wake.notify_all();
+
+    s_bInLoop = true;
+    RunChunks(0);
+    s_bInLoop = false;
+
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done.wait(lock, [&]{ return m_active == 0; });
+        m_fn = NULL;
+    }
+    m_busy.unlock();
+}
@@ -0,0 +1,90 @@
+/******************************************************************************
+ *
+ * Project:  OpenCPN
+ * Purpose:  Climatology Plugin
+ * Author:   Sean D'Epagnier
+ *
+ ***************************************************************************
+ *   Copyright (C) 2018 by Sean D'Epagnier                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,  USA.         *
+ ***************************************************************************
+ */
+
+#ifndef _THREADPOOL_H_
+#define _THREADPOOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* a small pool of worker threads for splitting loops over the
+   climatology grids across cores.  The calling thread takes part in
+   the work, and a loop started from inside a worker (or while another
+   loop is running) simply runs on the calling thread.
+
+   Each participant starts with an equal share of the range, and once
+   its share is used up it steals the upper half of whichever share
+   has the most left, so uneven work (like ensemble members that take
+   very different times) still keeps every core busy */
+class ThreadPool
+{
+public:
+    ThreadPool(int threads = 0);
+    ~ThreadPool();
+
+    int Size() { return m_threads.size() + 1; }
+
+    /* call fn(start, end) over chunks of [begin, end) no larger than grain */
+    void ParallelFor(int begin, int end, const std::function<void(int, int)> &fn, int grain = 1);
+
+    static ThreadPool &Global();
+
+private:
+    struct Share
+    {
+        std::mutex mutex;
+        int next, end;
+    };
+
+    void Worker(int index);
+    void RunChunks(int index);
+    bool Steal(int index);
+
+    std::vector<std::thread> m_threads;
+    Share *m_shares;
+
+    std::mutex m_busy, m_mutex;
+    std::condition_variable m_wake, m_done;
+
+    const std::function<void(int, int)> *m_fn;
+    int m_grain;
+
+    unsigned int m_generation;
+    int m_active;
+    bool m_bExit;
+};
+
+static inline void ParallelFor(int begin, int end, const std::function<void(int, int)> &fn,
+                               int grain = 1)
+{
+    ThreadPool::Global().ParallelFor(begin, end, fn, grain);
+}
+
+#endif
@@ -0,0 +1,246 @@
+/******************************************************************************
+ *
+ * Project:  OpenCPN
+ * Purpose:  Climatology Plugin
+ * Author:   Sean D'Epagnier
+ *
+ ***************************************************************************
+ *   Copyright (C) 2018 by Sean D'Epagnier                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,  USA.         *
+ ***************************************************************************
+ */
+
+#include <wx/wx.h>
+
+#include <math.h>
+
+#include "climatology_pi.h"
+#include "WindAtlasSampler.h"
+#include "ThreadPool.h"
+
+/* uniform in [0, 1) depending only on the seed and counter */
+static inline double Uniform(wxUint64 seed, wxUint64 counter)
+{
+    return (SplitMix64(seed ^ SplitMix64(counter)) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+WindAtlasSampler::WindAtlasSampler(WindData **winddata)
+    : m_WindData(winddata)
+{
+    for(int m=0; m<13; m++) {
+        m_Rows[m] = NULL;
+        m_RowCount[m] = 0;
+    }
+}
+
+WindAtlasSampler::~WindAtlasSampler()
+{
+    Clear();
+}
+
+void WindAtlasSampler::Clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for(int m=0; m<13; m++) {
+        std::atomic<Alias*> *rows = m_Rows[m].exchange(NULL);
+        if(!rows)
+            continue;
+        for(int i=0; i<m_RowCount[m]; i++)
+            delete [] rows[i].load();
+        delete [] rows;
+    }
+}
+
+/* Vose's method over calm and each direction */
+void WindAtlasSampler::BuildRow(int month, int lati, Alias *row)
+{
+    WindData *w = m_WindData[month];
+    int n = w->dir_cnt + 1;
+
+    for(int loni = 0; loni < w->longitudes; loni++) {
+        WindData::WindPolar &polar = w->data[lati*w->longitudes + loni];
+        Alias &a = row[loni];
+        a.count = n;
+        if(polar.gale == 255)
+            continue;
+
+        int totald = 0;
+        for(int i=0; i<w->dir_cnt; i++)
+            totald += polar.directions[i];
+
+        double p[MAX_OUTCOMES];
+        double calm = totald ? wxMin(polar.calm / 100.0, 1.0) : 1;
+        p[0] = calm * n;
+        for(int i=0; i<w->dir_cnt; i++)
+            p[i+1] = totald ? (1 - calm) * polar.directions[i] / totald * n : 0;
+
+        int small[MAX_OUTCOMES], large[MAX_OUTCOMES], ns = 0, nl = 0;
+        for(int i=0; i<n; i++) {
+            a.alias[i] = i;
+            if(p[i] < 1)
+                small[ns++] = i;
+            else
+                large[nl++] = i;
+        }
+
+        while(ns && nl) {
+            int s = small[--ns], l = large[--nl];
+            a.prob[s] = p[s];
+            a.alias[s] = l;
+            p[l] -= 1 - p[s];
+            if(p[l] < 1)
+                small[ns++] = l;
+            else
+                large[nl++] = l;
+        }
+
+        /* whatever is left is 1 up to rounding */
+        while(nl) a.prob[large[--nl]] = 1;
+        while(ns) a.prob[small[--ns]] = 1;
+    }
+}
+
+const WindAtlasSampler::Alias *WindAtlasSampler::GetAlias(int month, int lati, int loni)
+{
+    WindData *w = m_WindData[month];
+    if(w->data[lati*w->longitudes + loni].gale == 255)
+        return NULL;
+
+    std::atomic<Alias*> *rows = m_Rows[month].load(std::memory_order_acquire);
+    Alias *row = rows ? rows[lati].load(std::memory_order_acquire) : NULL;
+    if(!row) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        rows = m_Rows[month];
+        if(!rows) {
+            rows = new std::atomic<Alias*>[w->latitudes];
+            for(int i=0; i<w->latitudes; i++)
+                rows[i] = NULL;
+            m_RowCount[month] = w->latitudes;
+            m_Rows[month].store(rows, std::memory_order_release);
+        }
+        row = rows[lati].load();
+        if(!row) {
+            row = new Alias[w->longitudes];
+            BuildRow(month, lati, row);
+            rows[lati].store(row, std::memory_order_release);
+        }
+    }
+    return &row[loni];
+}
+
+int WindAtlasSampler::Sample(int month, int nmonth, double dpos, double lat, double lon,
+                             int count, wxUint64 seed, double *directions, double *speeds)
+{
+    if(!m_WindData[month] || !m_WindData[nmonth])
+        return -1;
+
+    /* the mixture components: 4 corners of 2 months */
+    struct Component
+    {
+        const Alias *alias;
+        const WindData::WindPolar *polar;
+        WindData *data;
+        double weight;
+    } components[8];
+    int ncomponents = 0;
+    double total = 0;
+
+    double lats[2] = {floor(lat), ceil(lat)}, lons[2] = {floor(lon), ceil(lon)};
+    double latd = lat - lats[0], lond = lon - lons[0];
+    int months[2] = {month, nmonth};
+    double monthweights[2] = {dpos, 1 - dpos};
+
+    for(int mi = 0; mi < 2; mi++) {
+        WindData *w = m_WindData[months[mi]];
+        double latoff = 90.0/w->latitudes, lonoff = 180.0/w->longitudes;
+        for(int i = 0; i < 4; i++) {
+            int la = i / 2, lo = i % 2;
+            double weight = monthweights[mi] * (la ? latd : 1 - latd) * (lo ? lond : 1 - lond);
+            if(weight <= 0)
+                continue;
+
+            /* same cell selection as WindData::GetPolar */
+            int lati = round(w->latitudes*(.5 + (lats[la]-latoff)/180.0));
+            int loni = round(w->longitudes*(positive_degrees(lons[lo])-lonoff)/360.0);
+            if(loni == w->longitudes)
+                loni = 0;
+            if(lati < 0 || lati >= w->latitudes || loni < 0 || loni >= w->longitudes)
+                continue;
+
+            const Alias *alias = GetAlias(months[mi], lati, loni);
+            if(!alias)
+                continue;
+
+            Component &c = components[ncomponents++];
+            c.alias = alias;
+            c.polar = &w->data[lati*w->longitudes + loni];
+            c.data = w;
+            c.weight = weight;
+            total += weight;
+        }
+    }
+
+    if(!ncomponents)
+        return -1;
+
+    double cumulative[8];
+    double sum = 0;
+    for(int i=0; i<ncomponents; i++)
+        cumulative[i] = (sum += components[i].weight / total);
+    cumulative[ncomponents-1] = 1;
+
+    ParallelFor(0, count, [&](int start, int end) {
+            for(int j = start; j < end; j++) {
+                wxUint64 counter = (wxUint64)j * 6;
+                double r0 = Uniform(seed, counter), r1 = Uniform(seed, counter+1);
+                double r2 = Uniform(seed, counter+2), r3 = Uniform(seed, counter+3);
+                double r4 = Uniform(seed, counter+4), r5 = Uniform(seed, counter+5);
+
+                int ci = 0;
+                while(ci < ncomponents - 1 && r0 >= cumulative[ci])
+                    ci++;
+                const Component &c = components[ci];
+
+                int col = wxMin((int)(r1 * c.alias->count), c.alias->count - 1);
+                int outcome = r2 < c.alias->prob[col] ? col : c.alias->alias[col];
+                if(outcome == 0) {
+                    directions[j] = speeds[j] = 0;
+                    continue;
+                }
+
+                int dir = outcome - 1, dir_cnt = c.data->dir_cnt;
+                directions[j] = positive_degrees((dir + r3 - .5) * 360.0 / dir_cnt);
+
+                /* rayleigh with the mean speed of this direction, on the
+                   side of GALE_KNOTS the gale percentage picks.  The
+                   distribution of v*v is exponential, so past the
+                   threshold it is the threshold plus the same again */
+                double mean = c.polar->speeds[dir] / c.data->speed_multiplier;
+                double twosigma2 = 2 * mean * mean * 2 / M_PI;
+                double gale = wxMin(1.0, c.polar->gale / wxMax(1.0, 100.0 - c.polar->calm));
+                double g2 = GALE_KNOTS * GALE_KNOTS;
+                if(r5 < gale)
+                    speeds[j] = sqrt(g2 - twosigma2 * log(1 - r4));
+                else if(twosigma2 > 0)
+                    speeds[j] = sqrt(-twosigma2 * log(1 - r4 * (1 - exp(-g2 / twosigma2))));
+                else
+                    speeds[j] = 0;
+            }
+        }, 4096);
+
+    return count;
+}
@@ -0,0 +1,100 @@
+/******************************************************************************
+ *
+ * Project:  OpenCPN
+ * Purpose:  Climatology Plugin
+ * Author:   Sean D'Epagnier
+ *
+ ***************************************************************************
+ *   Copyright (C) 2018 by Sean D'Epagnier                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,  USA.         *
+ ***************************************************************************
+ */
+
+#ifndef _WINDATLASSAMPLER_H_
+#define _WINDATLASSAMPLER_H_
+
+#include <atomic>
+#include <mutex>
+
+#include "wx/wx.h"
+
+struct WindData;
+
+/* counter based random numbers: mix a seed with a counter */
+static inline wxUint64 SplitMix64(wxUint64 x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/* the atlas gale percentage counts winds of at least this speed */
+#define GALE_KNOTS 34
+
+/* draws random (direction, speed) samples from the wind atlas.  Each
+   atlas cell is a discrete distribution over calm and the directions,
+   kept as an alias table so a draw is constant time.  The tables for a
+   month are built a latitude row at a time, the first time any cell in
+   the row is sampled.
+
+   Speeds are rayleigh with the mean speed of the direction drawn, but
+   conditioned on the cell's gale percentage: a wind that is not calm is
+   a gale with probability gale / (100 - calm), and its speed is then
+   drawn from the part of the rayleigh distribution at or above
+   GALE_KNOTS, otherwise from the part below.  So the share of samples
+   at gale force matches the atlas whatever the mean speeds are.
+
+   Random numbers come from a counter based generator keyed by the
+   caller's seed, so sample i of a call is the same no matter which
+   thread draws it */
+class WindAtlasSampler
+{
+public:
+    WindAtlasSampler(WindData **winddata);
+    ~WindAtlasSampler();
+
+    /* discard the alias tables, the wind data is being freed */
+    void Clear();
+
+    /* mixture of the 4 surrounding cells of month and nmonth, weighted
+       as InterpolateWindAtlas.  Calm draws have speed 0 and direction 0.
+       Returns the number of samples or -1 without data */
+    int Sample(int month, int nmonth, double dpos, double lat, double lon,
+               int count, wxUint64 seed, double *directions, double *speeds);
+
+private:
+    enum {MAX_OUTCOMES = 9}; /* calm + 8 directions */
+
+    struct Alias
+    {
+        float prob[MAX_OUTCOMES];
+        wxUint8 alias[MAX_OUTCOMES];
+        wxUint8 count;
+    };
+
+    const Alias *GetAlias(int month, int lati, int loni);
+    void BuildRow(int month, int lati, Alias *row);
+
+    WindData **m_WindData;
+
+    std::mutex m_mutex;
+    std::atomic<std::atomic<Alias*>*> m_Rows[13];
+    int m_RowCount[13];
+};
+
+#endif
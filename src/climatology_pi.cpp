@@ -38,6 +38,7 @@
 #include "climatology_pi.h"
 #include "icons.h"
 #include "ClimatologyDialog.h"
+#include "PassageSimulator.h"
 
 
 ClimatologyOverlayFactory *g_pOverlayFactory = NULL;
@@ -224,17 +225,109 @@ static bool ClimatologyData(int setting, wxDateTime &date, double lat, double lo
 {
     s_climatology_pi->CreateOverlayFactory();
 
-    speed = g_pOverlayFactory->getValue(MAG, setting, lat, lon, &date);
+    double values[4];
+    g_pOverlayFactory->getVector(setting, lat, lon, &date, values);
+
+    speed = values[MAG];
     if(isnan(speed))
         return false;
 
-    dir = g_pOverlayFactory->getValue(DIRECTION, setting, lat, lon, &date);
+    dir = values[DIRECTION];
     if(isnan(dir))
         return false;
 
     return true;
 }
 
+static bool ClimatologyVectorData(int setting, wxDateTime &date, double lat, double lon,
+                                  double &u, double &v, double &speed, double &dir)
+{
+    s_climatology_pi->CreateOverlayFactory();
+
+    double values[4];
+    if(!g_pOverlayFactory->getVector(setting, lat, lon, &date, values))
+        return false;
+
+    u = values[U], v = values[V];
+    speed = values[MAG], dir = values[DIRECTION];
+    return !isnan(speed);
+}
+
+static bool ClimatologyGradientData(int setting, int coord, wxDateTime &date,
+                                    double lat, double lon,
+                                    double &value, double &dlat, double &dlon)
+{
+    s_climatology_pi->CreateOverlayFactory();
+
+    value = g_pOverlayFactory->getValueGradient((enum Coord)coord, setting, lat, lon,
+                                                &date, dlat, dlon);
+    return !isnan(value);
+}
+
+static int ClimatologyGradientBatchData(int setting, int coord, wxDateTime &date, int count,
+                                        const double *lat, const double *lon,
+                                        double *value, double *dlat, double *dlon)
+{
+    s_climatology_pi->CreateOverlayFactory();
+
+    return g_pOverlayFactory->getValueGradients((enum Coord)coord, setting, count,
+                                                lat, lon, &date, value, dlat, dlon);
+}
+
+static int ClimatologyRasterData(int setting, int coord, wxDateTime &date,
+                                 double lat0, double lon0, double dlat, double dlon,
+                                 int rows, int cols, float *buffer)
+{
+    s_climatology_pi->CreateOverlayFactory();
+
+    return g_pOverlayFactory->getRaster((enum Coord)coord, setting, &date,
+                                        lat0, lon0, dlat, dlon, rows, cols, buffer);
+}
+
+/* count is 12 for monthly values or 365 for a daily series */
+static bool ClimatologyYearData(int setting, int coord, double lat, double lon,
+                                int count, double *values)
+{
+    s_climatology_pi->CreateOverlayFactory();
+
+    if(count == 12)
+        return g_pOverlayFactory->getMonthlyValues((enum Coord)coord, setting, lat, lon, values);
+    if(count == 365)
+        return g_pOverlayFactory->getDailyValues((enum Coord)coord, setting, lat, lon, values);
+    return false;
+}
+
+/* the year of several datasets in one pass, values[i*count + n] for
+   settings[i] where count is 12 or 365 as above, returns how many
+   datasets had values */
+static int ClimatologyYearDataMulti(int nsettings, const int *settings, int coord,
+                                    double lat, double lon, int count, double *values)
+{
+    s_climatology_pi->CreateOverlayFactory();
+
+    if(count == 12)
+        return g_pOverlayFactory->getMonthlyValues((enum Coord)coord, nsettings, settings,
+                                                   lat, lon, values);
+    if(count == 365)
+        return g_pOverlayFactory->getDailyValues((enum Coord)coord, nsettings, settings,
+                                                 lat, lon, values);
+    return -1;
+}
+
+/* mean over the days less than dayrange/2 from date: dayrange is the
+   full width of the window, as for ClimatologyCycloneTrackCrossings.
+   dayrange/2 rounds down, so the window is date +-(dayrange/2 - 1) days:
+   30 or 31 averages 29 days, date +-14, and date +-15 needs 32 */
+static bool ClimatologyWindowData(int setting, int coord, wxDateTime &date, int dayrange,
+                                  double lat, double lon, double &value)
+{
+    s_climatology_pi->CreateOverlayFactory();
+
+    value = g_pOverlayFactory->getWindowAverage((enum Coord)coord, setting, lat, lon,
+                                                date, dayrange);
+    return !isnan(value);
+}
+
 static bool ClimatologyWindAtlasData(wxDateTime &date, double lat, double lon,
                                      int &count, double *directions, double *speeds,
                                      double &storm, double &calm)
@@ -249,6 +342,40 @@ static bool ClimatologyWindAtlasData(wxDateTime &date, double lat, double lon,
         (date, lat, lon, directions, speeds, storm, calm);
 }
 
+static int ClimatologyWindAtlasSamples(wxDateTime &date, double lat, double lon,
+                                       int count, unsigned long long seed,
+                                       double *directions, double *speeds)
+{
+    if(!g_pOverlayFactory)
+        return -1;
+
+    return g_pOverlayFactory->SampleWindAtlas(date, lat, lon, count, seed,
+                                              directions, speeds);
+}
+
+/* polar boatspeeds are indexed [angle*nwindspeeds + windspeed], hours
+   and gale_hours receive one value per member */
+static int ClimatologyPassageSimulation(const double *lat, const double *lon, int waypoints,
+                                        const double *angles, int nangles,
+                                        const double *windspeeds, int nwindspeeds,
+                                        const double *boatspeeds,
+                                        wxDateTime &departure, double window_days,
+                                        int members, double step_hours, double max_days,
+                                        unsigned long long seed,
+                                        double *hours, double *gale_hours)
+{
+    if(!g_pOverlayFactory)
+        return -1;
+
+    SpeedPolar polar;
+    polar.angles = nangles, polar.windspeeds = nwindspeeds;
+    polar.angle = angles, polar.windspeed = windspeeds, polar.boatspeed = boatspeeds;
+
+    return g_pOverlayFactory->GetPassageSimulator().Run
+        (lat, lon, waypoints, polar, departure, window_days, members,
+         step_hours, max_days, seed, hours, gale_hours);
+}
+
 static int ClimatologyCycloneTrackCrossings(double lat1, double lon1, double lat2, double lon2,
                                             const wxDateTime &date, int dayrange)
 {
@@ -259,6 +386,84 @@ static int ClimatologyCycloneTrackCrossings(double lat1, double lon1, double lat
                                                     date, dayrange);
 }
 
+static int ClimatologyCycloneTrackCrossingsBatch(int count,
+                                                 const double *lat1, const double *lon1,
+                                                 const double *lat2, const double *lon2,
+                                                 const wxDateTime *dates, int dayrange,
+                                                 int *crossings)
+{
+    if(!g_pOverlayFactory)
+        return -1;
+
+    return g_pOverlayFactory->CycloneTrackCrossingsBatch(count, lat1, lon1, lat2, lon2,
+                                                         dates, dayrange, crossings);
+}
+
+static void ClimatologyCycloneApproaches(const CycloneApproach *approaches, int count,
+                                         int *tracks, double *distances,
+                                         double *windknots, wxDateTime *times)
+{
+    for(int i=0; i<count; i++) {
+        const CycloneApproach &a = approaches[i];
+        if(tracks) tracks[i] = a.track;
+        if(distances) distances[i] = a.distance;
+        if(windknots) windknots[i] = a.windknots;
+        if(times) times[i] = CycloneTracks::DateTime(a.hours);
+    }
+}
+
+/* the closest approach of the count nearest storms within maxdistance
+   nautical miles, returns how many.  Callers should bound maxdistance:
+   when fewer than count storms pass near the position the search widens
+   ring by ring until maxdistance, so an unbounded search over a quiet
+   day window visits every cell of the globe */
+static int ClimatologyCycloneNearest(double lat, double lon, wxDateTime &date, int dayrange,
+                                     int count, double maxdistance, int *tracks,
+                                     double *distances, double *windknots, wxDateTime *times)
+{
+    if(!g_pOverlayFactory || count <= 0)
+        return -1;
+
+    std::vector<CycloneApproach> approaches(count);
+    int found = g_pOverlayFactory->CycloneNearest(lat, lon, date, dayrange, count, maxdistance,
+                                                  &approaches[0]);
+    ClimatologyCycloneApproaches(&approaches[0], found, tracks, distances, windknots, times);
+    return found;
+}
+
+/* storms passing within radius nautical miles, returns how many there
+   were though only the first count are filled in */
+static int ClimatologyCycloneWithin(double lat, double lon, wxDateTime &date, int dayrange,
+                                    double radius, int count, int *tracks, double *distances,
+                                    double *windknots, wxDateTime *times)
+{
+    if(!g_pOverlayFactory)
+        return -1;
+
+    std::vector<CycloneApproach> approaches;
+    int found = g_pOverlayFactory->CycloneWithin(lat, lon, date, dayrange, radius, approaches);
+    if(found > 0)
+        ClimatologyCycloneApproaches(&approaches[0], wxMin(found, count),
+                                     tracks, distances, windknots, times);
+    return found;
+}
+
+static bool ClimatologyCycloneDensity(wxDateTime &date, double lat, double lon,
+                                      double &tracks, double &intensity, double &maxwind)
+{
+    if(!g_pOverlayFactory)
+        return false;
+
+    double values[CycloneDensity::KINDS];
+    if(!g_pOverlayFactory->CycloneDensityValues(lat, lon, &date, values))
+        return false;
+
+    tracks = values[CycloneDensity::TRACKS];
+    intensity = values[CycloneDensity::INTENSITY];
+    maxwind = values[CycloneDensity::MAXWIND];
+    return true;
+}
+
 void climatology_pi::OnToolbarToolCallback(int id)
 {
     CreateOverlayFactory();
@@ -322,11 +527,50 @@ void climatology_pi::SendClimatology(bool valid)
     snprintf(ptr, sizeof ptr, "%p", valid ? ClimatologyData : NULL);
     v["ClimatologyDataPtr"] = ptr;
 
+    snprintf(ptr, sizeof ptr, "%p", valid ? ClimatologyVectorData : NULL);
+    v["ClimatologyVectorDataPtr"] = ptr;
+
+    snprintf(ptr, sizeof ptr, "%p", valid ? ClimatologyGradientData : NULL);
+    v["ClimatologyGradientDataPtr"] = ptr;
+
+    snprintf(ptr, sizeof ptr, "%p", valid ? ClimatologyGradientBatchData : NULL);
+    v["ClimatologyGradientBatchDataPtr"] = ptr;
+
+    snprintf(ptr, sizeof ptr, "%p", valid ? ClimatologyRasterData : NULL);
+    v["ClimatologyRasterDataPtr"] = ptr;
+
+    snprintf(ptr, sizeof ptr, "%p", valid ? ClimatologyYearData : NULL);
+    v["ClimatologyYearDataPtr"] = ptr;
+
+    snprintf(ptr, sizeof ptr, "%p", valid ? ClimatologyYearDataMulti : NULL);
+    v["ClimatologyYearDataMultiPtr"] = ptr;
+
+    snprintf(ptr, sizeof ptr, "%p", valid ? ClimatologyWindowData : NULL);
+    v["ClimatologyWindowDataPtr"] = ptr;
+
     snprintf(ptr, sizeof ptr, "%p", valid ? ClimatologyWindAtlasData : NULL);
     v["ClimatologyWindAtlasDataPtr"] = ptr;
 
+    snprintf(ptr, sizeof ptr, "%p", valid ? ClimatologyWindAtlasSamples : NULL);
+    v["ClimatologyWindAtlasSamplesPtr"] = ptr;
+
+    snprintf(ptr, sizeof ptr, "%p", valid ? ClimatologyPassageSimulation : NULL);
+    v["ClimatologyPassageSimulationPtr"] = ptr;
+
     snprintf(ptr, sizeof ptr, "%p", valid ? ClimatologyCycloneTrackCrossings : NULL);
     v["ClimatologyCycloneTrackCrossingsPtr"] = ptr;
+
+    snprintf(ptr, sizeof ptr, "%p", valid ? ClimatologyCycloneTrackCrossingsBatch : NULL);
+    v["ClimatologyCycloneTrackCrossingsBatchPtr"] = ptr;
+
+    snprintf(ptr, sizeof ptr, "%p", valid ? ClimatologyCycloneDensity : NULL);
+    v["ClimatologyCycloneDensityPtr"] = ptr;
+
+    snprintf(ptr, sizeof ptr, "%p", valid ? ClimatologyCycloneNearest : NULL);
+    v["ClimatologyCycloneNearestPtr"] = ptr;
+
+    snprintf(ptr, sizeof ptr, "%p", valid ? ClimatologyCycloneWithin : NULL);
+    v["ClimatologyCycloneWithinPtr"] = ptr;
     
     Json::FastWriter writer;
     SendPluginMessage(wxT("CLIMATOLOGY"), writer.write( v ));
@@ -70,6 +70,11 @@ static inline double rad2deg(double radians)
   return 180.0 * radians / M_PI;
 }
 
+static inline double deg2rad(double degrees)
+{
+  return M_PI * degrees / 180.0;
+}
+
 static inline double positive_degrees(double degrees)
 {
     while(degrees < 0)
@@ -78,3 +83,9 @@ static inline double positive_degrees(double degrees)
         degrees -= 360;
     return degrees;
 }
+
+/* wrap to [-180, 180) */
+static inline double heading_resolve(double degrees)
+{
+    return positive_degrees(degrees + 180) - 180;
+}